@@ -5,6 +5,8 @@
 #ifndef _B_URL_PROTOCOL_HTTP_H_
 #define _B_URL_PROTOCOL_HTTP_H_
 
+#include <memory>
+
 #include <Certificate.h>
 #include <Expected.h>
 #include <ErrorsExt.h>
@@ -29,6 +31,22 @@ public:
 
 	virtual						~BHttpRequest();
 
+	// Request modifiers
+			void				SetMethod(const BHttpMethod& method);
+			void				SetHttpVersion(int8 version);
+			void				AdoptInputData(BDataIO* data, ssize_t size = -1,
+									const BString& contentType
+										= "application/octet-stream");
+			void				SetProgressInterval(bigtime_t interval,
+									off_t bytes = 0);
+			void				SetTimeout(bigtime_t timeout);
+			void				SetConnectTimeout(bigtime_t timeout);
+			void				SetResponseTimeout(bigtime_t timeout);
+			void				SetReadTimeout(bigtime_t timeout);
+			void				SetMaxAttempts(int32 attempts);
+			void				SetFollowLocation(bool follow,
+									uint8 maxRedirects = 8);
+
 	static	bool				IsInformationalStatusCode(int16 code);
 	static	bool				IsSuccessStatusCode(int16 code);
 	static	bool				IsRedirectionStatusCode(int16 code);
@@ -60,10 +78,18 @@ private:
 			uint32				fOptAuthMethods;
 			BHttpHeaders*		fOptHeaders;
 			BHttpForm*			fOptPostFields;
-			BDataIO*			fOptInputData;
+			std::shared_ptr<BDataIO> fOptInputData;
 			ssize_t				fOptInputDataSize;
+			BString				fOptInputDataType;
 			off_t				fOptRangeStart;
 			off_t				fOptRangeEnd;
+			bigtime_t			fOptProgressInterval;
+			off_t				fOptProgressBytes;
+			bigtime_t			fOptTimeout;
+			bigtime_t			fOptConnectTimeout;
+			bigtime_t			fOptResponseTimeout;
+			bigtime_t			fOptReadTimeout;
+			int32				fOptMaxAttempts;
 			bool				fOptSetCookies : 1;
 			bool				fOptFollowLocation : 1;
 			bool				fOptDiscardData : 1;
@@ -75,7 +101,8 @@ private:
 // HTTP Version
 enum {
 	B_HTTP_10 = 1,
-	B_HTTP_11
+	B_HTTP_11,
+	B_HTTP_2
 };
 
 
@@ -117,7 +144,8 @@ enum http_status_code {
 	B_HTTP_STATUS_SEE_OTHER,
 	B_HTTP_STATUS_NOT_MODIFIED,
 	B_HTTP_STATUS_USE_PROXY,
-	B_HTTP_STATUS_TEMPORARY_REDIRECT,
+	B_HTTP_STATUS_TEMPORARY_REDIRECT = 307,
+	B_HTTP_STATUS_PERMANENT_REDIRECT,
 	B_HTTP_STATUS__REDIRECTION_END,
 
 	// Client error status codes
@@ -23,6 +23,19 @@ class BHttpHeaders;
 struct HttpResultPrivate;
 
 
+// Error codes of requests that ran out of time
+enum {
+	B_HTTP_CONNECT_TIMEOUT = B_ERRORS_END + 1,
+		// the connection could not be set up in time
+	B_HTTP_RESPONSE_TIMEOUT,
+		// the server did not start its response in time
+	B_HTTP_READ_TIMEOUT,
+		// the server stopped sending the response
+	B_HTTP_REQUEST_TIMEOUT
+		// the request as a whole took too long
+};
+
+
 struct BHttpStatus {
 	int32			code = 0;
 	std::string		text;
@@ -54,6 +67,7 @@ public:
 
 	// Identity
 	int32							Identity() const;
+	int32							Attempts() const;
 
 	// Destructor, copy and move
 									~BHttpResult();
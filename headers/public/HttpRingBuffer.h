@@ -0,0 +1,112 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _B_HTTP_RING_BUFFER_H_
+#define _B_HTTP_RING_BUFFER_H_
+
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include <DataIO.h>
+#include <Locker.h>
+#include <OS.h>
+
+
+namespace BPrivate {
+
+namespace Network {
+
+struct HttpResultPrivate;
+
+
+/*!	Ring buffer that streams data from one thread to another.
+
+	One thread writes to the ring, and one other thread reads from it at the
+	same time; neither takes a lock, and a thread only sleeps when it has to
+	wait for the other. The size of the buffer is fixed, so the memory that a
+	stream uses does not depend on its length.
+
+	When the ring is the target of a request, the session writes the body to it
+	while the request is running. When the ring is full, the session stops
+	receiving until the reader has made room. Read() returns 0 at the end of the
+	body, or when the request failed; the BHttpResult tells which of the two.
+
+	This is not the BMemoryRingIO of the Support Kit: that class takes a lock
+	for every access, and has no way to tell the session that there is room
+	again.
+*/
+class BHttpRingBuffer : public BDataIO {
+public:
+	static	const size_t		kDefaultBufferSize = 1024 * 1024;
+
+								BHttpRingBuffer(
+									size_t bufferSize = kDefaultBufferSize);
+	virtual						~BHttpRingBuffer();
+
+								BHttpRingBuffer(const BHttpRingBuffer&) = delete;
+			BHttpRingBuffer&	operator=(const BHttpRingBuffer&) = delete;
+
+	// Reading; waits until there is data, or until writing is disabled
+	virtual	ssize_t				Read(void* buffer, size_t size);
+			ssize_t				Read(void* buffer, size_t size,
+									bigtime_t timeout);
+			status_t			WaitForRead(
+									bigtime_t timeout = B_INFINITE_TIMEOUT);
+			size_t				BytesAvailable() const;
+
+	// Writing; does not wait, but writes what fits
+	virtual	ssize_t				Write(const void* buffer, size_t size);
+			status_t			WaitForWrite(
+									bigtime_t timeout = B_INFINITE_TIMEOUT);
+			size_t				SpaceAvailable() const;
+
+	// Disabling writing marks the end of the data
+			void				SetWriteDisabled(bool disabled);
+			bool				WriteDisabled() const;
+
+			size_t				BufferSize() const { return fSize; }
+
+private:
+	friend struct HttpResultPrivate;
+
+	// Let \a hook know, instead of a thread that waits in WaitForWrite(), when
+	// there is room again after _RequestSpace() was called
+			void				_SetSpaceHook(std::function<void()> hook);
+			void				_RequestSpace();
+			void				_CancelSpaceRequest();
+
+			bool				_CanRead() const;
+			bool				_CanWrite() const;
+			status_t			_Wait(std::atomic<bool>& waiting, sem_id sem,
+									bool (BHttpRingBuffer::*ready)() const,
+									bigtime_t timeout);
+			void				_WakeReader();
+			void				_WakeWriter();
+
+			std::unique_ptr<char[]> fBuffer;
+			size_t				fSize;
+			std::atomic<bool>	fWriteDisabled{false};
+
+	// Owned by the reader and the writer; they are kept apart, so that the two
+	// threads do not share a cache line.
+	alignas(64)	std::atomic<size_t> fReadPosition{0};
+			std::atomic<bool>	fReaderWaiting{false};
+			sem_id				fReadSem;
+	alignas(64)	std::atomic<size_t> fWritePosition{0};
+			std::atomic<bool>	fWriterWaiting{false};
+			sem_id				fWriteSem;
+
+			BLocker				fHookLock;
+			std::function<void()> fSpaceHook;
+};
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _B_HTTP_RING_BUFFER_H_
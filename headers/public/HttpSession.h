@@ -8,21 +8,38 @@
 
 #include <future>
 #include <memory>
+#include <optional>
 
 #include <Messenger.h>
 
 
 namespace BPrivate {
 
+class BError;
+
 namespace Network {
 
 class BHttpRequest;
 class BHttpResult;
+class BHttpRingBuffer;
+struct Http2Event;
+
+// Priority of a request. Requests with a higher priority are started first,
+// and their connections are read first.
+enum {
+	B_HTTP_PRIORITY_LOWEST = 0,
+	B_HTTP_PRIORITY_LOW,
+	B_HTTP_PRIORITY_NORMAL,
+	B_HTTP_PRIORITY_HIGH,
+	B_HTTP_PRIORITY_HIGHEST
+};
+
 
 class BHttpSession {
 public:
 	// Constructor & Destructor
 								BHttpSession();
+								BHttpSession(int32 dataThreadCount);
 								~BHttpSession() = default;
 
 	// Session modifiers
@@ -39,26 +56,129 @@ public:
 	void						GetProxyPort() { }
 	bool						HasCertificateException() { return false; }
 
+	// Connection pool
+	void						SetMaxIdleConnectionsPerHost(size_t count);
+	void						SetMaxIdleConnections(size_t count);
+	void						SetIdleConnectionTimeout(bigtime_t timeout);
+
+	// Connection setup
+	void						SetConnectTimeout(bigtime_t timeout);
+	void						SetMaxPipelineDepth(size_t depth);
+
+	// Requests in progress; the others wait for their turn
+	void						SetMaxRequestsPerHost(size_t count);
+	void						SetMaxRequests(size_t count);
+
+	// Retries of GET and HEAD requests after transient failures
+	void						SetMaxAttempts(int32 attempts);
+	void						SetRetryBackoff(bigtime_t initial,
+									bigtime_t maximum);
+	void						SetRetryBudget(int32 percent);
+
 	// Requests
 	BHttpResult					AddRequest(BHttpRequest request,
 									std::unique_ptr<BDataIO> target = nullptr,
-									BMessenger observer = BMessenger());
+									BMessenger observer = BMessenger(),
+									int8 priority = B_HTTP_PRIORITY_NORMAL);
+	BHttpResult					AddRequest(BHttpRequest request,
+									std::shared_ptr<BHttpRingBuffer> target,
+									BMessenger observer = BMessenger(),
+									int8 priority = B_HTTP_PRIORITY_NORMAL);
 	void						Cancel(int32 identifier);
 	void						Cancel(const BHttpResult& result);
 private:
 	struct Wrapper;
+	struct Connection;
+	struct Shard;
 	struct Data;
 	std::shared_ptr<Data>		fData;
 	static	status_t			ControlThreadFunc(void* arg);
 	static	status_t			DataThreadFunc(void* arg);
+	static	void				_Dispatch(Shard* shard, Wrapper&& request,
+									bool allowPipelining);
+	static	void				_WaitForConnection(Shard* shard,
+									Wrapper&& request, bool allowPipelining);
+	static	Connection&			_AddConnection(Shard* shard, Wrapper& request);
+	static	void				_AddToConnection(Shard* shard,
+									Connection& connection, Wrapper&& request);
+	static	void				_UpdateInterest(Shard* shard,
+									Connection& connection);
+	static	void				_ProcessEvent(Shard* shard,
+									Connection& connection, uint16 events);
+	static	void				_ConnectionWrite(Shard* shard,
+									Connection& connection);
+	static	bool				_ConnectionRead(Shard* shard,
+									Connection& connection);
+	static	void				_CancelRequest(Shard* shard, Wrapper& request,
+									const BError& error);
+	static	void				_CheckDeadlines(Shard* shard, Wrapper& request);
+	static	void				_DropRequest(Shard* shard,
+									Connection& connection, Wrapper& request,
+									std::optional<bool> success);
+	static	void				_DetachRequest(Shard* shard,
+									Connection& connection, Wrapper& request);
+	static	void				_CloseConnection(Shard* shard,
+									Connection& connection, const BError& error,
+									bool failover);
+	static	void				_RemoveConnection(Shard* shard,
+									Connection& connection, bool reuse);
+	static	void				_Failover(Shard* shard, Wrapper& request,
+									const BError& error);
+	static	void				_Resend(Shard* shard, Wrapper& request,
+									const BError& error);
+	static	void				_FailRequest(Shard* shard, Wrapper& request,
+									const BError& error);
+	static	void				_FollowRedirect(Shard* shard,
+									Connection& connection, Wrapper& request,
+									bool reuse);
 
 	// Helper Functions
-	static	void				_ResolveHostName(Wrapper& request);
-	static	void				_OpenConnection(Wrapper& request);
-	static	std::string			_CreateRequestHeaders(Wrapper& request);
+	static	BHttpResult			_AddRequest(Data* data, BHttpRequest&& request,
+									std::unique_ptr<BDataIO> target,
+									std::shared_ptr<BHttpRingBuffer> sharedTarget,
+									BMessenger observer, int8 priority);
+	static	void				_ResolveHostName(Data* data, Wrapper&& request,
+									Shard* shard = nullptr);
+	static	void				_HostNameResolved(Data* data, Wrapper&& request,
+									status_t status, Shard* shard = nullptr);
+	static	void				_QueueForDataThread(Data* data,
+									Wrapper&& request);
+	static	void				_OpenConnection(Shard* shard, Wrapper& request);
+	static	void				_StartHandshake(Shard* shard,
+									Connection& connection);
+	static	void				_SerializeRequest(Wrapper& request);
+	static	bool				_RequestWrite(Wrapper& request);
+	static	void				_ReadBodySegment(Wrapper& request);
+	static	ssize_t				_ReadSocket(Shard* shard,
+									Connection& connection);
 	static	bool				_RequestRead(Wrapper& request);
+	static	bool				_ParseResponse(Wrapper& request);
 	static	void				_ParseStatus(Wrapper& request);
 	static	void				_ParseHeaders(Wrapper& request);
+	static	size_t				_ReadChunks(Wrapper& request, const char* data,
+									size_t size);
+	static	void				_SetupDecompression(Wrapper& request);
+	static	void				_WriteBody(Wrapper& request, const char* data,
+									size_t size);
+	static	void				_StartBodyWriter(Wrapper& request);
+	static	bool				_PauseReceiving(Wrapper& request);
+	static	void				_ResumeReceiving(Shard* shard, int fd);
+	static	void				_FinishBody(Wrapper& request);
+
+	// HTTP/2
+	static	void				_Http2Idle(Shard* shard,
+									Connection& connection);
+	static	void				_Http2Write(Shard* shard,
+									Connection& connection);
+	static	void				_Http2OpenStream(Connection& connection,
+									Wrapper& request);
+	static	bool				_Http2WriteBody(Shard* shard,
+									Connection& connection, Wrapper& request);
+	static	bool				_Http2Read(Shard* shard,
+									Connection& connection);
+	static	void				_Http2Event(Shard* shard,
+									Connection& connection,
+									Http2Event& event);
 };
 
 
@@ -0,0 +1,474 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+
+#include "EventLoop.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__linux__)
+#	include <errno.h>
+#	include <sys/epoll.h>
+#	include <sys/eventfd.h>
+#	include <unistd.h>
+#elif defined(EVENT_LOOP_USES_EVENT_QUEUE)
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <event_queue_defs.h>
+
+// The event queue syscalls are private; they are exported by libroot
+extern "C" {
+int _kern_event_queue_create(int openFlags);
+status_t _kern_event_queue_select(int queue, event_wait_info* userInfos,
+	int numInfos);
+ssize_t _kern_event_queue_wait(int queue, event_wait_info* infos, int numInfos,
+	uint32 flags, bigtime_t timeout);
+}
+#endif
+
+using namespace BPrivate::Network;
+
+
+#if defined(__linux__)
+
+
+static uint32_t
+ToEpollEvents(uint16 interest)
+{
+	uint32_t events = 0;
+	if ((interest & B_EVENT_READ) != 0)
+		events |= EPOLLIN;
+	if ((interest & B_EVENT_WRITE) != 0)
+		events |= EPOLLOUT;
+	if ((interest & B_EVENT_DISCONNECTED) != 0)
+		events |= EPOLLRDHUP;
+	return events;
+}
+
+
+static uint16
+FromEpollEvents(uint32_t events)
+{
+	uint16 result = 0;
+	if ((events & EPOLLIN) != 0)
+		result |= B_EVENT_READ;
+	if ((events & EPOLLOUT) != 0)
+		result |= B_EVENT_WRITE;
+	if ((events & (EPOLLRDHUP | EPOLLHUP)) != 0)
+		result |= B_EVENT_DISCONNECTED;
+	if ((events & EPOLLERR) != 0)
+		result |= B_EVENT_ERROR;
+	return result;
+}
+
+
+EventLoop::EventLoop()
+{
+	fPollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (fPollFd < 0)
+		throw std::runtime_error("Cannot create epoll instance");
+	fWakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fWakeupFd < 0) {
+		close(fPollFd);
+		throw std::runtime_error("Cannot create wakeup descriptor");
+	}
+
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.ptr = nullptr;
+	if (epoll_ctl(fPollFd, EPOLL_CTL_ADD, fWakeupFd, &event) != 0) {
+		close(fWakeupFd);
+		close(fPollFd);
+		throw std::runtime_error("Cannot register wakeup descriptor");
+	}
+}
+
+
+EventLoop::~EventLoop()
+{
+	close(fWakeupFd);
+	close(fPollFd);
+}
+
+
+status_t
+EventLoop::Add(int fd, uint16 interest, void* cookie)
+{
+	auto [it, inserted] = fRegistrations.try_emplace(fd,
+		Registration{0, interest, cookie});
+	if (!inserted)
+		return B_NAME_IN_USE;
+
+	epoll_event event = {};
+	event.events = ToEpollEvents(interest);
+	event.data.ptr = cookie;
+	if (epoll_ctl(fPollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+		fRegistrations.erase(it);
+		return errno;
+	}
+	return B_OK;
+}
+
+
+status_t
+EventLoop::Modify(int fd, uint16 interest)
+{
+	auto it = fRegistrations.find(fd);
+	if (it == fRegistrations.end())
+		return B_ENTRY_NOT_FOUND;
+	if (it->second.interest == interest)
+		return B_OK;
+
+	epoll_event event = {};
+	event.events = ToEpollEvents(interest);
+	event.data.ptr = it->second.cookie;
+	if (epoll_ctl(fPollFd, EPOLL_CTL_MOD, fd, &event) != 0)
+		return errno;
+	it->second.interest = interest;
+	return B_OK;
+}
+
+
+status_t
+EventLoop::Remove(int fd)
+{
+	auto it = fRegistrations.find(fd);
+	if (it == fRegistrations.end())
+		return B_ENTRY_NOT_FOUND;
+	fRegistrations.erase(it);
+	if (epoll_ctl(fPollFd, EPOLL_CTL_DEL, fd, nullptr) != 0)
+		return errno;
+	return B_OK;
+}
+
+
+status_t
+EventLoop::Wait(std::vector<Event>& ready, bigtime_t timeout)
+{
+	static const int kMaxEvents = 256;
+	epoll_event events[kMaxEvents];
+
+	int milliseconds = -1;
+	if (timeout != B_INFINITE_TIMEOUT)
+		milliseconds = timeout <= 0 ? 0 : (timeout + 999) / 1000;
+
+	ready.clear();
+	int count = epoll_wait(fPollFd, events, kMaxEvents, milliseconds);
+	if (count < 0)
+		return errno == EINTR ? B_INTERRUPTED : errno;
+
+	for (int i = 0; i < count; i++) {
+		if (events[i].data.ptr == nullptr) {
+			uint64_t value;
+			while (read(fWakeupFd, &value, sizeof(value)) > 0)
+				;
+			atomic_set(&fWakeupPending, 0);
+			continue;
+		}
+		ready.push_back(Event{FromEpollEvents(events[i].events),
+			events[i].data.ptr});
+	}
+	return B_OK;
+}
+
+
+void
+EventLoop::Wakeup()
+{
+	if (atomic_test_and_set(&fWakeupPending, 1, 0) != 0)
+		return;
+	uint64_t value = 1;
+	write(fWakeupFd, &value, sizeof(value));
+}
+
+
+/*static*/ const char*
+EventLoop::Backend()
+{
+	return "epoll";
+}
+
+
+#elif defined(EVENT_LOOP_USES_EVENT_QUEUE)
+
+
+/*!	Select (\a events > 0) or deselect (\a events < 0) \a object on \a queue.
+	The events are level-triggered, like those of the other backends.
+*/
+static status_t
+SelectEvents(int queue, int32 object, uint16 type, int32 events, void* cookie)
+{
+	event_wait_info info;
+	info.object = object;
+	info.type = type;
+	info.events = events > 0 ? events | B_EVENT_LEVEL_TRIGGERED : -1;
+	info.user_data = cookie;
+	status_t status = _kern_event_queue_select(queue, &info, 1);
+	if (status != B_OK)
+		return info.events < 0 ? (status_t)info.events : status;
+	return B_OK;
+}
+
+
+EventLoop::EventLoop()
+{
+	fQueue = _kern_event_queue_create(O_CLOEXEC);
+	if (fQueue < 0)
+		throw std::runtime_error("Cannot create event queue");
+	fWakeupSem = create_sem(0, "eventloop:wakeup");
+	if (fWakeupSem < 0) {
+		close(fQueue);
+		throw std::runtime_error("Cannot create wakeup semaphore");
+	}
+	if (SelectEvents(fQueue, fWakeupSem, B_OBJECT_TYPE_SEMAPHORE,
+			B_EVENT_ACQUIRE_SEMAPHORE, nullptr) != B_OK) {
+		delete_sem(fWakeupSem);
+		close(fQueue);
+		throw std::runtime_error("Cannot register wakeup semaphore");
+	}
+}
+
+
+EventLoop::~EventLoop()
+{
+	close(fQueue);
+	delete_sem(fWakeupSem);
+}
+
+
+status_t
+EventLoop::Add(int fd, uint16 interest, void* cookie)
+{
+	auto [it, inserted] = fRegistrations.try_emplace(fd,
+		Registration{0, interest, cookie});
+	if (!inserted)
+		return B_NAME_IN_USE;
+	if (interest == 0)
+		return B_OK;
+
+	status_t status = SelectEvents(fQueue, fd, B_OBJECT_TYPE_FD, interest,
+		cookie);
+	if (status != B_OK)
+		fRegistrations.erase(it);
+	return status;
+}
+
+
+/*!	An object without any interest is not selected at all, as the queue takes
+	no events for a selection.
+*/
+status_t
+EventLoop::Modify(int fd, uint16 interest)
+{
+	auto it = fRegistrations.find(fd);
+	if (it == fRegistrations.end())
+		return B_ENTRY_NOT_FOUND;
+	if (it->second.interest == interest)
+		return B_OK;
+
+	if (it->second.interest != 0)
+		SelectEvents(fQueue, fd, B_OBJECT_TYPE_FD, -1, nullptr);
+	it->second.interest = 0;
+	if (interest == 0)
+		return B_OK;
+	status_t status = SelectEvents(fQueue, fd, B_OBJECT_TYPE_FD, interest,
+		it->second.cookie);
+	if (status == B_OK)
+		it->second.interest = interest;
+	return status;
+}
+
+
+status_t
+EventLoop::Remove(int fd)
+{
+	auto it = fRegistrations.find(fd);
+	if (it == fRegistrations.end())
+		return B_ENTRY_NOT_FOUND;
+	uint16 interest = it->second.interest;
+	fRegistrations.erase(it);
+	if (interest != 0)
+		return SelectEvents(fQueue, fd, B_OBJECT_TYPE_FD, -1, nullptr);
+	return B_OK;
+}
+
+
+status_t
+EventLoop::Wait(std::vector<Event>& ready, bigtime_t timeout)
+{
+	static const int kMaxEvents = 256;
+	event_wait_info infos[kMaxEvents];
+
+	ready.clear();
+	ssize_t count;
+	if (timeout == B_INFINITE_TIMEOUT)
+		count = _kern_event_queue_wait(fQueue, infos, kMaxEvents, 0, timeout);
+	else {
+		count = _kern_event_queue_wait(fQueue, infos, kMaxEvents,
+			B_RELATIVE_TIMEOUT, std::max(timeout, (bigtime_t)0));
+	}
+	if (count == B_TIMED_OUT || count == B_WOULD_BLOCK)
+		return B_OK;
+	if (count < 0)
+		return count;
+
+	for (ssize_t i = 0; i < count; i++) {
+		if (infos[i].user_data == nullptr) {
+			atomic_set(&fWakeupPending, 0);
+			acquire_sem_etc(fWakeupSem, 1, B_RELATIVE_TIMEOUT, 0);
+			continue;
+		}
+		uint16 events = infos[i].events < 0
+			? (uint16)B_EVENT_ERROR : (uint16)infos[i].events;
+		ready.push_back(Event{events, infos[i].user_data});
+	}
+	return B_OK;
+}
+
+
+void
+EventLoop::Wakeup()
+{
+	if (atomic_test_and_set(&fWakeupPending, 1, 0) != 0)
+		return;
+	release_sem(fWakeupSem);
+}
+
+
+/*static*/ const char*
+EventLoop::Backend()
+{
+	return "event_queue";
+}
+
+
+#else // wait_for_objects() backend
+
+
+EventLoop::EventLoop()
+{
+	fWakeupSem = create_sem(0, "eventloop:wakeup");
+	if (fWakeupSem < 0)
+		throw std::runtime_error("Cannot create wakeup semaphore");
+
+	// The first slot is always the wakeup semaphore
+	fObjects.push_back(object_wait_info{fWakeupSem, B_OBJECT_TYPE_SEMAPHORE,
+		B_EVENT_ACQUIRE_SEMAPHORE});
+	fInterests.push_back(B_EVENT_ACQUIRE_SEMAPHORE);
+	fCookies.push_back(nullptr);
+}
+
+
+EventLoop::~EventLoop()
+{
+	delete_sem(fWakeupSem);
+}
+
+
+status_t
+EventLoop::Add(int fd, uint16 interest, void* cookie)
+{
+	auto [it, inserted] = fRegistrations.try_emplace(fd,
+		Registration{fObjects.size(), interest, cookie});
+	if (!inserted)
+		return B_NAME_IN_USE;
+
+	fObjects.push_back(object_wait_info{fd, B_OBJECT_TYPE_FD, interest});
+	fInterests.push_back(interest);
+	fCookies.push_back(cookie);
+	return B_OK;
+}
+
+
+status_t
+EventLoop::Modify(int fd, uint16 interest)
+{
+	auto it = fRegistrations.find(fd);
+	if (it == fRegistrations.end())
+		return B_ENTRY_NOT_FOUND;
+	it->second.interest = interest;
+	fInterests[it->second.slot] = interest;
+	return B_OK;
+}
+
+
+status_t
+EventLoop::Remove(int fd)
+{
+	auto it = fRegistrations.find(fd);
+	if (it == fRegistrations.end())
+		return B_ENTRY_NOT_FOUND;
+
+	// Move the last registration into the freed slot
+	size_t slot = it->second.slot;
+	size_t last = fObjects.size() - 1;
+	if (slot != last) {
+		fObjects[slot] = fObjects[last];
+		fInterests[slot] = fInterests[last];
+		fCookies[slot] = fCookies[last];
+		fRegistrations[fObjects[slot].object].slot = slot;
+	}
+	fObjects.pop_back();
+	fInterests.pop_back();
+	fCookies.pop_back();
+	fRegistrations.erase(fd);
+	return B_OK;
+}
+
+
+status_t
+EventLoop::Wait(std::vector<Event>& ready, bigtime_t timeout)
+{
+	// wait_for_objects() overwrites the events with the ones that occurred
+	for (size_t i = 0; i < fObjects.size(); i++)
+		fObjects[i].events = fInterests[i];
+
+	ready.clear();
+	ssize_t count;
+	if (timeout == B_INFINITE_TIMEOUT)
+		count = wait_for_objects(fObjects.data(), fObjects.size());
+	else {
+		count = wait_for_objects_etc(fObjects.data(), fObjects.size(),
+			B_RELATIVE_TIMEOUT, timeout);
+	}
+	if (count == B_TIMED_OUT || count == B_WOULD_BLOCK)
+		return B_OK;
+	if (count < 0)
+		return count;
+
+	if ((fObjects[0].events & B_EVENT_ACQUIRE_SEMAPHORE) != 0) {
+		atomic_set(&fWakeupPending, 0);
+		acquire_sem_etc(fWakeupSem, 1, B_RELATIVE_TIMEOUT, 0);
+	}
+
+	for (size_t i = 1; i < fObjects.size(); i++) {
+		if (fObjects[i].events != 0)
+			ready.push_back(Event{fObjects[i].events, fCookies[i]});
+	}
+	return B_OK;
+}
+
+
+void
+EventLoop::Wakeup()
+{
+	if (atomic_test_and_set(&fWakeupPending, 1, 0) != 0)
+		return;
+	release_sem(fWakeupSem);
+}
+
+
+/*static*/ const char*
+EventLoop::Backend()
+{
+	return "wait_for_objects";
+}
+
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _EVENT_LOOP_H_
+#define _EVENT_LOOP_H_
+
+
+#include <unordered_map>
+#include <vector>
+
+#include <OS.h>
+
+#if !defined(__linux__) && defined(__HAIKU__) \
+	&& __has_include(<event_queue_defs.h>)
+#	define EVENT_LOOP_USES_EVENT_QUEUE
+#endif
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+/*!	Readiness based event loop for sockets.
+
+	File descriptors are registered with an interest mask (the B_EVENT_* flags
+	from OS.h) and an opaque cookie. Wait() only reports the descriptors that
+	are ready, together with their cookie, so that the owner can get to the
+	per-connection state without any lookups.
+
+	On Linux the loop is backed by epoll, and on Haiku by a kernel event queue;
+	with both, the cost of Wait() depends on the number of descriptors that are
+	ready, not on the number that are registered. Where neither is available,
+	the loop falls back to wait_for_objects(). Its registrations are kept in a
+	dense array that is updated in place, so that adding and removing
+	descriptors is O(1) and the wait list is never rebuilt, but the kernel
+	still checks every descriptor on each Wait().
+
+	Wakeup() may be called from any thread to interrupt a Wait(). Multiple
+	wakeups are coalesced until the loop has woken up.
+*/
+class EventLoop {
+public:
+	struct Event {
+		uint16	events;
+		void*	cookie;
+	};
+
+								EventLoop();
+								~EventLoop();
+
+	// Registration (only from the thread that calls Wait())
+			status_t			Add(int fd, uint16 interest, void* cookie);
+			status_t			Modify(int fd, uint16 interest);
+			status_t			Remove(int fd);
+			size_t				CountDescriptors() const
+									{ return fRegistrations.size(); }
+
+	// Waiting
+			status_t			Wait(std::vector<Event>& ready,
+									bigtime_t timeout = B_INFINITE_TIMEOUT);
+			void				Wakeup();
+
+	// Name of the mechanism that the loop is backed by
+	static	const char*			Backend();
+
+private:
+	struct Registration {
+		size_t	slot;
+		uint16	interest;
+		void*	cookie;
+	};
+
+			std::unordered_map<int, Registration> fRegistrations;
+			int32				fWakeupPending = 0;
+#if defined(__linux__)
+			int					fPollFd = -1;
+			int					fWakeupFd = -1;
+#elif defined(EVENT_LOOP_USES_EVENT_QUEUE)
+			int					fQueue = -1;
+			sem_id				fWakeupSem = -1;
+#else
+			sem_id				fWakeupSem = -1;
+			std::vector<object_wait_info> fObjects;
+			std::vector<uint16>	fInterests;
+			std::vector<void*>	fCookies;
+#endif
+};
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _EVENT_LOOP_H_
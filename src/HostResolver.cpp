@@ -0,0 +1,124 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+
+#include "HostResolver.h"
+
+#include <algorithm>
+
+#include "AutoLocker.h"
+
+using namespace BPrivate::Network;
+
+
+HostResolver::HostResolver(LookupFunction lookup, int32 threadCount)
+	:
+	fLookup(lookup),
+	fLock("http:resolver"),
+	fWorkers("http:resolver", threadCount)
+{
+}
+
+
+/*!	Resolve \a host.
+
+	When the result is in the cache, it is returned immediately: the address is
+	stored in \a address and B_OK is returned, or the cached error is returned.
+	Otherwise a lookup is scheduled and B_WOULD_BLOCK is returned; the
+	\a callback is called from a worker thread when the lookup is done.
+*/
+status_t
+HostResolver::Resolve(const std::string& host, uint16 port,
+	BNetworkAddress& address, Callback callback)
+{
+	AutoLocker<BLocker> locker(fLock);
+	if (auto it = fCache.find(host); it != fCache.end()) {
+		if (it->second.expiresAt > system_time()) {
+			if (it->second.status == B_OK) {
+				address = it->second.address;
+				address.SetPort(port);
+			}
+			return it->second.status;
+		}
+		fCache.erase(it);
+	}
+
+	auto [pending, isNew] = fPending.try_emplace(host);
+	pending->second.emplace_back(port, std::move(callback));
+	if (isNew)
+		fWorkers.Submit([this, host]() { _Lookup(host); });
+	return B_WOULD_BLOCK;
+}
+
+
+void
+HostResolver::Flush()
+{
+	AutoLocker<BLocker> locker(fLock);
+	fCache.clear();
+}
+
+
+/*static*/ status_t
+HostResolver::SystemLookup(const std::string& host, BNetworkAddress& address,
+	bigtime_t& ttl)
+{
+	// The system resolver does not report the time to live of the records
+	ttl = kDefaultTtl;
+	address.SetTo(host.c_str(), 0);
+	return address.InitCheck();
+}
+
+
+void
+HostResolver::_Lookup(const std::string& host)
+{
+	CacheEntry entry;
+	bigtime_t ttl = kNegativeTtl;
+	entry.status = fLookup(host, entry.address, ttl);
+	if (entry.status != B_OK)
+		ttl = std::min(ttl, kNegativeTtl);
+	entry.expiresAt = system_time() + ttl;
+
+	fLock.Lock();
+	auto callbacks = std::move(fPending[host]);
+	fPending.erase(host);
+	_Store(host, CacheEntry(entry));
+	fLock.Unlock();
+
+	for (auto& [port, callback]: callbacks) {
+		BNetworkAddress address = entry.address;
+		if (entry.status == B_OK)
+			address.SetPort(port);
+		callback(entry.status, address);
+	}
+}
+
+
+void
+HostResolver::_Store(const std::string& host, CacheEntry&& entry)
+{
+	if (fCache.size() >= kMaxCacheEntries) {
+		// Drop the expired entries, and if that is not enough, the entry that
+		// expires first.
+		bigtime_t now = system_time();
+		auto first = fCache.end();
+		for (auto it = fCache.begin(); it != fCache.end();) {
+			if (it->second.expiresAt <= now) {
+				it = fCache.erase(it);
+				continue;
+			}
+			if (first == fCache.end() || it->second.expiresAt < first->second.expiresAt)
+				first = it;
+			it++;
+		}
+		if (fCache.size() >= kMaxCacheEntries && first != fCache.end())
+			fCache.erase(first);
+	}
+	fCache.insert_or_assign(host, std::move(entry));
+}
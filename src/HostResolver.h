@@ -0,0 +1,97 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _HOST_RESOLVER_H_
+#define _HOST_RESOLVER_H_
+
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Locker.h>
+#include <NetworkAddress.h>
+
+#include "WorkerPool.h"
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+/*!	Asynchronous host name resolver with a cache.
+
+	Lookups are done on a small pool of worker threads, so that the caller
+	never blocks on the network. Successful lookups are cached for the time to
+	live reported by the lookup function, failed lookups are cached for a short
+	time as well, so that a burst of requests to a nonexistent host does not
+	result in a burst of lookups. Concurrent requests for a host that is being
+	looked up are merged into the pending lookup.
+
+	The lookup function can be replaced, which allows for testing with a stub
+	resolver.
+*/
+class HostResolver {
+public:
+	// Lookup function; fills in the address and the time to live of the
+	// result. The default implementation uses BNetworkAddress::SetTo().
+	typedef std::function<status_t(const std::string& host,
+		BNetworkAddress& address, bigtime_t& ttl)> LookupFunction;
+	// Called when an asynchronous lookup is done
+	typedef std::function<void(status_t status,
+		const BNetworkAddress& address)> Callback;
+
+	static	const bigtime_t			kDefaultTtl = 60000000;
+										// 1 minute
+	static	const bigtime_t			kNegativeTtl = 5000000;
+										// 5 seconds
+	static	const size_t			kMaxCacheEntries = 256;
+	static	const int32				kDefaultThreadCount = 2;
+
+									HostResolver(
+										LookupFunction lookup = SystemLookup,
+										int32 threadCount = kDefaultThreadCount);
+
+			status_t				Resolve(const std::string& host, uint16 port,
+										BNetworkAddress& address,
+										Callback callback);
+			void					Flush();
+
+	static	status_t				SystemLookup(const std::string& host,
+										BNetworkAddress& address,
+										bigtime_t& ttl);
+
+private:
+	struct CacheEntry {
+		status_t					status;
+		BNetworkAddress				address;
+		bigtime_t					expiresAt;
+	};
+
+			void					_Lookup(const std::string& host);
+			void					_Store(const std::string& host,
+										CacheEntry&& entry);
+
+			LookupFunction			fLookup;
+			BLocker					fLock;
+			std::unordered_map<std::string, CacheEntry> fCache;
+			std::unordered_map<std::string,
+				std::vector<std::pair<uint16, Callback>>> fPending;
+			WorkerPool				fWorkers;
+										// last, so that the pending lookups
+										// are done before the rest is gone
+};
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _HOST_RESOLVER_H_
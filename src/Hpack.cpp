@@ -0,0 +1,481 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+
+#include "Hpack.h"
+
+#include <algorithm>
+
+#include <ErrorsExt.h>
+
+using namespace BPrivate::Network;
+using BPrivate::BError;
+
+
+static const std::pair<std::string, std::string> kStaticTable[] = {
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+
+
+// Code lengths of the Huffman code in RFC 7541 Appendix B, for the 256 octets
+// and the end-of-string symbol. The code is canonical, so the codes follow
+// from the lengths.
+static const uint8 kHuffmanCodeLengths[257] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30,
+};
+
+static const int kMaxHuffmanCodeLength = 30;
+static const uint16 kEndOfString = 256;
+
+
+/*!	Huffman codes, and the tables to decode them.
+
+	For each code length, the codes are consecutive numbers starting at
+	firstCode; the symbols are listed in code order in symbols, starting at
+	firstIndex.
+*/
+struct HuffmanCode {
+	uint32	codes[257];
+	uint32	firstCode[kMaxHuffmanCodeLength + 1];
+	uint16	firstIndex[kMaxHuffmanCodeLength + 1];
+	uint16	counts[kMaxHuffmanCodeLength + 1] = {};
+	uint16	symbols[257];
+
+	HuffmanCode()
+	{
+		for (uint16 symbol = 0; symbol < 257; symbol++)
+			symbols[symbol] = symbol;
+		std::stable_sort(symbols, symbols + 257, [](uint16 a, uint16 b) {
+			return kHuffmanCodeLengths[a] < kHuffmanCodeLengths[b];
+		});
+
+		uint32 code = 0;
+		int previousLength = kHuffmanCodeLengths[symbols[0]];
+		for (uint16 i = 0; i < 257; i++) {
+			int length = kHuffmanCodeLengths[symbols[i]];
+			if (i > 0)
+				code = (code + 1) << (length - previousLength);
+			if (counts[length]++ == 0) {
+				firstCode[length] = code;
+				firstIndex[length] = i;
+			}
+			codes[symbols[i]] = code;
+			previousLength = length;
+		}
+	}
+};
+
+
+static const HuffmanCode&
+Huffman()
+{
+	static const HuffmanCode code;
+	return code;
+}
+
+
+// #pragma mark - primitives
+
+
+void
+BPrivate::Network::HpackEncodeInteger(std::string& output, uint8 prefix,
+	int prefixBits, uint64 value)
+{
+	uint64 max = (1 << prefixBits) - 1;
+	if (value < max) {
+		output += char(prefix | value);
+		return;
+	}
+
+	output += char(prefix | max);
+	value -= max;
+	while (value >= 0x80) {
+		output += char((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	output += char(value);
+}
+
+
+void
+BPrivate::Network::HpackEncodeString(std::string& output,
+	const std::string& value)
+{
+	size_t huffmanSize = HuffmanEncodedSize(value);
+	if (huffmanSize < value.size()) {
+		HpackEncodeInteger(output, 0x80, 7, huffmanSize);
+		HuffmanEncode(output, value);
+	} else {
+		HpackEncodeInteger(output, 0x00, 7, value.size());
+		output.append(value);
+	}
+}
+
+
+void
+BPrivate::Network::HuffmanEncode(std::string& output, const std::string& value)
+{
+	const auto& huffman = Huffman();
+	uint64 bits = 0;
+	int count = 0;
+	for (uint8 symbol: value) {
+		bits = (bits << kHuffmanCodeLengths[symbol]) | huffman.codes[symbol];
+		count += kHuffmanCodeLengths[symbol];
+		while (count >= 8) {
+			count -= 8;
+			output += char(bits >> count);
+		}
+	}
+
+	// Pad with the most significant bits of the end-of-string code
+	if (count > 0)
+		output += char((bits << (8 - count)) | (0xff >> count));
+}
+
+
+size_t
+BPrivate::Network::HuffmanEncodedSize(const std::string& value)
+{
+	size_t bits = 0;
+	for (uint8 symbol: value)
+		bits += kHuffmanCodeLengths[symbol];
+	return (bits + 7) / 8;
+}
+
+
+bool
+BPrivate::Network::HuffmanDecode(const uint8* data, size_t size,
+	std::string& output)
+{
+	const auto& huffman = Huffman();
+	uint32 code = 0;
+	int length = 0;
+	for (size_t i = 0; i < size; i++) {
+		for (int bit = 7; bit >= 0; bit--) {
+			code = (code << 1) | ((data[i] >> bit) & 1);
+			length++;
+			if (length > kMaxHuffmanCodeLength)
+				return false;
+
+			uint16 count = huffman.counts[length];
+			if (count == 0 || code < huffman.firstCode[length]
+				|| code - huffman.firstCode[length] >= count)
+				continue;
+
+			uint16 symbol = huffman.symbols[huffman.firstIndex[length]
+				+ code - huffman.firstCode[length]];
+			if (symbol == kEndOfString)
+				return false;
+			output += char(symbol);
+			code = 0;
+			length = 0;
+		}
+	}
+
+	// The padding is shorter than an octet, and consists of the most
+	// significant bits of the end-of-string code (all ones)
+	return length <= 7 && code == (1u << length) - 1;
+}
+
+
+static uint64
+DecodeInteger(const uint8*& data, const uint8* end, int prefixBits)
+{
+	uint64 max = (1 << prefixBits) - 1;
+	uint64 value = *data++ & max;
+	if (value < max)
+		return value;
+
+	for (int shift = 0; ; shift += 7) {
+		if (data == end)
+			throw BError(B_BAD_DATA, "Truncated integer in header block");
+		if (shift > 56)
+			throw BError(B_BAD_DATA, "Integer overflow in header block");
+		uint8 byte = *data++;
+		value += (uint64)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return value;
+	}
+}
+
+
+static std::string
+DecodeString(const uint8*& data, const uint8* end)
+{
+	if (data == end)
+		throw BError(B_BAD_DATA, "Truncated string in header block");
+	bool huffman = (*data & 0x80) != 0;
+	uint64 length = DecodeInteger(data, end, 7);
+	if (length > (uint64)(end - data))
+		throw BError(B_BAD_DATA, "Truncated string in header block");
+
+	std::string value;
+	if (huffman) {
+		value.reserve(length * 8 / 5);
+		if (!HuffmanDecode(data, length, value))
+			throw BError(B_BAD_DATA, "Invalid Huffman code in header block");
+	} else
+		value.assign(reinterpret_cast<const char*>(data), length);
+	data += length;
+	return value;
+}
+
+
+// #pragma mark - HpackTable
+
+
+void
+HpackTable::Add(const std::string& name, const std::string& value)
+{
+	size_t size = name.size() + value.size() + kEntryOverhead;
+	if (size > fMaxSize) {
+		// An entry that does not fit empties the table
+		_Evict(0);
+		return;
+	}
+
+	_Evict(fMaxSize - size);
+	fEntries.emplace_front(name, value);
+	fSize += size;
+}
+
+
+void
+HpackTable::SetMaxSize(size_t size)
+{
+	fMaxSize = size;
+	_Evict(size);
+}
+
+
+const std::pair<std::string, std::string>*
+HpackTable::At(size_t index) const
+{
+	if (index == 0)
+		return nullptr;
+	if (index <= kStaticTableSize)
+		return &kStaticTable[index - 1];
+	index -= kStaticTableSize + 1;
+	if (index >= fEntries.size())
+		return nullptr;
+	return &fEntries[index];
+}
+
+
+ssize_t
+HpackTable::Find(const std::string& name, const std::string& value) const
+{
+	ssize_t nameMatch = 0;
+	for (size_t i = 0; i < kStaticTableSize; i++) {
+		if (kStaticTable[i].first != name)
+			continue;
+		if (kStaticTable[i].second == value)
+			return i + 1;
+		if (nameMatch == 0)
+			nameMatch = -(ssize_t)(i + 1);
+	}
+	for (size_t i = 0; i < fEntries.size(); i++) {
+		if (fEntries[i].first != name)
+			continue;
+		if (fEntries[i].second == value)
+			return i + kStaticTableSize + 1;
+		if (nameMatch == 0)
+			nameMatch = -(ssize_t)(i + kStaticTableSize + 1);
+	}
+	return nameMatch;
+}
+
+
+void
+HpackTable::_Evict(size_t maxSize)
+{
+	while (fSize > maxSize) {
+		const auto& entry = fEntries.back();
+		fSize -= entry.first.size() + entry.second.size() + kEntryOverhead;
+		fEntries.pop_back();
+	}
+}
+
+
+// #pragma mark - HpackEncoder
+
+
+void
+HpackEncoder::SetMaxTableSize(size_t size)
+{
+	size = std::min(size, (size_t)HpackTable::kDefaultMaxSize);
+	if (size == fTable.MaxSize())
+		return;
+	fTable.SetMaxSize(size);
+	fSizeUpdatePending = true;
+}
+
+
+void
+HpackEncoder::Encode(std::string& output, const HpackHeaderList& headers)
+{
+	if (fSizeUpdatePending) {
+		HpackEncodeInteger(output, 0x20, 5, fTable.MaxSize());
+		fSizeUpdatePending = false;
+	}
+
+	for (const auto& [name, value]: headers) {
+		// Credentials are kept out of the table, also on any intermediaries
+		bool sensitive = name == "authorization" || name == "proxy-authorization"
+			|| name == "cookie";
+		ssize_t index = fTable.Find(name, value);
+		if (index > 0 && !sensitive) {
+			HpackEncodeInteger(output, 0x80, 7, index);
+			continue;
+		}
+
+		size_t nameIndex = index < 0 ? -index : index;
+		if (sensitive)
+			HpackEncodeInteger(output, 0x10, 4, nameIndex);
+		else
+			HpackEncodeInteger(output, 0x40, 6, nameIndex);
+		if (nameIndex == 0)
+			HpackEncodeString(output, name);
+		HpackEncodeString(output, value);
+		if (!sensitive)
+			fTable.Add(name, value);
+	}
+}
+
+
+// #pragma mark - HpackDecoder
+
+
+void
+HpackDecoder::SetMaxTableSize(size_t size)
+{
+	fMaxTableSize = size;
+	if (fTable.MaxSize() > size)
+		fTable.SetMaxSize(size);
+}
+
+
+void
+HpackDecoder::Decode(const uint8* data, size_t size, HpackHeaderList& headers)
+{
+	const uint8* end = data + size;
+	while (data < end) {
+		uint8 type = *data;
+		if ((type & 0x80) != 0) {
+			// Indexed header field
+			auto entry = fTable.At(DecodeInteger(data, end, 7));
+			if (entry == nullptr)
+				throw BError(B_BAD_DATA, "Invalid index in header block");
+			headers.push_back(*entry);
+			continue;
+		}
+
+		if ((type & 0xe0) == 0x20) {
+			// Dynamic table size update
+			uint64 maxSize = DecodeInteger(data, end, 5);
+			if (maxSize > fMaxTableSize)
+				throw BError(B_BAD_DATA, "Invalid table size in header block");
+			fTable.SetMaxSize(maxSize);
+			continue;
+		}
+
+		// Literal header field, with incremental indexing (01), without
+		// indexing (0000) or never indexed (0001)
+		bool indexed = (type & 0x40) != 0;
+		uint64 nameIndex = DecodeInteger(data, end, indexed ? 6 : 4);
+		std::string name;
+		if (nameIndex == 0)
+			name = DecodeString(data, end);
+		else {
+			auto entry = fTable.At(nameIndex);
+			if (entry == nullptr)
+				throw BError(B_BAD_DATA, "Invalid index in header block");
+			name = entry->first;
+		}
+		std::string value = DecodeString(data, end);
+		if (indexed)
+			fTable.Add(name, value);
+		headers.emplace_back(std::move(name), std::move(value));
+	}
+}
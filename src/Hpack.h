@@ -0,0 +1,115 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _HPACK_H_
+#define _HPACK_H_
+
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <SupportDefs.h>
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+typedef std::vector<std::pair<std::string, std::string>> HpackHeaderList;
+
+
+/*!	Dynamic table that is shared by the header blocks on one connection.
+
+	The most recent entry is in front, which matches the order of the indexes
+	after the 61 entries of the static table.
+*/
+class HpackTable {
+public:
+	static	const size_t		kDefaultMaxSize = 4096;
+	static	const size_t		kEntryOverhead = 32;
+	static	const size_t		kStaticTableSize = 61;
+
+			void				Add(const std::string& name,
+									const std::string& value);
+			void				SetMaxSize(size_t size);
+			size_t				MaxSize() const { return fMaxSize; }
+			size_t				Size() const { return fSize; }
+
+	// Lookup by index; indexes start at 1 and cover the static table first
+			const std::pair<std::string, std::string>* At(size_t index) const;
+
+	// Find an entry; returns the index of an entry with the same name and
+	// value, or else the negated index of an entry with the same name, or 0
+			ssize_t				Find(const std::string& name,
+									const std::string& value) const;
+
+private:
+			void				_Evict(size_t maxSize);
+
+			std::deque<std::pair<std::string, std::string>> fEntries;
+			size_t				fSize = 0;
+			size_t				fMaxSize = kDefaultMaxSize;
+};
+
+
+/*!	Encodes header lists into HPACK header blocks.
+
+	Header fields are added to the dynamic table, except for the ones that are
+	likely to contain secrets, which are never indexed. String literals are
+	Huffman encoded when that makes them shorter.
+*/
+class HpackEncoder {
+public:
+	// Limit the dynamic table to what the peer allows
+			void				SetMaxTableSize(size_t size);
+
+			void				Encode(std::string& output,
+									const HpackHeaderList& headers);
+
+private:
+			HpackTable			fTable;
+			bool				fSizeUpdatePending = false;
+};
+
+
+/*!	Decodes HPACK header blocks into header lists.
+
+	Errors in a header block are fatal for the connection, as they leave the
+	dynamic table in an unknown state; Decode() throws a BError.
+*/
+class HpackDecoder {
+public:
+	// Limit the dynamic table to what was announced to the peer
+			void				SetMaxTableSize(size_t size);
+
+			void				Decode(const uint8* data, size_t size,
+									HpackHeaderList& headers);
+
+private:
+			HpackTable			fTable;
+			size_t				fMaxTableSize = HpackTable::kDefaultMaxSize;
+};
+
+
+// Primitives, exposed for testing
+void	HpackEncodeInteger(std::string& output, uint8 prefix, int prefixBits,
+			uint64 value);
+void	HpackEncodeString(std::string& output, const std::string& value);
+void	HuffmanEncode(std::string& output, const std::string& value);
+size_t	HuffmanEncodedSize(const std::string& value);
+bool	HuffmanDecode(const uint8* data, size_t size, std::string& output);
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _HPACK_H_
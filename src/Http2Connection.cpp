@@ -0,0 +1,576 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+
+#include "Http2Connection.h"
+
+#include <algorithm>
+
+#include <ErrorsExt.h>
+
+using namespace BPrivate::Network;
+using BPrivate::BError;
+
+
+static const char kConnectionPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const size_t kFrameHeaderSize = 9;
+static const size_t kMaxFrameSize = 16384;
+	// the SETTINGS_MAX_FRAME_SIZE that is announced to the server
+static const int64 kMaxWindowSize = 0x7fffffff;
+static const int64 kMaxStreamId = 0x7fffffff;
+
+// Frame types
+enum {
+	kData = 0x0,
+	kHeaders = 0x1,
+	kPriority = 0x2,
+	kResetStream = 0x3,
+	kSettings = 0x4,
+	kPushPromise = 0x5,
+	kPing = 0x6,
+	kGoAway = 0x7,
+	kWindowUpdate = 0x8,
+	kContinuation = 0x9
+};
+
+// Frame flags
+enum {
+	kEndStream = 0x1,
+	kAck = 0x1,
+	kEndHeaders = 0x4,
+	kPadded = 0x8,
+	kPriorityFlag = 0x20
+};
+
+// Settings
+enum {
+	kHeaderTableSize = 0x1,
+	kEnablePush = 0x2,
+	kMaxConcurrentStreams = 0x3,
+	kInitialWindowSize = 0x4,
+	kMaxFrameSizeSetting = 0x5
+};
+
+
+static inline uint32
+Read32(const uint8* data)
+{
+	return ((uint32)data[0] << 24) | ((uint32)data[1] << 16)
+		| ((uint32)data[2] << 8) | data[3];
+}
+
+
+static inline void
+Append32(std::string& output, uint32 value)
+{
+	output += char(value >> 24);
+	output += char(value >> 16);
+	output += char(value >> 8);
+	output += char(value);
+}
+
+
+static inline void
+AppendSetting(std::string& output, uint16 identifier, uint32 value)
+{
+	output += char(identifier >> 8);
+	output += char(identifier);
+	Append32(output, value);
+}
+
+
+Http2Connection::Http2Connection()
+{
+	// Prior knowledge: the connection starts with the preface and the
+	// client's settings straight away.
+	fOutput.append(kConnectionPreface, sizeof(kConnectionPreface) - 1);
+	_WriteFrameHeader(3 * 6, kSettings, 0, 0);
+	AppendSetting(fOutput, kEnablePush, 0);
+	AppendSetting(fOutput, kInitialWindowSize, kStreamReceiveWindow);
+	AppendSetting(fOutput, kMaxFrameSizeSetting, kMaxFrameSize);
+	_WriteWindowUpdate(0, kConnectionReceiveWindow - 65535);
+}
+
+
+const char*
+Http2Connection::Output(size_t& size) const
+{
+	size = fOutput.size() - fOutputOffset;
+	return fOutput.data() + fOutputOffset;
+}
+
+
+void
+Http2Connection::OutputWritten(size_t size)
+{
+	fOutputOffset += size;
+	if (fOutputOffset == fOutput.size()) {
+		fOutput.clear();
+		fOutputOffset = 0;
+	}
+}
+
+
+bool
+Http2Connection::CanOpenStream() const
+{
+	return !fGoAwayReceived && fStreams.size() < fPeerMaxConcurrentStreams
+		&& fNextStreamId <= kMaxStreamId;
+}
+
+
+/*!	Start a new stream with a request with \a headers.
+
+	If \a endStream is set, the request has no body. Returns the identifier of
+	the stream.
+*/
+int32
+Http2Connection::OpenStream(const HpackHeaderList& headers, bool endStream,
+	uint8 weight)
+{
+	int32 id = fNextStreamId;
+	fNextStreamId += 2;
+	Stream& stream = fStreams[id];
+	stream.sendWindow = fPeerInitialWindowSize;
+	stream.localClosed = endStream;
+
+	// The header block follows the priority fields; the part that does not
+	// fit in the HEADERS frame goes into CONTINUATION frames.
+	std::string block;
+	block.append(4, '\0');
+		// no dependency
+	block += char(weight - 1);
+	fEncoder.Encode(block, headers);
+
+	size_t offset = 0;
+	uint8 type = kHeaders;
+	uint8 flags = kPriorityFlag | (endStream ? kEndStream : 0);
+	while (true) {
+		size_t length = std::min(block.size() - offset, fPeerMaxFrameSize);
+		bool last = offset + length == block.size();
+		_WriteFrameHeader(length, type, flags | (last ? kEndHeaders : 0), id);
+		fOutput.append(block, offset, length);
+		offset += length;
+		if (last)
+			break;
+		type = kContinuation;
+		flags = 0;
+	}
+	return id;
+}
+
+
+/*!	Number of bytes of body data that may be sent on \a stream right now. */
+size_t
+Http2Connection::SendWindow(int32 stream) const
+{
+	auto it = fStreams.find(stream);
+	if (it == fStreams.end() || it->second.localClosed)
+		return 0;
+	return std::max(std::min(fSendWindow, it->second.sendWindow), (int64)0);
+}
+
+
+/*!	Send request body data on \a stream.
+
+	The \a size should not be more than SendWindow(). With \a endStream, the
+	request is complete; \a size may be 0 in that case.
+*/
+void
+Http2Connection::SendData(int32 stream, const void* data, size_t size,
+	bool endStream)
+{
+	auto it = fStreams.find(stream);
+	if (it == fStreams.end() || it->second.localClosed)
+		return;
+
+	const char* bytes = static_cast<const char*>(data);
+	do {
+		size_t length = std::min(size, fPeerMaxFrameSize);
+		bool last = length == size;
+		_WriteFrameHeader(length, kData, last && endStream ? kEndStream : 0,
+			stream);
+		fOutput.append(bytes, length);
+		bytes += length;
+		size -= length;
+	} while (size > 0);
+
+	size_t sent = bytes - static_cast<const char*>(data);
+	fSendWindow -= sent;
+	it->second.sendWindow -= sent;
+	if (endStream) {
+		it->second.localClosed = true;
+		if (it->second.remoteClosed)
+			fStreams.erase(it);
+	}
+}
+
+
+void
+Http2Connection::SetPriority(int32 stream, uint8 weight)
+{
+	if (fStreams.find(stream) == fStreams.end())
+		return;
+	_WriteFrameHeader(5, kPriority, 0, stream);
+	Append32(fOutput, 0);
+	fOutput += char(weight - 1);
+}
+
+
+void
+Http2Connection::ResetStream(int32 stream, uint32 errorCode)
+{
+	auto it = fStreams.find(stream);
+	if (it == fStreams.end())
+		return;
+	fStreams.erase(it);
+	_WriteFrameHeader(4, kResetStream, 0, stream);
+	Append32(fOutput, errorCode);
+}
+
+
+/*!	Process the \a data that is received from the server.
+
+	Complete frames are processed, the rest is kept until more data comes in.
+	The \a events are appended for the streams that got headers or data, or
+	that were reset, and for the connection when the server goes away.
+*/
+void
+Http2Connection::Receive(const uint8* data, size_t size,
+	std::vector<Http2Event>& events)
+{
+	// The data events of the previous call point into the input buffer, so
+	// the processed frames are only dropped now
+	fInput.erase(0, fInputOffset);
+	fInputOffset = 0;
+	fInput.append(reinterpret_cast<const char*>(data), size);
+
+	while (fInput.size() - fInputOffset >= kFrameHeaderSize) {
+		const uint8* header = reinterpret_cast<const uint8*>(fInput.data())
+			+ fInputOffset;
+		size_t length = ((size_t)header[0] << 16) | ((size_t)header[1] << 8)
+			| header[2];
+		uint8 type = header[3];
+		uint8 flags = header[4];
+		int32 stream = Read32(header + 5) & 0x7fffffff;
+		if (length > kMaxFrameSize)
+			_ConnectionError(kFrameSizeError, "HTTP/2 frame is too large");
+		if (fInput.size() - fInputOffset < kFrameHeaderSize + length)
+			break;
+
+		fInputOffset += kFrameHeaderSize + length;
+		if (fHeaderBlockStream != 0 && type != kContinuation)
+			_ConnectionError(kProtocolError, "Header block is interrupted");
+		_ReceiveFrame(type, flags, stream, header + kFrameHeaderSize, length,
+			events);
+	}
+}
+
+
+void
+Http2Connection::_WriteFrameHeader(size_t length, uint8 type, uint8 flags,
+	int32 stream)
+{
+	fOutput += char(length >> 16);
+	fOutput += char(length >> 8);
+	fOutput += char(length);
+	fOutput += char(type);
+	fOutput += char(flags);
+	Append32(fOutput, stream);
+}
+
+
+void
+Http2Connection::_WriteWindowUpdate(int32 stream, uint32 increment)
+{
+	_WriteFrameHeader(4, kWindowUpdate, 0, stream);
+	Append32(fOutput, increment);
+}
+
+
+void
+Http2Connection::_ReceiveFrame(uint8 type, uint8 flags, int32 stream,
+	const uint8* payload, size_t length, std::vector<Http2Event>& events)
+{
+	switch (type) {
+		case kData:
+			_ReceiveData(flags, stream, payload, length, events);
+			break;
+
+		case kHeaders:
+		case kContinuation:
+			if (type == kContinuation && stream != fHeaderBlockStream)
+				_ConnectionError(kProtocolError, "Unexpected CONTINUATION frame");
+			_ReceiveHeaders(type == kHeaders ? flags : flags & kEndHeaders,
+				stream, payload, length, events);
+			break;
+
+		case kPriority:
+			// Only the client prioritizes
+			break;
+
+		case kResetStream:
+		{
+			if (length != 4)
+				_ConnectionError(kFrameSizeError, "Invalid RST_STREAM frame");
+			if (fStreams.erase(stream) == 0)
+				break;
+			Http2Event event{Http2Event::kReset, stream};
+			event.errorCode = Read32(payload);
+			events.push_back(std::move(event));
+			break;
+		}
+
+		case kSettings:
+			_ReceiveSettings(flags, stream, payload, length);
+			break;
+
+		case kPushPromise:
+			_ConnectionError(kProtocolError, "Server push is disabled");
+
+		case kPing:
+			if (length != 8 || stream != 0)
+				_ConnectionError(kProtocolError, "Invalid PING frame");
+			if ((flags & kAck) == 0) {
+				_WriteFrameHeader(8, kPing, kAck, 0);
+				fOutput.append(reinterpret_cast<const char*>(payload), 8);
+			}
+			break;
+
+		case kGoAway:
+		{
+			if (length < 8 || stream != 0)
+				_ConnectionError(kProtocolError, "Invalid GOAWAY frame");
+			int32 lastStream = Read32(payload) & 0x7fffffff;
+			fGoAwayReceived = true;
+			// The streams after the last one are not processed by the server
+			for (auto it = fStreams.begin(); it != fStreams.end();) {
+				if (it->first > lastStream)
+					it = fStreams.erase(it);
+				else
+					it++;
+			}
+			Http2Event event{Http2Event::kGoAway, lastStream};
+			event.errorCode = Read32(payload + 4);
+			events.push_back(std::move(event));
+			break;
+		}
+
+		case kWindowUpdate:
+			_ReceiveWindowUpdate(stream, payload, length);
+			break;
+
+		default:
+			// Unknown frame types are ignored
+			break;
+	}
+}
+
+
+void
+Http2Connection::_ReceiveData(uint8 flags, int32 stream, const uint8* payload,
+	size_t length, std::vector<Http2Event>& events)
+{
+	if (stream == 0)
+		_ConnectionError(kProtocolError, "DATA frame on the connection");
+
+	// The whole frame counts for flow control, including the padding. The
+	// connection window is opened up also for streams that are gone.
+	size_t frameLength = length;
+	fReceiveConsumed += frameLength;
+	if (fReceiveConsumed >= kConnectionReceiveWindow / 2) {
+		_WriteWindowUpdate(0, fReceiveConsumed);
+		fReceiveConsumed = 0;
+	}
+
+	size_t padding = 0;
+	if ((flags & kPadded) != 0) {
+		if (length == 0 || payload[0] >= length)
+			_ConnectionError(kProtocolError, "Invalid padding");
+		padding = payload[0];
+		payload++;
+		length--;
+	}
+
+	auto it = fStreams.find(stream);
+	if (it == fStreams.end() || it->second.remoteClosed)
+		return;
+
+	bool endStream = (flags & kEndStream) != 0;
+	auto& state = it->second;
+	state.receiveConsumed += frameLength;
+	if (!endStream && state.receiveConsumed >= kStreamReceiveWindow / 2) {
+		_WriteWindowUpdate(stream, state.receiveConsumed);
+		state.receiveConsumed = 0;
+	}
+
+	Http2Event event{Http2Event::kData, stream, endStream};
+	event.data = payload;
+	event.size = length - padding;
+	events.push_back(std::move(event));
+	if (endStream)
+		_CloseRemote(stream);
+}
+
+
+void
+Http2Connection::_ReceiveHeaders(uint8 flags, int32 stream,
+	const uint8* payload, size_t length, std::vector<Http2Event>& events)
+{
+	if (stream == 0)
+		_ConnectionError(kProtocolError, "HEADERS frame on the connection");
+
+	size_t padding = 0;
+	if ((flags & kPadded) != 0) {
+		if (length == 0)
+			_ConnectionError(kProtocolError, "Invalid padding");
+		padding = payload[0];
+		payload++;
+		length--;
+	}
+	if ((flags & kPriorityFlag) != 0) {
+		if (length < 5)
+			_ConnectionError(kProtocolError, "Invalid HEADERS frame");
+		payload += 5;
+		length -= 5;
+	}
+	if (padding > length)
+		_ConnectionError(kProtocolError, "Invalid padding");
+
+	if (fHeaderBlockStream == 0) {
+		fHeaderBlockStream = stream;
+		fHeaderBlockEndStream = (flags & kEndStream) != 0;
+		fHeaderBlock.clear();
+	}
+	fHeaderBlock.append(reinterpret_cast<const char*>(payload),
+		length - padding);
+	if ((flags & kEndHeaders) != 0)
+		_HeaderBlockComplete(events);
+}
+
+
+void
+Http2Connection::_HeaderBlockComplete(std::vector<Http2Event>& events)
+{
+	int32 stream = fHeaderBlockStream;
+	fHeaderBlockStream = 0;
+
+	// The block is decoded even when the stream is gone, to keep the
+	// compression state in sync with the server
+	Http2Event event{Http2Event::kHeaders, stream, fHeaderBlockEndStream};
+	try {
+		fDecoder.Decode(reinterpret_cast<const uint8*>(fHeaderBlock.data()),
+			fHeaderBlock.size(), event.headers);
+	} catch (BError&) {
+		_ConnectionError(kCompressionError, "Invalid header block");
+	}
+
+	auto it = fStreams.find(stream);
+	if (it == fStreams.end() || it->second.remoteClosed)
+		return;
+	events.push_back(std::move(event));
+	if (fHeaderBlockEndStream)
+		_CloseRemote(stream);
+}
+
+
+void
+Http2Connection::_ReceiveSettings(uint8 flags, int32 stream,
+	const uint8* payload, size_t length)
+{
+	if (stream != 0)
+		_ConnectionError(kProtocolError, "SETTINGS frame on a stream");
+	if ((flags & kAck) != 0) {
+		if (length != 0)
+			_ConnectionError(kFrameSizeError, "Invalid SETTINGS acknowledgement");
+		return;
+	}
+	if (length % 6 != 0)
+		_ConnectionError(kFrameSizeError, "Invalid SETTINGS frame");
+
+	for (size_t offset = 0; offset < length; offset += 6) {
+		uint16 identifier = (payload[offset] << 8) | payload[offset + 1];
+		uint32 value = Read32(payload + offset + 2);
+		switch (identifier) {
+			case kHeaderTableSize:
+				fEncoder.SetMaxTableSize(value);
+				break;
+			case kMaxConcurrentStreams:
+				fPeerMaxConcurrentStreams = value;
+				break;
+			case kInitialWindowSize:
+			{
+				if (value > kMaxWindowSize)
+					_ConnectionError(kFlowControlError, "Invalid window size");
+				// The change applies to all the open streams
+				int64 delta = (int64)value - fPeerInitialWindowSize;
+				for (auto& [id, state]: fStreams)
+					state.sendWindow += delta;
+				fPeerInitialWindowSize = value;
+				break;
+			}
+			case kMaxFrameSizeSetting:
+				if (value < 16384 || value > 16777215)
+					_ConnectionError(kProtocolError, "Invalid frame size");
+				fPeerMaxFrameSize = value;
+				break;
+			default:
+				// Other settings do not matter to the client
+				break;
+		}
+	}
+
+	_WriteFrameHeader(0, kSettings, kAck, 0);
+}
+
+
+void
+Http2Connection::_ReceiveWindowUpdate(int32 stream, const uint8* payload,
+	size_t length)
+{
+	if (length != 4)
+		_ConnectionError(kFrameSizeError, "Invalid WINDOW_UPDATE frame");
+	uint32 increment = Read32(payload) & 0x7fffffff;
+	if (increment == 0)
+		_ConnectionError(kProtocolError, "Invalid window increment");
+
+	int64* window = &fSendWindow;
+	if (stream != 0) {
+		auto it = fStreams.find(stream);
+		if (it == fStreams.end())
+			return;
+		window = &it->second.sendWindow;
+	}
+	*window += increment;
+	if (*window > kMaxWindowSize)
+		_ConnectionError(kFlowControlError, "Window size overflow");
+}
+
+
+void
+Http2Connection::_CloseRemote(int32 stream)
+{
+	auto it = fStreams.find(stream);
+	if (it == fStreams.end())
+		return;
+	it->second.remoteClosed = true;
+	if (it->second.localClosed)
+		fStreams.erase(it);
+}
+
+
+/*!	Tell the server why the connection is given up, and throw a BError. */
+void
+Http2Connection::_ConnectionError(uint32 errorCode, const char* message)
+{
+	_WriteFrameHeader(8, kGoAway, 0, 0);
+	Append32(fOutput, 0);
+		// the client does not process any streams of the server
+	Append32(fOutput, errorCode);
+	throw BError(B_BAD_DATA, message);
+}
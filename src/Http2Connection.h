@@ -0,0 +1,174 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _HTTP2_CONNECTION_H_
+#define _HTTP2_CONNECTION_H_
+
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <SupportDefs.h>
+
+#include "Hpack.h"
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+struct Http2Event;
+
+
+/*!	Client side of the HTTP/2 framing layer (RFC 7540) of one connection.
+
+	The class does not do any I/O. Frames that are to be sent are appended to
+	an output buffer, which the owner writes to the socket. Data that is
+	received from the socket is passed to Receive(), which returns what
+	happened to the streams.
+
+	Flow control: the receive windows are opened up again as soon as the data
+	is received. The owner only sends as much request body data as the send
+	windows allow. Requests carry a weight, which the server uses to divide
+	the connection between the streams.
+
+	Errors that are fatal for the connection are thrown as a BError.
+*/
+class Http2Connection {
+public:
+	static	const uint8			kDefaultWeight = 16;
+	static	const int32			kStreamReceiveWindow = 1024 * 1024;
+	static	const int32			kConnectionReceiveWindow = 16 * 1024 * 1024;
+	static	const size_t		kDefaultMaxConcurrentStreams = 100;
+
+	enum {
+		kNoError = 0x0,
+		kProtocolError = 0x1,
+		kInternalError = 0x2,
+		kFlowControlError = 0x3,
+		kStreamClosed = 0x5,
+		kFrameSizeError = 0x6,
+		kRefusedStream = 0x7,
+		kCancel = 0x8,
+		kCompressionError = 0x9
+	};
+
+
+								Http2Connection();
+
+	// Output
+			bool				HasOutput() const
+									{ return fOutputOffset < fOutput.size(); }
+			const char*			Output(size_t& size) const;
+			void				OutputWritten(size_t size);
+
+	// Streams
+			bool				CanOpenStream() const;
+			size_t				MaxConcurrentStreams() const
+									{ return fPeerMaxConcurrentStreams; }
+			size_t				CountStreams() const { return fStreams.size(); }
+			bool				IsGoingAway() const { return fGoAwayReceived; }
+			int32				OpenStream(const HpackHeaderList& headers,
+									bool endStream,
+									uint8 weight = kDefaultWeight);
+			size_t				SendWindow(int32 stream) const;
+			void				SendData(int32 stream, const void* data,
+									size_t size, bool endStream);
+			void				SetPriority(int32 stream, uint8 weight);
+			void				ResetStream(int32 stream,
+									uint32 errorCode = kCancel);
+
+	// Input
+			void				Receive(const uint8* data, size_t size,
+									std::vector<Http2Event>& events);
+
+private:
+	struct Stream {
+		int64					sendWindow;
+		int32					receiveConsumed = 0;
+		bool					localClosed = false;
+		bool					remoteClosed = false;
+	};
+
+			void				_WriteFrameHeader(size_t length, uint8 type,
+									uint8 flags, int32 stream);
+			void				_WriteWindowUpdate(int32 stream,
+									uint32 increment);
+			void				_ReceiveFrame(uint8 type, uint8 flags,
+									int32 stream, const uint8* payload,
+									size_t length, std::vector<Http2Event>& events);
+			void				_ReceiveData(uint8 flags, int32 stream,
+									const uint8* payload, size_t length,
+									std::vector<Http2Event>& events);
+			void				_ReceiveHeaders(uint8 flags, int32 stream,
+									const uint8* payload, size_t length,
+									std::vector<Http2Event>& events);
+			void				_ReceiveSettings(uint8 flags, int32 stream,
+									const uint8* payload, size_t length);
+			void				_ReceiveWindowUpdate(int32 stream,
+									const uint8* payload, size_t length);
+			void				_HeaderBlockComplete(std::vector<Http2Event>& events);
+			void				_CloseRemote(int32 stream);
+	[[noreturn]] void			_ConnectionError(uint32 errorCode,
+									const char* message);
+
+			HpackEncoder		fEncoder;
+			HpackDecoder		fDecoder;
+			std::unordered_map<int32, Stream> fStreams;
+			int64				fNextStreamId = 1;
+
+			// Flow control and the peer's settings
+			int64				fSendWindow = 65535;
+			int32				fReceiveConsumed = 0;
+			int32				fPeerInitialWindowSize = 65535;
+			size_t				fPeerMaxFrameSize = 16384;
+			size_t				fPeerMaxConcurrentStreams
+									= kDefaultMaxConcurrentStreams;
+			bool				fGoAwayReceived = false;
+
+			// Header block that continues in CONTINUATION frames
+			int32				fHeaderBlockStream = 0;
+			bool				fHeaderBlockEndStream = false;
+			std::string			fHeaderBlock;
+
+			std::string			fOutput;
+			size_t				fOutputOffset = 0;
+			std::string			fInput;
+			size_t				fInputOffset = 0;
+};
+
+
+/*!	What happened to a stream, or to the connection, in the data that was
+	passed to Http2Connection::Receive().
+*/
+struct Http2Event {
+	enum {
+		kHeaders,
+		kData,
+		kReset,
+		kGoAway
+	}						type;
+	int32					stream;
+	bool					endStream = false;
+	// kHeaders
+	HpackHeaderList			headers;
+	// kData; the data stays valid until the next call to Receive()
+	const uint8*			data = nullptr;
+	size_t					size = 0;
+	// kReset and kGoAway (where stream is the last processed stream)
+	uint32					errorCode = Http2Connection::kNoError;
+};
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _HTTP2_CONNECTION_H_
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#include "HttpChunkedDecoder.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include <ErrorsExt.h>
+
+using namespace BPrivate::Network;
+using BPrivate::BError;
+
+
+static inline int
+HexValue(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+
+size_t
+HttpChunkedDecoder::Decode(const char* data, size_t size, const char*& payload,
+	size_t& payloadSize)
+{
+	payload = nullptr;
+	payloadSize = 0;
+
+	size_t offset = 0;
+	while (offset < size) {
+		switch (fState) {
+			case kData:
+			{
+				payload = data + offset;
+				payloadSize = std::min((uint64)(size - offset), fRemaining);
+				fRemaining -= payloadSize;
+				if (fRemaining == 0)
+					fState = kDataEnd;
+				return offset + payloadSize;
+			}
+
+			case kSize:
+			{
+				if (++fLineLength > kMaxLineLength)
+					throw BError(B_BAD_DATA, "Chunk size line is too long");
+				char c = data[offset++];
+				int value = HexValue(c);
+				if (value >= 0) {
+					// leave room for the next digit, and keep the size within
+					// what an off_t can hold
+					if ((fRemaining >> 58) != 0)
+						throw BError(B_BAD_DATA, "Chunk size is too large");
+					fRemaining = (fRemaining << 4) | value;
+					fDigits++;
+				} else if (fDigits == 0) {
+					throw BError(B_BAD_DATA, "Invalid chunk size");
+				} else if (c == ';' || c == ' ' || c == '\t') {
+					fState = kExtension;
+				} else if (c == '\r') {
+					fState = kSizeLineFeed;
+				} else if (c == '\n') {
+					_SizeLineEnd();
+				} else
+					throw BError(B_BAD_DATA, "Invalid chunk size");
+				break;
+			}
+
+			case kExtension:
+			{
+				// The extensions are not used, so they are not parsed either
+				const char* end = static_cast<const char*>(
+					memchr(data + offset, '\n', size - offset));
+				size_t length = (end != nullptr ? end - data : size) - offset;
+				fLineLength += length;
+				if (fLineLength > kMaxLineLength)
+					throw BError(B_BAD_DATA, "Chunk size line is too long");
+				offset += length;
+				if (end != nullptr) {
+					offset++;
+					_SizeLineEnd();
+				}
+				break;
+			}
+
+			case kSizeLineFeed:
+				if (data[offset++] != '\n')
+					throw BError(B_BAD_DATA, "Invalid chunk size line");
+				_SizeLineEnd();
+				break;
+
+			case kDataEnd:
+			{
+				char c = data[offset++];
+				if (c == '\r')
+					fState = kDataLineFeed;
+				else if (c == '\n')
+					fState = kSize;
+				else
+					throw BError(B_BAD_DATA, "Chunk is longer than its size");
+				break;
+			}
+
+			case kDataLineFeed:
+				if (data[offset++] != '\n')
+					throw BError(B_BAD_DATA, "Chunk is longer than its size");
+				fState = kSize;
+				break;
+
+			case kTrailer:
+			{
+				const char* end = static_cast<const char*>(
+					memchr(data + offset, '\n', size - offset));
+				size_t length = (end != nullptr ? end - data : size) - offset;
+				if (fLine.size() + length > kMaxLineLength
+					|| fTrailerSize + length > kMaxTrailerSize)
+					throw BError(B_BAD_DATA, "Trailer section is too large");
+				fLine.append(data + offset, length);
+				fTrailerSize += length;
+				offset += length;
+				if (end == nullptr)
+					break;
+
+				offset++;
+				if (!fLine.empty() && fLine.back() == '\r')
+					fLine.pop_back();
+				if (fLine.empty()) {
+					// The empty line ends the body; what follows belongs to
+					// the next response
+					fState = kDone;
+					return offset;
+				}
+				fTrailers.push_back(std::move(fLine));
+				fLine.clear();
+				break;
+			}
+
+			case kDone:
+				return offset;
+		}
+	}
+	return offset;
+}
+
+
+void
+HttpChunkedDecoder::Reset()
+{
+	fState = kSize;
+	fRemaining = 0;
+	fDigits = 0;
+	fLineLength = 0;
+	fLine.clear();
+	fTrailerSize = 0;
+	fTrailers.clear();
+}
+
+
+void
+HttpChunkedDecoder::_SizeLineEnd()
+{
+	fState = fRemaining == 0 ? kTrailer : kData;
+	fDigits = 0;
+	fLineLength = 0;
+}
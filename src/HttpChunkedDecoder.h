@@ -0,0 +1,79 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _HTTP_CHUNKED_DECODER_H_
+#define _HTTP_CHUNKED_DECODER_H_
+
+
+#include <string>
+#include <vector>
+
+#include <SupportDefs.h>
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+/*!	Incremental decoder for a body with the chunked transfer encoding.
+
+	The data may be passed in pieces of any size; the chunk size lines and the
+	trailer section may be split over several calls. The chunk payload is not
+	copied: Decode() returns where it is in the data that was passed in, so
+	that the caller can pass it on straight away. Chunk extensions are
+	skipped.
+
+	Errors in the encoding are thrown as a BError.
+*/
+class HttpChunkedDecoder {
+public:
+	static	const size_t		kMaxLineLength = 4096;
+									// chunk size line, or trailer field
+	static	const size_t		kMaxTrailerSize = 65536;
+
+	// Decode the start of \a data. The decoder stops after the first piece of
+	// chunk payload, which is returned in \a payload and \a payloadSize, and at
+	// the end of the body. Returns the number of bytes that were used.
+			size_t				Decode(const char* data, size_t size,
+									const char*& payload, size_t& payloadSize);
+
+			bool				IsDone() const { return fState == kDone; }
+	// The fields of the trailer section, once the decoder is done
+			const std::vector<std::string>& Trailers() const
+									{ return fTrailers; }
+
+			void				Reset();
+
+private:
+			void				_SizeLineEnd();
+
+			enum {
+				kSize,
+				kExtension,
+				kSizeLineFeed,
+				kData,
+				kDataEnd,
+				kDataLineFeed,
+				kTrailer,
+				kDone
+			}					fState = kSize;
+			uint64				fRemaining = 0;
+			size_t				fDigits = 0;
+			size_t				fLineLength = 0;
+			std::string			fLine;
+			size_t				fTrailerSize = 0;
+			std::vector<std::string> fTrailers;
+};
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _HTTP_CHUNKED_DECODER_H_
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+
+#include "HttpConnectionPool.h"
+
+#include <algorithm>
+
+#include <OS.h>
+
+#include "AutoLocker.h"
+
+using namespace BPrivate::Network;
+
+
+HttpConnectionPool::HttpConnectionPool()
+	: fLock("http:connectionpool")
+{
+}
+
+
+void
+HttpConnectionPool::SetMaxIdlePerHost(size_t count)
+{
+	AutoLocker<BLocker> locker(fLock);
+	fMaxIdlePerHost = count;
+	for (auto it = fIdle.begin(); it != fIdle.end();) {
+		auto current = it++;
+		_Trim(current);
+	}
+}
+
+
+void
+HttpConnectionPool::SetMaxIdle(size_t count)
+{
+	AutoLocker<BLocker> locker(fLock);
+	fMaxIdle = count;
+	while (fIdleCount > fMaxIdle)
+		_EvictOldest();
+}
+
+
+void
+HttpConnectionPool::SetIdleTimeout(bigtime_t timeout)
+{
+	AutoLocker<BLocker> locker(fLock);
+	fIdleTimeout = timeout;
+	_EvictExpired(system_time());
+}
+
+
+bigtime_t
+HttpConnectionPool::IdleTimeout()
+{
+	AutoLocker<BLocker> locker(fLock);
+	return fIdleTimeout;
+}
+
+
+/*!	Get an idle connection to \a origin, or \c nullptr if there is none.
+
+	The most recently used connection is handed out first, as it is the least
+	likely to have been closed by the server in the mean time. Connections that
+	have become readable while idle have been closed by the remote end (or
+	have sent unsolicited data), and are dropped.
+*/
+std::unique_ptr<BSocket>
+HttpConnectionPool::Acquire(const std::string& origin)
+{
+	AutoLocker<BLocker> locker(fLock);
+	_EvictExpired(system_time());
+
+	auto it = fIdle.find(origin);
+	if (it == fIdle.end())
+		return nullptr;
+
+	std::unique_ptr<BSocket> socket = nullptr;
+	while (!it->second.empty() && socket == nullptr) {
+		auto candidate = std::move(it->second.back().socket);
+		it->second.pop_back();
+		fIdleCount--;
+		if (candidate->WaitForReadable(0) == B_OK)
+			candidate->Disconnect();
+		else
+			socket = std::move(candidate);
+	}
+
+	if (it->second.empty())
+		fIdle.erase(it);
+	return socket;
+}
+
+
+void
+HttpConnectionPool::Release(const std::string& origin,
+	std::unique_ptr<BSocket> socket)
+{
+	if (!socket)
+		return;
+
+	AutoLocker<BLocker> locker(fLock);
+	if (fMaxIdlePerHost == 0 || fMaxIdle == 0) {
+		socket->Disconnect();
+		return;
+	}
+
+	auto it = fIdle.try_emplace(origin).first;
+	it->second.push_back(Entry{std::move(socket), system_time()});
+	fIdleCount++;
+	_Trim(it);
+	while (fIdleCount > fMaxIdle)
+		_EvictOldest();
+}
+
+
+/*!	Close the connections that have been idle for longer than the idle
+	timeout. Returns the time at which the next idle connection expires, or
+	B_INFINITE_TIMEOUT when there are no idle connections left.
+*/
+bigtime_t
+HttpConnectionPool::EvictIdle()
+{
+	AutoLocker<BLocker> locker(fLock);
+	_EvictExpired(system_time());
+
+	bigtime_t next = B_INFINITE_TIMEOUT;
+	for (const auto& [origin, entries]: fIdle)
+		next = std::min(next, entries.front().releasedAt + fIdleTimeout);
+	return next;
+}
+
+
+/*static*/ std::string
+HttpConnectionPool::OriginFor(const BUrl& url, bool ssl)
+{
+	int port = ssl ? 443 : 80;
+	if (url.HasPort())
+		port = url.Port();
+
+	std::string origin = ssl ? "https://" : "http://";
+	origin += url.Host().String();
+	origin += ':';
+	origin += std::to_string(port);
+	return origin;
+}
+
+
+void
+HttpConnectionPool::_EvictExpired(bigtime_t now)
+{
+	for (auto it = fIdle.begin(); it != fIdle.end();) {
+		auto& entries = it->second;
+		// entries are ordered by release time, so the oldest are in front
+		while (!entries.empty()
+			&& now - entries.front().releasedAt >= fIdleTimeout) {
+			entries.front().socket->Disconnect();
+			entries.pop_front();
+			fIdleCount--;
+		}
+		if (entries.empty())
+			it = fIdle.erase(it);
+		else
+			it++;
+	}
+}
+
+
+void
+HttpConnectionPool::_EvictOldest()
+{
+	auto oldest = fIdle.end();
+	for (auto it = fIdle.begin(); it != fIdle.end(); it++) {
+		if (oldest == fIdle.end()
+			|| it->second.front().releasedAt < oldest->second.front().releasedAt)
+			oldest = it;
+	}
+	if (oldest == fIdle.end())
+		return;
+
+	oldest->second.front().socket->Disconnect();
+	oldest->second.pop_front();
+	fIdleCount--;
+	if (oldest->second.empty())
+		fIdle.erase(oldest);
+}
+
+
+void
+HttpConnectionPool::_Trim(IdleMap::iterator it)
+{
+	while (it->second.size() > fMaxIdlePerHost) {
+		it->second.front().socket->Disconnect();
+		it->second.pop_front();
+		fIdleCount--;
+	}
+	if (it->second.empty())
+		fIdle.erase(it);
+}
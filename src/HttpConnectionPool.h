@@ -0,0 +1,86 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _HTTP_CONNECTION_POOL_H_
+#define _HTTP_CONNECTION_POOL_H_
+
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <Locker.h>
+#include <Socket.h>
+#include <Url.h>
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+/*!	Pool of idle persistent connections.
+
+	Connections are grouped by their origin (scheme, host and port). When a
+	request is finished and the server allows it, the socket is released into
+	the pool, so that the next request to the same origin can skip the TCP
+	connect and TLS handshake.
+
+	The pool is shared between the control thread (which acquires sockets) and
+	the data thread (which releases them), so all access is locked.
+*/
+class HttpConnectionPool {
+public:
+	static	const size_t				kDefaultMaxIdlePerHost = 6;
+	static	const size_t				kDefaultMaxIdle = 32;
+	static	const bigtime_t				kDefaultIdleTimeout = 30000000;
+											// 30 seconds
+
+										HttpConnectionPool();
+										~HttpConnectionPool() = default;
+
+	// Configuration
+			void						SetMaxIdlePerHost(size_t count);
+			void						SetMaxIdle(size_t count);
+			void						SetIdleTimeout(bigtime_t timeout);
+			bigtime_t					IdleTimeout();
+
+	// Pool operations
+			std::unique_ptr<BSocket>	Acquire(const std::string& origin);
+			void						Release(const std::string& origin,
+											std::unique_ptr<BSocket> socket);
+			bigtime_t					EvictIdle();
+
+	static	std::string					OriginFor(const BUrl& url, bool ssl);
+
+private:
+	struct Entry {
+		std::unique_ptr<BSocket>	socket;
+		bigtime_t					releasedAt;
+	};
+	typedef std::map<std::string, std::deque<Entry>> IdleMap;
+
+			void						_EvictExpired(bigtime_t now);
+			void						_EvictOldest();
+			void						_Trim(IdleMap::iterator it);
+
+			BLocker						fLock;
+			IdleMap						fIdle;
+			size_t						fIdleCount = 0;
+			size_t						fMaxIdlePerHost = kDefaultMaxIdlePerHost;
+			size_t						fMaxIdle = kDefaultMaxIdle;
+			bigtime_t					fIdleTimeout = kDefaultIdleTimeout;
+};
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _HTTP_CONNECTION_POOL_H_
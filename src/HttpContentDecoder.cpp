@@ -0,0 +1,295 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+
+#include "HttpContentDecoder.h"
+
+#include <algorithm>
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+
+#include <zlib.h>
+#ifdef BROTLI_ENABLED
+#include <brotli/decode.h>
+#endif
+#ifdef ZSTD_ENABLED
+#include <zstd.h>
+#endif
+
+#include <ErrorsExt.h>
+
+using namespace BPrivate::Network;
+using BPrivate::BError;
+
+
+/*!	Decoder for the gzip and the deflate (zlib) content codings; zlib tells
+	them apart by their header.
+*/
+class ZlibDecoder : public HttpContentDecoder {
+public:
+	ZlibDecoder()
+	{
+		memset(&fStream, 0, sizeof(fStream));
+		if (inflateInit2(&fStream, kWindowBits) != Z_OK)
+			throw BError(B_NO_MEMORY, "Could not create decompression stream");
+	}
+
+	~ZlibDecoder() override
+	{
+		inflateEnd(&fStream);
+	}
+
+	const char* Encoding() const override { return "gzip"; }
+
+	bool Decode(const char*& input, size_t& inputSize, char*& output,
+		size_t& outputSize) override
+	{
+		if (fDone) {
+			input += inputSize;
+			inputSize = 0;
+			return true;
+		}
+
+		fStream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input));
+		fStream.avail_in = std::min(inputSize, (size_t)UINT_MAX);
+		fStream.next_out = reinterpret_cast<Bytef*>(output);
+		fStream.avail_out = std::min(outputSize, (size_t)UINT_MAX);
+		int result = inflate(&fStream, Z_NO_FLUSH);
+		if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+			throw BError(B_BAD_DATA, "Error decompressing data");
+
+		size_t used = reinterpret_cast<const char*>(fStream.next_in) - input;
+		input += used;
+		inputSize -= used;
+		size_t produced = reinterpret_cast<char*>(fStream.next_out) - output;
+		output += produced;
+		outputSize -= produced;
+
+		fDone = result == Z_STREAM_END;
+		return fDone;
+	}
+
+	void Reset() override
+	{
+		inflateReset(&fStream);
+		fDone = false;
+	}
+
+private:
+	static	const int			kWindowBits = 15 + 32;
+									// the largest window, and detect the
+									// gzip or zlib header
+			z_stream			fStream;
+			bool				fDone = false;
+};
+
+
+#ifdef BROTLI_ENABLED
+
+/*!	Decoder for the br content coding (RFC 7932).
+*/
+class BrotliDecoder : public HttpContentDecoder {
+public:
+	BrotliDecoder()
+	{
+		_Create();
+	}
+
+	~BrotliDecoder() override
+	{
+		BrotliDecoderDestroyInstance(fState);
+	}
+
+	const char* Encoding() const override { return "br"; }
+
+	bool Decode(const char*& input, size_t& inputSize, char*& output,
+		size_t& outputSize) override
+	{
+		if (fDone) {
+			input += inputSize;
+			inputSize = 0;
+			return true;
+		}
+
+		const uint8_t* nextIn = reinterpret_cast<const uint8_t*>(input);
+		uint8_t* nextOut = reinterpret_cast<uint8_t*>(output);
+		BrotliDecoderResult result = BrotliDecoderDecompressStream(fState,
+			&inputSize, &nextIn, &outputSize, &nextOut, NULL);
+		if (result == BROTLI_DECODER_RESULT_ERROR)
+			throw BError(B_BAD_DATA, "Error decompressing data");
+		input = reinterpret_cast<const char*>(nextIn);
+		output = reinterpret_cast<char*>(nextOut);
+
+		fDone = result == BROTLI_DECODER_RESULT_SUCCESS;
+		return fDone;
+	}
+
+	void Reset() override
+	{
+		// The decoder can not be reset, so the state is set up again
+		BrotliDecoderDestroyInstance(fState);
+		_Create();
+		fDone = false;
+	}
+
+private:
+	void _Create()
+	{
+		fState = BrotliDecoderCreateInstance(NULL, NULL, NULL);
+		if (fState == NULL)
+			throw BError(B_NO_MEMORY, "Could not create decompression stream");
+	}
+
+			BrotliDecoderState*	fState;
+			bool				fDone = false;
+};
+
+#endif
+
+
+#ifdef ZSTD_ENABLED
+
+/*!	Decoder for the zstd content coding (RFC 8878).
+*/
+class ZstdDecoder : public HttpContentDecoder {
+public:
+	ZstdDecoder()
+	{
+		fContext = ZSTD_createDCtx();
+		if (fContext == NULL)
+			throw BError(B_NO_MEMORY, "Could not create decompression stream");
+		// Limit the memory a response may claim to what RFC 8878 requires
+		ZSTD_DCtx_setParameter(fContext, ZSTD_d_windowLogMax, kWindowLogMax);
+	}
+
+	~ZstdDecoder() override
+	{
+		ZSTD_freeDCtx(fContext);
+	}
+
+	const char* Encoding() const override { return "zstd"; }
+
+	bool Decode(const char*& input, size_t& inputSize, char*& output,
+		size_t& outputSize) override
+	{
+		if (fDone) {
+			input += inputSize;
+			inputSize = 0;
+			return true;
+		}
+
+		ZSTD_inBuffer in = { input, inputSize, 0 };
+		ZSTD_outBuffer out = { output, outputSize, 0 };
+		size_t result = ZSTD_decompressStream(fContext, &out, &in);
+		if (ZSTD_isError(result))
+			throw BError(B_BAD_DATA, "Error decompressing data");
+		input += in.pos;
+		inputSize -= in.pos;
+		output += out.pos;
+		outputSize -= out.pos;
+
+		// The frame is complete, and all of it has been written
+		fDone = result == 0;
+		return fDone;
+	}
+
+	void Reset() override
+	{
+		ZSTD_DCtx_reset(fContext, ZSTD_reset_session_only);
+		fDone = false;
+	}
+
+private:
+	static	const int			kWindowLogMax = 23;
+									// 8 MiB
+			ZSTD_DCtx*			fContext;
+			bool				fDone = false;
+};
+
+#endif
+
+
+template<typename Decoder>
+static HttpContentDecoder*
+CreateDecoder()
+{
+	return new Decoder();
+}
+
+
+// The content codings that can be decoded, in the order of preference in which
+// they are advertised. Aliases are not advertised, and neither is deflate, as
+// some servers send it without the zlib wrapper.
+static const struct {
+	const char*				encoding;
+	const char*				decoder;
+	HttpContentDecoder*		(*create)();
+	bool					advertise;
+} kDecoders[] = {
+#ifdef ZSTD_ENABLED
+	{ "zstd", "zstd", CreateDecoder<ZstdDecoder>, true },
+#endif
+#ifdef BROTLI_ENABLED
+	{ "br", "br", CreateDecoder<BrotliDecoder>, true },
+#endif
+	{ "gzip", "gzip", CreateDecoder<ZlibDecoder>, true },
+	{ "deflate", "gzip", CreateDecoder<ZlibDecoder>, false },
+	{ "x-gzip", "gzip", CreateDecoder<ZlibDecoder>, false },
+};
+
+
+// #pragma mark - HttpContentDecoderPool
+
+
+/*static*/ const char*
+HttpContentDecoderPool::AcceptEncoding()
+{
+	static const std::string acceptEncoding = []() {
+		std::string value;
+		for (const auto& type: kDecoders) {
+			if (!type.advertise)
+				continue;
+			if (!value.empty())
+				value += ", ";
+			value += type.encoding;
+		}
+		return value;
+	}();
+	return acceptEncoding.c_str();
+}
+
+
+std::unique_ptr<HttpContentDecoder>
+HttpContentDecoderPool::Get(const std::string& encoding)
+{
+	for (const auto& type: kDecoders) {
+		if (strcasecmp(encoding.c_str(), type.encoding) != 0)
+			continue;
+
+		for (auto it = fDecoders.begin(); it != fDecoders.end(); it++) {
+			if (strcmp((*it)->Encoding(), type.decoder) == 0) {
+				auto decoder = std::move(*it);
+				fDecoders.erase(it);
+				return decoder;
+			}
+		}
+		return std::unique_ptr<HttpContentDecoder>(type.create());
+	}
+	return nullptr;
+}
+
+
+void
+HttpContentDecoderPool::Put(std::unique_ptr<HttpContentDecoder> decoder)
+{
+	if (fDecoders.size() >= kMaxPooledDecoders)
+		return;
+	decoder->Reset();
+	fDecoders.push_back(std::move(decoder));
+}
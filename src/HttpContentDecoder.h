@@ -0,0 +1,84 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _HTTP_CONTENT_DECODER_H_
+#define _HTTP_CONTENT_DECODER_H_
+
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <SupportDefs.h>
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+/*!	Streaming decoder for a content coding of a response body.
+
+	The encoded data is decoded as it is received, straight from the receive
+	buffer into the output that the caller provides, so that there is no
+	intermediate buffer. Decoders keep a fair amount of state, so they are
+	reused for later responses through a HttpContentDecoderPool.
+
+	The gzip and deflate codings are always supported. Brotli (br) and zstd
+	are supported when the library is built with BROTLI_ENABLED and
+	ZSTD_ENABLED.
+
+	Errors in the encoded data are thrown as a BError.
+*/
+class HttpContentDecoder {
+public:
+	virtual						~HttpContentDecoder() {}
+
+	// The main content coding that the decoder handles; the pool reuses the
+	// decoder for all the codings that map to it
+	virtual	const char*			Encoding() const = 0;
+
+	// Decode from \a input into \a output. Both are advanced past the data
+	// that was used and produced. The caller keeps calling as long as there is
+	// input left, or the output was filled up. Returns true once the end of
+	// the encoded data is reached; any input after that is ignored.
+	virtual	bool				Decode(const char*& input, size_t& inputSize,
+									char*& output, size_t& outputSize) = 0;
+
+	// Get ready to decode a new body
+	virtual	void				Reset() = 0;
+};
+
+
+/*!	Decoders that are kept for reuse, for the responses that are received by
+	one thread.
+*/
+class HttpContentDecoderPool {
+public:
+	static	const size_t		kMaxPooledDecoders = 8;
+
+	// The value for the Accept-Encoding header: the content codings for which
+	// a decoder is built in
+	static	const char*			AcceptEncoding();
+
+	// Get a decoder for \a encoding, or nullptr when the encoding is not
+	// supported
+			std::unique_ptr<HttpContentDecoder> Get(const std::string& encoding);
+	// Hand a decoder back once the body is decoded
+			void				Put(std::unique_ptr<HttpContentDecoder> decoder);
+
+private:
+			std::vector<std::unique_ptr<HttpContentDecoder>> fDecoders;
+};
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _HTTP_CONTENT_DECODER_H_
@@ -23,6 +23,11 @@ using BPrivate::BError;
 using namespace BPrivate::Network;
 
 
+static const bigtime_t kDefaultResponseTimeout = 60000000;
+static const bigtime_t kDefaultReadTimeout = 60000000;
+	// one minute
+
+
 BHttpRequest::BHttpRequest(const BUrl& url, bool ssl, const BHttpMethod method)
 	: fUrl(url),
 	fSSL(ssl),
@@ -30,7 +35,7 @@ BHttpRequest::BHttpRequest(const BUrl& url, bool ssl, const BHttpMethod method)
 	fHttpVersion(B_HTTP_11),
 	fOptHeaders(NULL),
 	fOptPostFields(NULL),
-	fOptInputData(NULL),
+	fOptInputData(nullptr),
 	fOptInputDataSize(-1),
 	fOptRangeStart(-1),
 	fOptRangeEnd(-1),
@@ -60,6 +65,147 @@ BHttpRequest::Get(const BUrl& url)
 }
 
 
+void
+BHttpRequest::SetMethod(const BHttpMethod& method)
+{
+	fRequestMethod = method;
+}
+
+
+/*!	Set the version of the protocol that is used to send the request.
+
+	Requests with \c B_HTTP_2 over cleartext connections are sent with prior
+	knowledge: the session assumes that the server speaks HTTP/2 without
+	upgrading an HTTP/1.1 connection first. Secure requests fall back to
+	HTTP/1.1, as the protocol cannot be negotiated during the TLS handshake.
+*/
+void
+BHttpRequest::SetHttpVersion(int8 version)
+{
+	if (version < B_HTTP_10 || version > B_HTTP_2)
+		throw BError(B_BAD_VALUE, "Unsupported HTTP version");
+	fHttpVersion = version;
+}
+
+
+/*!	Use \a data as the body of the request.
+
+	The request takes ownership of \a data. If the \a size is known, it is sent
+	as the Content-Length of the request, otherwise the body is sent with the
+	chunked transfer encoding (which requires HTTP/1.1).
+*/
+void
+BHttpRequest::AdoptInputData(BDataIO* data, ssize_t size,
+	const BString& contentType)
+{
+	fOptInputData = std::shared_ptr<BDataIO>(data);
+	fOptInputDataSize = size;
+	fOptInputDataType = contentType;
+}
+
+
+/*!	Limit how often the observer is told about the progress of the request.
+
+	An update is sent once at least \a interval has passed since the previous
+	one, and the transfer has moved on by at least \a bytes. The updates in
+	between are folded into the next message, and the last one is always sent
+	before the request is completed. With an interval of 0 and no bytes, every
+	update is sent.
+*/
+void
+BHttpRequest::SetProgressInterval(bigtime_t interval, off_t bytes)
+{
+	if (interval < 0 || bytes < 0)
+		throw BError(B_BAD_VALUE, "Invalid progress interval");
+	fOptProgressInterval = interval;
+	fOptProgressBytes = bytes;
+}
+
+
+/*!	Limit the time that the request takes as a whole, from the moment the
+	session starts it until the body is received. B_INFINITE_TIMEOUT, the
+	default, sets no limit. A request that takes too long fails with
+	B_HTTP_REQUEST_TIMEOUT.
+*/
+void
+BHttpRequest::SetTimeout(bigtime_t timeout)
+{
+	if (timeout <= 0)
+		throw BError(B_BAD_VALUE, "Invalid timeout");
+	fOptTimeout = timeout;
+}
+
+
+/*!	Limit the time to set up a connection for the request, when it does not
+	get one that is already open. The connect timeout of the session applies
+	as well. When the connection is not set up in time, the request fails with
+	B_HTTP_CONNECT_TIMEOUT.
+*/
+void
+BHttpRequest::SetConnectTimeout(bigtime_t timeout)
+{
+	if (timeout <= 0)
+		throw BError(B_BAD_VALUE, "Invalid timeout");
+	fOptConnectTimeout = timeout;
+}
+
+
+/*!	Limit the time between sending the request and the start of the response
+	(one minute by default). A request that is pipelined behind others waits
+	for their responses first; its time starts when it is next in line. When
+	the response does not start in time, the request fails with
+	B_HTTP_RESPONSE_TIMEOUT.
+*/
+void
+BHttpRequest::SetResponseTimeout(bigtime_t timeout)
+{
+	if (timeout <= 0)
+		throw BError(B_BAD_VALUE, "Invalid timeout");
+	fOptResponseTimeout = timeout;
+}
+
+
+/*!	Limit the time that no data arrives while the response is received (one
+	minute by default). Time in which the session does not read because the
+	body target has to catch up does not count. When the server stalls for
+	longer, the request fails with B_HTTP_READ_TIMEOUT.
+*/
+void
+BHttpRequest::SetReadTimeout(bigtime_t timeout)
+{
+	if (timeout <= 0)
+		throw BError(B_BAD_VALUE, "Invalid timeout");
+	fOptReadTimeout = timeout;
+}
+
+
+/*!	Set how many times the request is tried before a transient failure is
+	passed on, including the first time. This overrides the number of attempts
+	of the session; 1 turns retries off. Only GET and HEAD requests without
+	input data are tried again.
+*/
+void
+BHttpRequest::SetMaxAttempts(int32 attempts)
+{
+	if (attempts < 1)
+		throw BError(B_BAD_VALUE, "Invalid number of attempts");
+	fOptMaxAttempts = attempts;
+}
+
+
+/*!	Set whether the session follows redirects itself (the default), up to
+	\a maxRedirects of them in a row. The response to the last request is
+	reported, with the identity of the original request. A redirect that is
+	not followed, such as the one after the last, is reported as it is.
+*/
+void
+BHttpRequest::SetFollowLocation(bool follow, uint8 maxRedirects)
+{
+	fOptFollowLocation = follow;
+	fOptMaxRedirs = maxRedirects;
+}
+
+
 /*static*/ bool
 BHttpRequest::IsInformationalStatusCode(int16 code)
 {
@@ -138,5 +284,12 @@ BHttpRequest::_ResetOptions()
 	fOptDiscardData = false;
 	fOptDisableListener = false;
 	fOptAutoReferer = true;
+	fOptProgressInterval = 100000;
+	fOptProgressBytes = 4096;
+	fOptTimeout = B_INFINITE_TIMEOUT;
+	fOptConnectTimeout = B_INFINITE_TIMEOUT;
+	fOptResponseTimeout = kDefaultResponseTimeout;
+	fOptReadTimeout = kDefaultReadTimeout;
+	fOptMaxAttempts = 0;
 }
 
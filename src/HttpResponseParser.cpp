@@ -0,0 +1,263 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+
+#include "HttpResponseParser.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || (defined(__GNUC__) \
+	&& (defined(__x86_64__) || defined(__i386__)))
+#include <immintrin.h>
+#define FIND_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <ErrorsExt.h>
+#include <HttpResult.h>
+
+using namespace BPrivate::Network;
+using BPrivate::BError;
+
+
+static const char*
+FindFirstOfScalar(const char* start, const char* end, char a, char b)
+{
+	while (start < end && *start != a && *start != b)
+		start++;
+	return start;
+}
+
+
+#if defined(__SSE2__)
+
+static const char*
+FindFirstOfSse2(const char* start, const char* end, char a, char b)
+{
+	const __m128i vectorA = _mm_set1_epi8(a);
+	const __m128i vectorB = _mm_set1_epi8(b);
+	for (; end - start >= 16; start += 16) {
+		__m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(start));
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(data, vectorA),
+			_mm_cmpeq_epi8(data, vectorB)));
+		if (mask != 0)
+			return start + __builtin_ctz(mask);
+	}
+	return FindFirstOfScalar(start, end, a, b);
+}
+
+#endif
+
+
+#if defined(FIND_X86) && defined(__GNUC__)
+
+// Only used when the CPU supports it, so it is compiled for AVX2 regardless of
+// the target of the rest of the code
+__attribute__((target("avx2"))) static const char*
+FindFirstOfAvx2(const char* start, const char* end, char a, char b)
+{
+	const __m256i vectorA = _mm256_set1_epi8(a);
+	const __m256i vectorB = _mm256_set1_epi8(b);
+	for (; end - start >= 32; start += 32) {
+		__m256i data = _mm256_loadu_si256(
+			reinterpret_cast<const __m256i*>(start));
+		uint32 mask = _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_cmpeq_epi8(data, vectorA), _mm256_cmpeq_epi8(data, vectorB)));
+		if (mask != 0)
+			return start + __builtin_ctz(mask);
+	}
+	return FindFirstOfScalar(start, end, a, b);
+}
+
+#endif
+
+
+#if defined(__ARM_NEON)
+
+static const char*
+FindFirstOfNeon(const char* start, const char* end, char a, char b)
+{
+	const uint8x16_t vectorA = vdupq_n_u8(a);
+	const uint8x16_t vectorB = vdupq_n_u8(b);
+	for (; end - start >= 16; start += 16) {
+		uint8x16_t data = vld1q_u8(reinterpret_cast<const uint8*>(start));
+		uint8x16_t matches = vorrq_u8(vceqq_u8(data, vectorA),
+			vceqq_u8(data, vectorB));
+		// Narrow every byte of the result to 4 bits, to get it in one word
+		uint64 mask = vget_lane_u64(vreinterpret_u64_u8(
+			vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+		if (mask != 0)
+			return start + (__builtin_ctzll(mask) >> 2);
+	}
+	return FindFirstOfScalar(start, end, a, b);
+}
+
+#endif
+
+
+typedef const char* (*FindFirstOfFunction)(const char*, const char*, char, char);
+
+
+static FindFirstOfFunction
+SelectFindFirstOf()
+{
+#if defined(FIND_X86) && defined(__GNUC__)
+	if (__builtin_cpu_supports("avx2"))
+		return FindFirstOfAvx2;
+#endif
+#if defined(__SSE2__)
+	return FindFirstOfSse2;
+#elif defined(__ARM_NEON)
+	return FindFirstOfNeon;
+#else
+	return FindFirstOfScalar;
+#endif
+}
+
+
+const char*
+BPrivate::Network::FindFirstOf(const char* start, const char* end, char a,
+	char b)
+{
+	static const FindFirstOfFunction function = SelectFindFirstOf();
+	return function(start, end, a, b);
+}
+
+
+// #pragma mark - HttpResponseParser
+
+
+size_t
+HttpResponseParser::ParseStatus(char* data, size_t size, BHttpStatus& status,
+	bool& http11)
+{
+	size_t end = _FindLineEnd(data, size, false);
+	if (end == size)
+		return 0;
+	size_t length = _LineEnd(data, end);
+
+	// HTTP-version SP 3DIGIT [SP reason-phrase]
+	const char* line = data;
+	if (length < 12 || memcmp(line, "HTTP/1.", 7) != 0
+		|| line[7] < '0' || line[7] > '9' || line[8] != ' '
+		|| (length > 12 && line[12] != ' '))
+		throw BError(B_BAD_DATA, "Invalid status line");
+	int32 code = 0;
+	for (int i = 9; i < 12; i++) {
+		if (line[i] < '0' || line[i] > '9')
+			throw BError(B_BAD_DATA, "Invalid status code");
+		code = code * 10 + line[i] - '0';
+	}
+
+	http11 = line[7] == '1';
+	status.code = code;
+	status.text.assign(length > 13 ? line + 13 : "", length > 13 ? length - 13 : 0);
+	return end + 1;
+}
+
+
+size_t
+HttpResponseParser::ParseField(char* data, size_t size, const char*& name,
+	const char*& value)
+{
+	name = nullptr;
+	value = nullptr;
+
+	size_t end = _FindLineEnd(data, size, true);
+	if (end == size)
+		return 0;
+	bool colonFound = fColonFound;
+	size_t colon = fColon;
+	size_t length = _LineEnd(data, end);
+
+	if (length == 0) {
+		fDone = true;
+		return end + 1;
+	}
+	if (!colonFound || colon >= length) {
+		// not a header field; it is ignored
+		return end + 1;
+	}
+
+	// The value is trimmed of the whitespace around it
+	data[colon] = '\0';
+	size_t valueStart = colon + 1;
+	while (valueStart < length
+		&& (data[valueStart] == ' ' || data[valueStart] == '\t'))
+		valueStart++;
+	while (length > valueStart
+		&& (data[length - 1] == ' ' || data[length - 1] == '\t'))
+		data[--length] = '\0';
+
+	name = data;
+	value = data + valueStart;
+	return end + 1;
+}
+
+
+void
+HttpResponseParser::Reset()
+{
+	fScanned = 0;
+	fColon = 0;
+	fColonFound = false;
+	fHeadSize = 0;
+	fDone = false;
+}
+
+
+/*!	Find the end of the line at the start of \a data; returns \a size when the
+	line is not complete yet. The scan continues where the previous call for
+	the same line stopped. When \a findColon is set, the first colon of the
+	line is looked for in the same pass.
+*/
+size_t
+HttpResponseParser::_FindLineEnd(const char* data, size_t size,
+	bool findColon)
+{
+	const char* end = data + size;
+	const char* position = data + fScanned;
+	if (findColon && !fColonFound) {
+		position = FindFirstOf(position, end, ':', '\n');
+		if (position < end && *position == ':') {
+			fColonFound = true;
+			fColon = position - data;
+			position = FindFirstOf(position + 1, end, '\n', '\n');
+		}
+	} else
+		position = FindFirstOf(position, end, '\n', '\n');
+
+	fScanned = position - data;
+	if (position == end) {
+		if (fHeadSize + size > kMaxHeadSize)
+			throw BError(B_BAD_DATA, "Response head is too large");
+		return size;
+	}
+	return fScanned;
+}
+
+
+/*!	Terminate the line that ends with the line feed at \a end, and get ready
+	for the next line. Returns the length of the line without the line ending.
+*/
+size_t
+HttpResponseParser::_LineEnd(char* data, size_t end)
+{
+	fHeadSize += end + 1;
+	if (fHeadSize > kMaxHeadSize)
+		throw BError(B_BAD_DATA, "Response head is too large");
+	fScanned = 0;
+	fColonFound = false;
+
+	size_t length = end;
+	if (length > 0 && data[length - 1] == '\r')
+		length--;
+	data[length] = '\0';
+	return length;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _HTTP_RESPONSE_PARSER_H_
+#define _HTTP_RESPONSE_PARSER_H_
+
+
+#include <SupportDefs.h>
+
+
+namespace BPrivate {
+
+namespace Network {
+
+struct BHttpStatus;
+
+
+/*!	Incremental parser for the head of an HTTP/1.x response.
+
+	The parser works on the received data where it is, which it gets passed
+	starting at the start of the line that is being parsed. When a line is not
+	complete yet, the caller passes the same data again, extended with what is
+	received next; the parser continues to scan where it left off. Lines are
+	scanned for the line end, and for the colon in a header field, many bytes
+	at a time with the vector instructions of the CPU.
+
+	The line that is returned is terminated in place, so it can be used until
+	the data is changed. Errors in the response head are thrown as a BError.
+*/
+class HttpResponseParser {
+public:
+	static	const size_t		kMaxHeadSize = 65536;
+
+	// Parse the status line at the start of \a data. Returns the number of
+	// bytes that were used, or 0 when the line is not complete yet.
+			size_t				ParseStatus(char* data, size_t size,
+									BHttpStatus& status, bool& http11);
+
+	// Parse the header field at the start of \a data. Returns the number of
+	// bytes that were used, or 0 when the line is not complete yet. The name
+	// is nullptr for a line that is not a header field, and at the empty line
+	// that ends the head.
+			size_t				ParseField(char* data, size_t size,
+									const char*& name, const char*& value);
+
+			bool				IsDone() const { return fDone; }
+			void				Reset();
+
+private:
+			size_t				_FindLineEnd(const char* data, size_t size,
+									bool findColon);
+			size_t				_LineEnd(char* data, size_t end);
+
+			size_t				fScanned = 0;
+			size_t				fColon = 0;
+			bool				fColonFound = false;
+			size_t				fHeadSize = 0;
+			bool				fDone = false;
+};
+
+
+// Find the first \a a or \a b between \a start and \a end; returns \a end when
+// there is none
+const char* FindFirstOf(const char* start, const char* end, char a, char b);
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _HTTP_RESPONSE_PARSER_H_
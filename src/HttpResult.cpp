@@ -138,6 +138,18 @@ BHttpResult::Identity() const
 }
 
 
+/*!	The number of times the request has been tried so far; more than one when
+	the session retried it after a transient failure.
+*/
+int32
+BHttpResult::Attempts() const
+{
+	if (!fData)
+		throw std::runtime_error("The BHttpResult object is no longer valid");
+	return fData->GetAttemptsAtomic();
+}
+
+
 } // namespace Network
 
 } // namespace BPrivate
@@ -10,7 +10,15 @@
 #define _HTTP_RESULT_PRIVATE_H_
 
 
+#include <deque>
+#include <functional>
 #include <optional>
+#include <string>
+
+#include <HttpRingBuffer.h>
+#include <Locker.h>
+
+#include "AutoLocker.h"
 
 
 namespace BPrivate {
@@ -32,6 +40,8 @@ struct HttpResultPrivate {
 			};
 			int32						requestStatus = kNoData;
 			int32						canCancel = 0;
+			int32						cancelRequested = 0;
+			int32						attempts = 1;
 
 	// Data
 			std::optional<BHttpStatus>	status;
@@ -41,19 +51,47 @@ struct HttpResultPrivate {
 
 	// Body storage
 			std::unique_ptr<BDataIO>	owned_body = nullptr;
-	//		std::shared_ptr<BMemoryRingIO>	shared_body = nullptr;
+			std::shared_ptr<BHttpRingBuffer>	shared_body = nullptr;
 			std::string					body_text;
 
+	// Body data that a worker writes to the target, so that a slow target
+	// does not hold up the data thread (locked by body_lock). For a shared
+	// ring, the queue holds what did not fit in the ring; it is only used by
+	// the data thread until the body is complete.
+			BLocker						body_lock{"http:body"};
+			std::deque<std::string>		body_queue;
+			size_t						body_backlog = 0;
+			bool						body_writing = false;
+			bool						body_waiting = false;
+			bool						body_complete = false;
+			std::optional<BError>		body_error;
+			std::function<void()>		body_resume;
+			std::function<void(bool)>	body_completed;
+
 	// Utility functions
 										HttpResultPrivate(int32 identifier);
+										~HttpResultPrivate();
 			int32						GetStatusAtomic();
+			int32						GetAttemptsAtomic();
+			void						SetAttempts(int32 count);
 			bool						CanCancel();
 			void						SetCancel();
+			bool						IsCancelRequested();
+			void						RequestCancel();
 			void						SetError(const BError& e);
 			void						SetStatus(BHttpStatus&& s);
 			void						SetHeaders(BHttpHeaders&& h);
-			void						SetBody();
-			ssize_t						WriteToBody(const void* buffer, ssize_t size);
+			void						SetBody(std::function<void(bool)>
+											completed = nullptr);
+			bool						WriteToBody(const void* buffer, size_t size);
+			bool						PauseBody(size_t limit,
+											const std::function<void()>& resume);
+			void						WriteQueuedBody(size_t resumeSize,
+											const std::function<void()>& resume);
+			void						SetSharedBody(
+											std::shared_ptr<BHttpRingBuffer> target);
+			void						WriteToRing();
+			void						RingHasSpace();
 };
 
 
@@ -68,6 +106,17 @@ HttpResultPrivate::HttpResultPrivate(int32 identifier)
 }
 
 
+inline
+HttpResultPrivate::~HttpResultPrivate()
+{
+	if (shared_body != nullptr) {
+		// The ring may outlive the result; it is not written to anymore
+		shared_body->_SetSpaceHook(nullptr);
+		shared_body->SetWriteDisabled(true);
+	}
+}
+
+
 inline int32
 HttpResultPrivate::GetStatusAtomic()
 {
@@ -75,6 +124,20 @@ HttpResultPrivate::GetStatusAtomic()
 }
 
 
+inline int32
+HttpResultPrivate::GetAttemptsAtomic()
+{
+	return atomic_get(&attempts);
+}
+
+
+inline void
+HttpResultPrivate::SetAttempts(int32 count)
+{
+	atomic_set(&attempts, count);
+}
+
+
 inline bool
 HttpResultPrivate::CanCancel()
 {
@@ -89,12 +152,40 @@ HttpResultPrivate::SetCancel()
 }
 
 
+inline bool
+HttpResultPrivate::IsCancelRequested()
+{
+	return atomic_get(&cancelRequested) == 1;
+}
+
+
+inline void
+HttpResultPrivate::RequestCancel()
+{
+	atomic_set(&cancelRequested, 1);
+}
+
+
 inline void
 HttpResultPrivate::SetError(const BError& e)
 {
 	error = e;
 	atomic_set(&requestStatus, kError);
+	std::function<void(bool)> done;
+	if (shared_body != nullptr) {
+		// The reader gets the end of the data, and finds the error in the
+		// result
+		AutoLocker<BLocker> locker(body_lock);
+		body_queue.clear();
+		body_complete = false;
+		body_resume = nullptr;
+		done = std::move(body_completed);
+		body_completed = nullptr;
+		shared_body->SetWriteDisabled(true);
+	}
 	release_sem(data_wait);
+	if (done)
+		done(false);
 }
 
 
@@ -116,25 +207,243 @@ HttpResultPrivate::SetHeaders(BHttpHeaders&& h)
 }
 
 
+/*!	Make the body available, once all of it is received. When a worker is
+	still writing to the target, the body is made available once the worker
+	is done. When not all of the body fits in a shared ring, the rest is
+	written, and the body made available, when the reader has made room.
+
+	\a completed is called once the body is available, or once writing it
+	failed, with whether it succeeded; this may be from the thread of the
+	worker or of the reader.
+*/
 inline void
-HttpResultPrivate::SetBody()
+HttpResultPrivate::SetBody(std::function<void(bool)> completed)
 {
+	AutoLocker<BLocker> locker(body_lock);
+	if (completed)
+		body_completed = std::move(completed);
+	if (body_writing) {
+		body_complete = true;
+		return;
+	}
+	auto done = std::move(body_completed);
+	body_completed = nullptr;
+	if (body_error) {
+		locker.Unlock();
+		SetError(*body_error);
+		if (done)
+			done(false);
+		return;
+	}
+	if (shared_body != nullptr) {
+		body_resume = nullptr;
+		WriteToRing();
+		if (!body_queue.empty()) {
+			shared_body->_RequestSpace();
+			WriteToRing();
+			if (!body_queue.empty()) {
+				body_complete = true;
+				body_completed = std::move(done);
+				return;
+			}
+			shared_body->_CancelSpaceRequest();
+		}
+		body_complete = false;
+		shared_body->SetWriteDisabled(true);
+	}
+	locker.Unlock();
+
 	body = BHttpBody{std::move(owned_body), std::move(body_text)};
 	atomic_set(&requestStatus, kBodyReady);
 	release_sem(data_wait);
+	if (done)
+		done(true);
 }
 
 
-inline ssize_t
-HttpResultPrivate::WriteToBody(const void* buffer, ssize_t size)
+/*!	Add \a size bytes to the body.
+
+	The body text is added to straight away, and so is a shared ring as far as
+	there is room; the rest is kept until the reader has made room. Data for
+	the target is queued for a worker to write; returns true when a worker has
+	to be started for that. An error that the worker ran into is thrown as a
+	BError.
+*/
+inline bool
+HttpResultPrivate::WriteToBody(const void* buffer, size_t size)
 {
-	// TODO: when the support for a shared BMemoryRingIO is here, choose
-	// between one or the other depending on which one is available.
+	if (shared_body != nullptr) {
+		const char* data = static_cast<const char*>(buffer);
+		if (body_queue.empty()) {
+			ssize_t written = shared_body->Write(data, size);
+			if (written >= 0) {
+				data += written;
+				size -= written;
+			} else if (written != B_WOULD_BLOCK)
+				return false;
+		}
+		if (size > 0)
+			body_queue.emplace_back(data, size);
+		return false;
+	}
+
 	if (owned_body == nullptr) {
 		body_text.append(static_cast<const char*>(buffer), size);
-		return size;
+		return false;
+	}
+
+	AutoLocker<BLocker> locker(body_lock);
+	if (body_error)
+		throw *body_error;
+	body_queue.emplace_back(static_cast<const char*>(buffer), size);
+	body_backlog += size;
+	if (body_writing)
+		return false;
+	body_writing = true;
+	return true;
+}
+
+
+/*!	Check whether the worker is behind by \a limit bytes or more, or whether
+	the shared ring has no room for the data that is kept for it. In that case
+	the receiving should pause; the worker calls its resume function once it
+	has caught up, and for a shared ring \a resume is called once the reader
+	has made room.
+*/
+inline bool
+HttpResultPrivate::PauseBody(size_t limit, const std::function<void()>& resume)
+{
+	if (shared_body != nullptr) {
+		WriteToRing();
+		if (body_queue.empty())
+			return false;
+
+		{
+			AutoLocker<BLocker> locker(body_lock);
+			body_resume = resume;
+		}
+		shared_body->_RequestSpace();
+		WriteToRing();
+		if (!body_queue.empty())
+			return true;
+		shared_body->_CancelSpaceRequest();
+		return false;
+	}
+
+	if (owned_body == nullptr)
+		return false;
+
+	AutoLocker<BLocker> locker(body_lock);
+	body_waiting = body_backlog >= limit;
+	return body_waiting;
+}
+
+
+/*!	Write the queued body data to the target; called by a worker.
+
+	When the receiving was paused, \a resume is called once no more than
+	\a resumeSize bytes are left to write. When the body is complete, it is
+	made available once it has all been written.
+*/
+inline void
+HttpResultPrivate::WriteQueuedBody(size_t resumeSize,
+	const std::function<void()>& resume)
+{
+	AutoLocker<BLocker> locker(body_lock);
+	while (!body_queue.empty()) {
+		std::string data = std::move(body_queue.front());
+		body_queue.pop_front();
+		bool discard = body_error || CanCancel() || GetStatusAtomic() == kError;
+		locker.Unlock();
+
+		status_t status = discard
+			? B_OK : owned_body->WriteExactly(data.data(), data.size());
+
+		locker.Lock();
+		body_backlog -= data.size();
+		if (status != B_OK) {
+			body_error = BError(status, "Error writing the body");
+			body_backlog = 0;
+			body_queue.clear();
+		}
+		if (body_waiting && body_backlog <= resumeSize) {
+			body_waiting = false;
+			locker.Unlock();
+			resume();
+			locker.Lock();
+		}
+	}
+
+	body_writing = false;
+	if (body_complete) {
+		if (GetStatusAtomic() == kError) {
+			auto done = std::move(body_completed);
+			body_completed = nullptr;
+			locker.Unlock();
+			if (done)
+				done(false);
+			return;
+		}
+		locker.Unlock();
+		SetBody();
+	}
+}
+
+
+/*!	Stream the body to \a target, which the reader shares with the request.
+*/
+inline void
+HttpResultPrivate::SetSharedBody(std::shared_ptr<BHttpRingBuffer> target)
+{
+	shared_body = std::move(target);
+	shared_body->_SetSpaceHook([this]() { RingHasSpace(); });
+}
+
+
+/*!	Move the body data that did not fit in the shared ring into it, as far as
+	there is room. Until the body is complete, this is only done by the data
+	thread; after that, by the reader of the ring.
+*/
+inline void
+HttpResultPrivate::WriteToRing()
+{
+	while (!body_queue.empty()) {
+		std::string& data = body_queue.front();
+		ssize_t written = shared_body->Write(data.data(), data.size());
+		if (written == B_WOULD_BLOCK)
+			return;
+		if (written < 0) {
+			// writing was disabled, because the request failed
+			body_queue.clear();
+			return;
+		}
+		if ((size_t)written < data.size()) {
+			data.erase(0, written);
+			return;
+		}
+		body_queue.pop_front();
+	}
+}
+
+
+/*!	Called by the reader of the shared ring, when it has made room after the
+	writer asked for it. The receiving is resumed, or when the body is
+	complete, the rest of it is written.
+
+	The resume function is called with the lock held, so that it is not called
+	anymore once the request has failed and the session may be gone.
+*/
+inline void
+HttpResultPrivate::RingHasSpace()
+{
+	AutoLocker<BLocker> locker(body_lock);
+	if (!body_complete) {
+		if (body_resume)
+			body_resume();
+		return;
 	}
-	return owned_body->Write(buffer, size);
+	locker.Unlock();
+	SetBody();
 }
 
 
@@ -0,0 +1,268 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+#include <HttpRingBuffer.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+#include "AutoLocker.h"
+
+using namespace BPrivate::Network;
+
+
+static const size_t kMinBufferSize = 4096;
+
+
+BHttpRingBuffer::BHttpRingBuffer(size_t bufferSize)
+	: fHookLock("memory ring hook")
+{
+	// The size is a power of two, so that the positions can simply wrap around
+	fSize = kMinBufferSize;
+	while (fSize < bufferSize)
+		fSize *= 2;
+	fBuffer = std::make_unique<char[]>(fSize);
+
+	fReadSem = create_sem(0, "memory ring read");
+	fWriteSem = create_sem(0, "memory ring write");
+	if (fReadSem < 0 || fWriteSem < 0) {
+		delete_sem(fReadSem);
+		throw std::runtime_error("Cannot create memory ring semaphores");
+	}
+}
+
+
+BHttpRingBuffer::~BHttpRingBuffer()
+{
+	delete_sem(fReadSem);
+	delete_sem(fWriteSem);
+}
+
+
+ssize_t
+BHttpRingBuffer::Read(void* buffer, size_t size)
+{
+	return Read(buffer, size, B_INFINITE_TIMEOUT);
+}
+
+
+/*!	Read up to \a size bytes, waiting up to \a timeout for data. Returns 0 when
+	writing is disabled and all data has been read, B_TIMED_OUT when there was
+	no data in time, and B_WOULD_BLOCK when \a timeout is 0 and there is no
+	data.
+*/
+ssize_t
+BHttpRingBuffer::Read(void* buffer, size_t size, bigtime_t timeout)
+{
+	if (size == 0)
+		return 0;
+	status_t status = WaitForRead(timeout);
+	if (status != B_OK)
+		return status;
+
+	size_t position = fReadPosition.load(std::memory_order_relaxed);
+	size = std::min(size,
+		fWritePosition.load(std::memory_order_acquire) - position);
+	if (size == 0)
+		return 0;
+
+	size_t offset = position & (fSize - 1);
+	size_t first = std::min(size, fSize - offset);
+	memcpy(buffer, fBuffer.get() + offset, first);
+	memcpy(static_cast<char*>(buffer) + first, fBuffer.get(), size - first);
+	fReadPosition.store(position + size, std::memory_order_release);
+
+	_WakeWriter();
+	return size;
+}
+
+
+status_t
+BHttpRingBuffer::WaitForRead(bigtime_t timeout)
+{
+	return _Wait(fReaderWaiting, fReadSem, &BHttpRingBuffer::_CanRead, timeout);
+}
+
+
+size_t
+BHttpRingBuffer::BytesAvailable() const
+{
+	return fWritePosition.load(std::memory_order_acquire)
+		- fReadPosition.load(std::memory_order_acquire);
+}
+
+
+/*!	Write as much of \a size bytes as fits. Returns B_WOULD_BLOCK when the ring
+	is full, and B_NOT_ALLOWED when writing is disabled.
+*/
+ssize_t
+BHttpRingBuffer::Write(const void* buffer, size_t size)
+{
+	if (WriteDisabled())
+		return B_NOT_ALLOWED;
+	if (size == 0)
+		return 0;
+
+	size_t position = fWritePosition.load(std::memory_order_relaxed);
+	size = std::min(size,
+		fSize - (position - fReadPosition.load(std::memory_order_acquire)));
+	if (size == 0)
+		return B_WOULD_BLOCK;
+
+	size_t offset = position & (fSize - 1);
+	size_t first = std::min(size, fSize - offset);
+	memcpy(fBuffer.get() + offset, buffer, first);
+	memcpy(fBuffer.get(), static_cast<const char*>(buffer) + first,
+		size - first);
+	fWritePosition.store(position + size, std::memory_order_release);
+
+	_WakeReader();
+	return size;
+}
+
+
+status_t
+BHttpRingBuffer::WaitForWrite(bigtime_t timeout)
+{
+	return _Wait(fWriterWaiting, fWriteSem, &BHttpRingBuffer::_CanWrite, timeout);
+}
+
+
+size_t
+BHttpRingBuffer::SpaceAvailable() const
+{
+	return fSize - BytesAvailable();
+}
+
+
+void
+BHttpRingBuffer::SetWriteDisabled(bool disabled)
+{
+	fWriteDisabled.store(disabled, std::memory_order_release);
+	if (disabled)
+		_WakeReader();
+}
+
+
+bool
+BHttpRingBuffer::WriteDisabled() const
+{
+	return fWriteDisabled.load(std::memory_order_acquire);
+}
+
+
+void
+BHttpRingBuffer::_SetSpaceHook(std::function<void()> hook)
+{
+	AutoLocker<BLocker> locker(fHookLock);
+	fSpaceHook = std::move(hook);
+}
+
+
+/*!	Ask the reader to call the space hook once it has made room. The writer
+	checks for room once more after this, as the reader may have made room
+	before it noticed the request.
+*/
+void
+BHttpRingBuffer::_RequestSpace()
+{
+	fWriterWaiting.store(true, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+
+void
+BHttpRingBuffer::_CancelSpaceRequest()
+{
+	fWriterWaiting.store(false, std::memory_order_relaxed);
+}
+
+
+bool
+BHttpRingBuffer::_CanRead() const
+{
+	return BytesAvailable() > 0 || WriteDisabled();
+}
+
+
+bool
+BHttpRingBuffer::_CanWrite() const
+{
+	return SpaceAvailable() > 0 || WriteDisabled();
+}
+
+
+/*!	Wait until \a ready, for up to \a timeout.
+
+	The waiting flag is set before the last check, and the other side checks
+	it after it made a change, so that either this side sees the change, or the
+	other side sees the flag and releases \a sem. When the flag was cleared by
+	the other side, its release is consumed before returning.
+*/
+status_t
+BHttpRingBuffer::_Wait(std::atomic<bool>& waiting, sem_id sem,
+	bool (BHttpRingBuffer::*ready)() const, bigtime_t timeout)
+{
+	bigtime_t deadline = timeout == B_INFINITE_TIMEOUT
+		? B_INFINITE_TIMEOUT : system_time() + timeout;
+	while (!(this->*ready)()) {
+		if (timeout == 0)
+			return B_WOULD_BLOCK;
+
+		waiting.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if ((this->*ready)()) {
+			if (!waiting.exchange(false))
+				acquire_sem(sem);
+			break;
+		}
+
+		status_t status = deadline == B_INFINITE_TIMEOUT
+			? acquire_sem(sem)
+			: acquire_sem_etc(sem, 1, B_RELATIVE_TIMEOUT,
+				std::max(deadline - system_time(), (bigtime_t)0));
+		if (status == B_OK)
+			continue;
+		if (waiting.exchange(false)) {
+			if (status == B_INTERRUPTED)
+				continue;
+			return status == B_WOULD_BLOCK ? B_TIMED_OUT : status;
+		}
+		// The other side is about to release the semaphore
+		acquire_sem(sem);
+	}
+	return B_OK;
+}
+
+
+void
+BHttpRingBuffer::_WakeReader()
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (fReaderWaiting.load(std::memory_order_relaxed)
+		&& fReaderWaiting.exchange(false))
+		release_sem(fReadSem);
+}
+
+
+/*!	Wake up the writer once half of the ring is free, so that it does not wake
+	up for every read.
+*/
+void
+BHttpRingBuffer::_WakeWriter()
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!fWriterWaiting.load(std::memory_order_relaxed)
+		|| SpaceAvailable() < fSize / 2 || !fWriterWaiting.exchange(false))
+		return;
+
+	AutoLocker<BLocker> locker(fHookLock);
+	if (fSpaceHook)
+		fSpaceHook();
+	else
+		release_sem(fWriteSem);
+}
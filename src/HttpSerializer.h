@@ -0,0 +1,130 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _HTTP_SERIALIZER_H_
+#define _HTTP_SERIALIZER_H_
+
+
+#include <charconv>
+#include <string>
+
+#include <HttpRequest.h>
+#include <String.h>
+#include <Url.h>
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+/*!	Writes the head of an HTTP/1.x request into a string buffer.
+
+	The request line and the headers are appended to the buffer directly,
+	without intermediate header objects or streams. The buffer is cleared, but
+	keeps its capacity, so a buffer that is reused for the next request does
+	not need to allocate again.
+*/
+class HttpSerializer {
+public:
+	static	const size_t		kDefaultCapacity = 1024;
+
+	HttpSerializer(std::string& buffer)
+		:
+		fBuffer(buffer)
+	{
+		fBuffer.clear();
+		if (fBuffer.capacity() < kDefaultCapacity)
+			fBuffer.reserve(kDefaultCapacity);
+	}
+
+	void RequestLine(const std::string& method, const BUrl& url, int8 version)
+	{
+		fBuffer.append(method);
+		fBuffer += ' ';
+		if (url.HasPath() && url.Path().Length() > 0)
+			_Append(url.Path());
+		else
+			fBuffer += '/';
+		if (url.HasRequest()) {
+			fBuffer += '?';
+			_Append(url.Request());
+		}
+		if (version == B_HTTP_11)
+			fBuffer.append(" HTTP/1.1\r\n");
+		else
+			fBuffer.append(" HTTP/1.0\r\n");
+	}
+
+	// The Host header; the port is left out when it is the default one
+	void Host(const BUrl& url, int defaultPort)
+	{
+		_Name("Host");
+		_Append(url.Host());
+		if (url.HasPort() && url.Port() != defaultPort) {
+			fBuffer += ':';
+			_Append((off_t)url.Port());
+		}
+		fBuffer.append("\r\n");
+	}
+
+	void Header(const char* name, const char* value)
+	{
+		_Name(name);
+		fBuffer.append(value);
+		fBuffer.append("\r\n");
+	}
+
+	void Header(const char* name, const BString& value)
+	{
+		_Name(name);
+		_Append(value);
+		fBuffer.append("\r\n");
+	}
+
+	void Header(const char* name, off_t value)
+	{
+		_Name(name);
+		_Append(value);
+		fBuffer.append("\r\n");
+	}
+
+	// Ends the header section
+	void End()
+	{
+		fBuffer.append("\r\n");
+	}
+
+private:
+	void _Name(const char* name)
+	{
+		fBuffer.append(name);
+		fBuffer.append(": ");
+	}
+
+	void _Append(const BString& value)
+	{
+		fBuffer.append(value.String(), value.Length());
+	}
+
+	void _Append(off_t value)
+	{
+		char digits[24];
+		auto result = std::to_chars(digits, digits + sizeof(digits), value);
+		fBuffer.append(digits, result.ptr - digits);
+	}
+
+	std::string&				fBuffer;
+};
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _HTTP_SERIALIZER_H_
@@ -6,27 +6,46 @@
  *		Niels Sascha Reedijk, niels.reedijk@gmail.com
  */
 
+#include <algorithm>
 #include <deque>
+#include <errno.h>
 #include <fcntl.h>
+#include <functional>
 #include <iostream>
+#include <list>
 #include <map>
-#include <sstream>
+#include <optional>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unordered_map>
 #include <vector>
 
-#include <DynamicBuffer.h>
 #include <HttpRequest.h>
 #include <HttpResult.h>
 #include <HttpSession.h>
 #include <Locker.h>
-#include <NetBuffer.h>
 #include <NetServices.h>
 #include <NetworkAddress.h>
 #include <OS.h>
-#include <StackOrHeapArray.h>
-#include <ZlibCompressionAlgorithm.h>
 
 #include "AutoLocker.h"
+#include "EventLoop.h"
+#include "HostResolver.h"
+#include "Http2Connection.h"
+#include "HttpChunkedDecoder.h"
+#include "HttpConnectionPool.h"
+#include "HttpContentDecoder.h"
 #include "HttpResultPrivate.h"
+#include "HttpResponseParser.h"
+#include "HttpSerializer.h"
+#include "HttpSocket.h"
+#include "MpscQueue.h"
+#include "ReceiveBuffer.h"
+#include "RequestScheduler.h"
+#include "TimerWheel.h"
+#include "WorkerPool.h"
 
 using namespace BPrivate::Network;
 
@@ -38,56 +57,129 @@ namespace BPrivate::Network::UrlEventData {
 }
 
 
-struct BHttpSession::Data {
-	// constants (does not need to be locked to be accessed)
-	thread_id							controlThread;
-	thread_id							dataThread;
-	sem_id								controlQueueSem;
-	sem_id								dataQueueSem;
-	// locking mechanism
-	BLocker								lock;
-	int32								quitting = 0;
-	// queues
-	std::deque<BHttpSession::Wrapper>	controlQueue;
-	std::deque<BHttpSession::Wrapper>	dataQueue;
-	std::vector<int32>					cancelList;
-	// data owned by the dataThread
-	std::map<int,BHttpSession::Wrapper>	connectionMap;
-	std::vector<object_wait_info>		objectList;
+static const bigtime_t kDefaultConnectTimeout = 30000000;
+	// 30 seconds per connection attempt
+static const int32 kWorkerThreadCount = 2;
+static const int32 kBodyWriterThreadCount = 4;
+static const int32 kMaxBodyWriterThreadCount = 64;
+	// body targets that may block at the same time before the others have to
+	// wait for a writer
+static const size_t kMaxBodyBacklog = 4 * 1024 * 1024;
+	// body data of a request that the target may be behind with, before the
+	// connection stops receiving
+static const int32 kMaxDefaultDataThreadCount = 4;
+static const size_t kQueueCapacity = 1024;
+static const bigtime_t kQueueFullDelay = 1000;
+	// time to give the consumer when a queue is full
+static const size_t kMinRequestIndexPurgeSize = 64;
+static const int32 kDefaultPipelineDepth = 4;
+static const int32 kMaxFailovers = 2;
+	// times a request is moved to a new connection after its connection failed
+static const int32 kDefaultMaxAttempts = 3;
+	// times a request is tried before a transient failure is passed on
+static const bigtime_t kDefaultRetryBackoff = 100000;
+static const bigtime_t kDefaultMaxRetryBackoff = 10000000;
+	// the delay before a retry doubles with every attempt, up to the maximum
+static const int32 kDefaultRetryBudget = 20;
+	// retries as a percentage of the requests that are started
+static const int32 kRetryBudgetReserve = 10;
+	// retries that may be made before the requests have paid for them; this
+	// is also the most that is saved up
+static const size_t kMaxOriginShards = 256;
+static const size_t kMinReadSize = 4096;
+static const size_t kMaxReadSize = 256 * 1024;
+	// the read size of a connection grows while its reads fill the buffer
+static const size_t kReadBudget = 1024 * 1024;
+	// bytes read from one connection before the others get their turn, for
+	// requests of normal priority; it doubles for every level above that
+static const int32 kPriorityLevels = B_HTTP_PRIORITY_HIGHEST + 1;
+static const bigtime_t kPriorityAgingInterval = 200000;
+	// time a queued request waits before it counts as one level higher
+static const int32 kDefaultMaxRequestsPerHost = 6;
+static const int32 kDefaultMaxRequests = 64;
+static const size_t kMaxRequestsLimit = kQueueCapacity;
+	// requests that are started are bounded by the capacity of the queues,
+	// so that the threads never wait for each other's full queues
+// What the timers of a shard belong to
+enum {
+	kConnectionTimer,
+		// connection attempt, or idle HTTP/2 connection
+	kRequestTimer,
+	kPoolTimer
+		// idle connections in the connection pool
+};
+static const char* kConnectionClosedMessage
+	= "Connection was closed before the response was received";
 
-	// Constructor
-	Data(thread_func ControlFunc, thread_func DataFunc) {
-		// set up semaphores for synchronization between data and control thread
-		controlQueueSem = create_sem(0, "http:control");
-		if (controlQueueSem < 0)
-			throw std::runtime_error("Cannot create control queue semaphore");
-		dataQueueSem = create_sem(0, "http:data");
-		if (dataQueueSem < 0)
-			throw std::runtime_error("Cannot create data queue semaphore");
 
-		// set up internal threads
-		controlThread = spawn_thread(ControlFunc, "http:control", B_NORMAL_PRIORITY, this);
-		if (controlThread < 0)
-			throw std::runtime_error("Cannot create control thread");
-		if (resume_thread(controlThread) != B_OK)
-			throw std::runtime_error("Cannot resume control thread");
+/*!	Push \a value onto a bounded \a queue.
 
-		dataThread = spawn_thread(DataFunc, "http:data", B_NORMAL_PRIORITY, this);
-		if (dataThread < 0)
-			throw std::runtime_error("Cannot create data thread");
-		if (resume_thread(dataThread) != B_OK)
-			throw std::runtime_error("Cannot resume data thread");
+	When the queue is full, the consumer is woken up and given some time to
+	catch up. Returns false if the session starts quitting in the meantime, in
+	which case \a value is left untouched.
+*/
+template<typename T, typename WakeupFunction>
+static bool
+PushOrWait(MpscQueue<T>& queue, T&& value, int32* quitting,
+	WakeupFunction wakeup)
+{
+	while (!queue.Push(std::move(value))) {
+		if (atomic_get(quitting) == 1)
+			return false;
+		wakeup();
+		snooze(kQueueFullDelay);
 	}
+	wakeup();
+	return true;
+}
 
-	// Destructor
-	~Data() {
-		atomic_set(&quitting, 1);
-		delete_sem(controlQueueSem);
-		delete_sem(dataQueueSem);
-		status_t threadResult;
-		wait_for_thread(controlThread, &threadResult);
-		wait_for_thread(dataThread, &threadResult);
-	}
+
+/*!	Check whether a request that failed with \a error on its connection may
+	succeed when it is tried again later.
+*/
+static bool
+IsTransientError(status_t error)
+{
+	return error == B_IO_ERROR || error == B_HTTP_CONNECT_TIMEOUT
+		|| error == ECONNREFUSED || error == ECONNRESET || error == ECONNABORTED
+		|| error == ETIMEDOUT;
+}
+
+
+// Check whether the server responded that it cannot handle the request now
+static bool
+IsTransientStatus(int16 code)
+{
+	return code == B_HTTP_STATUS_BAD_GATEWAY
+		|| code == B_HTTP_STATUS_SERVICE_UNAVAILABLE
+		|| code == B_HTTP_STATUS_GATEWAY_TIMEOUT;
+}
+
+
+static int32
+DefaultDataThreadCount()
+{
+	system_info info;
+	if (get_system_info(&info) != B_OK)
+		return 1;
+	return std::clamp((int32)info.cpu_count, (int32)1, kMaxDefaultDataThreadCount);
+}
+
+
+/*!	Progress of one kind that is reported to the observer of a request.
+
+	The latest numbers are kept until they are sent; everything that happened
+	since the previous message is reported in the next one.
+*/
+struct ProgressReport {
+	uint32							what;
+	off_t							bytes = 0;
+	off_t							total = -1;
+	off_t							reportedBytes = 0;
+	bigtime_t						reportedTime = 0;
+	bool							pending = false;
+
+	ProgressReport(uint32 what) : what(what) {}
 };
 
 
@@ -97,6 +189,8 @@ struct BHttpSession::Wrapper {
 	enum {
 		kRequestInitialState,
 		kRequestConnected,
+		kRequestSending,
+		kRequestSent,
 		kRequestStatusReceived,
 		kRequestHeadersReceived,
 		kRequestContentReceived,
@@ -106,461 +200,2259 @@ struct BHttpSession::Wrapper {
 	// Communication
 	BMessenger						observer;
 	std::shared_ptr<HttpResultPrivate> result;
-
-	// Connection
+	int8							priority = B_HTTP_PRIORITY_NORMAL;
+	// Deadlines; the timer is set to the first point in time at which one of
+	// them may pass. The time until the response starts counts from the
+	// moment the request is sent, and is next in line for a response.
+	TimerWheel::Timer				timer{nullptr, kRequestTimer};
+	bigtime_t						startTime = 0;
+	bigtime_t						responseStart = 0;
+	// Progress of the request body that is sent, of the response body that
+	// is received, and of the body that is written to the target; only kept
+	// when there is an observer
+	bool							reportProgress = false;
+	ProgressReport					uploadProgress{UrlEvent::UploadProgress};
+	ProgressReport					downloadProgress{UrlEvent::DownloadProgress};
+	ProgressReport					bytesWritten{UrlEvent::BytesWritten};
+
+	// Connection; a socket from the connection pool is carried by the request
+	// until the shard sets up a connection for it
+	Shard*							shard = nullptr;
+	Connection*						connection = nullptr;
+	std::string						origin;
 	BNetworkAddress					remoteAddress;
 	std::unique_ptr<BSocket>		socket;
+	bool							reusedConnection = false;
+	int32							failovers = 0;
+	// Attempt at the request, and the number of attempts it may take; a
+	// request that the server answered with a transient error is not
+	// reported, but retried
+	int32							attempt = 1;
+	int32							maxAttempts = 1;
+	bool							retryResponse = false;
+	bool							keepAlive = false;
+	// HTTP/2 stream that carries the request, once it is opened
+	int32							stream = 0;
+
+	// Send state; the write cursor consists of the offsets into the request
+	// headers and into the body segment that is being written
+	std::string						outputBuffer;
+	size_t							outputOffset = 0;
+	std::string						bodyBuffer;
+	size_t							bodyOffset = 0;
+	off_t							bodyBytesSent = 0;
+	bool							sendEnd = false;
 
 	// Receive state
 	bool							receiveEnd = false;
 	bool							parseEnd = false;
-	BNetBuffer						inputBuffer;
-	size_t							previousBufferSize = 0;
 	off_t							bytesReceived = 0;
 	off_t							bytesTotal = 0;
 	BHttpHeaders					headers;
 	bool							readByChunks = false;
-	bool							decompress = false;
-	DynamicBuffer					decompressorStorage;
-	std::unique_ptr<BDataIO>		decompressingStream = nullptr;
-	std::vector<char>				inputTempBuffer = std::vector<char>(4096);
+	HttpResponseParser				responseParser;
+	HttpChunkedDecoder				chunkedDecoder;
+	std::unique_ptr<HttpContentDecoder> decoder;
 	BHttpStatus						status;
-	// TODO: reset method to reset Connection and Receive State when redirected
-};
+	bool							http11Response = false;
+	// Redirects that were followed, and the location of the response when it
+	// is a redirect that is followed; its body is skipped
+	int32							redirects = 0;
+	std::optional<BUrl>				redirectUrl;
+	bool							redirectToGet = false;
+
+	// Check whether the request may be sent again without side effects
+	bool							IsIdempotent() const {
+		return request.fRequestMethod == BHttpMethod::Get()
+			|| request.fRequestMethod == BHttpMethod::Head();
+	}
 
+	// Check whether the request may share a connection with other requests
+	// that are sent before their responses are received
+	bool							CanPipeline() const {
+		return IsIdempotent() && request.fHttpVersion == B_HTTP_11
+			&& !request.fOptInputData;
+	}
 
-BHttpSession::BHttpSession()
-	: fData(std::make_shared<Data>(ControlThreadFunc, DataThreadFunc))
-{
-}
+	// Check whether the request is sent as a stream on an HTTP/2 connection
+	bool							UsesHttp2() const {
+		return request.fHttpVersion == B_HTTP_2;
+	}
 
+	// Check whether the request may be moved to another connection when its
+	// connection fails before the response is received
+	bool							CanFailover() const {
+		return IsIdempotent() && !request.fOptInputData
+			&& requestStatus < kRequestStatusReceived
+			&& failovers < kMaxFailovers;
+	}
 
-BHttpResult
-BHttpSession::AddRequest(BHttpRequest request, std::unique_ptr<BDataIO> target,
-	BMessenger observer)
-{
-	BHttpSession::Wrapper wRequest{std::move(request)};
-	wRequest.observer = observer;
-	auto identifier = get_netservices_request_identifier();
+	// Check whether the request, which the server did not process, may be
+	// moved to another connection. This does not depend on the method; a body
+	// that was partly read has to be read again from the start, which takes
+	// a BPositionIO.
+	bool							CanResend() const {
+		return failovers < kMaxFailovers && (bodyBytesSent == 0
+			|| dynamic_cast<BPositionIO*>(request.fOptInputData.get())
+				!= nullptr);
+	}
 
-	// create shared data
-	wRequest.result = std::make_shared<HttpResultPrivate>(identifier);
-	wRequest.result->owned_body = std::move(target);
+	// Check whether the request may be tried again after a transient failure
+	bool							CanRetry() const {
+		return IsIdempotent() && !request.fOptInputData
+			&& attempt < maxAttempts && !result->IsCancelRequested();
+	}
 
-	auto retval = BHttpResult(wRequest.result);
-	AutoLocker<BLocker>(fData->lock);
-	fData->controlQueue.push_back(std::move(wRequest));
-	release_sem(fData->controlQueueSem);
-	return retval;
-}
+	// Check whether the connection can be used for the next request
+	bool							CanReuseConnection() const {
+		return keepAlive && receiveEnd && parseEnd
+			&& (readByChunks ? chunkedDecoder.IsDone() : bytesTotal >= 0);
+	}
 
+	// Create a fresh request with the same identity, to send it again on
+	// another connection. Only requests that were (partly) sent count as a
+	// failover.
+	Wrapper							Restart() {
+		Wrapper restarted{std::move(request)};
+		restarted.observer = observer;
+		restarted.result = result;
+		restarted.priority = priority;
+		restarted.startTime = startTime;
+		restarted.reportProgress = reportProgress;
+		restarted.shard = shard;
+		restarted.origin = origin;
+		restarted.remoteAddress = remoteAddress;
+		restarted.failovers = failovers
+			+ (requestStatus >= kRequestSending ? 1 : 0);
+		restarted.attempt = attempt;
+		restarted.maxAttempts = maxAttempts;
+		restarted.redirects = redirects;
+		return restarted;
+	}
 
-void
-BHttpSession::Cancel(int32 identifier)
-{
-	AutoLocker<BLocker>(fData->lock);
-	fData->cancelList.push_back(identifier);
-	release_sem(fData->dataQueueSem);
-}
+	// Create a fresh request with the same identity for the next attempt
+	Wrapper							Retry() {
+		Wrapper retry = Restart();
+		retry.failovers = 0;
+		retry.attempt++;
+		return retry;
+	}
 
+	// Check whether the response, of which the headers are received, is a
+	// redirect that is followed, and find its location. A request with a body
+	// only follows a redirect that changes it into a GET request, as the body
+	// cannot be sent again.
+	bool							CheckRedirect() {
+		int16 code = status.code;
+		if (!request.fOptFollowLocation || redirects >= request.fOptMaxRedirs
+			|| (code != B_HTTP_STATUS_MOVED_PERMANENTLY
+				&& code != B_HTTP_STATUS_FOUND
+				&& code != B_HTTP_STATUS_SEE_OTHER
+				&& code != B_HTTP_STATUS_TEMPORARY_REDIRECT
+				&& code != B_HTTP_STATUS_PERMANENT_REDIRECT)) {
+			return false;
+		}
 
-void
-BHttpSession::Cancel(const BHttpResult& result)
-{
-	Cancel(result.Identity());
-}
+		const char* value = headers["Location"];
+		if (value == nullptr)
+			return false;
+		BUrl location(request.fUrl, BString(value));
+		if (!location.IsValid()
+			|| (location.Protocol() != "http" && location.Protocol() != "https"))
+			return false;
 
+		// Browsers change a POST into a GET on 301 and 302 as well
+		redirectToGet = !(request.fRequestMethod == BHttpMethod::Head())
+			&& (code == B_HTTP_STATUS_SEE_OTHER
+				|| ((code == B_HTTP_STATUS_MOVED_PERMANENTLY
+						|| code == B_HTTP_STATUS_FOUND)
+					&& request.fRequestMethod == BHttpMethod::Post()));
+		if (request.fOptInputData && !redirectToGet)
+			return false;
+		redirectUrl = location;
+		return true;
+	}
 
-static void
-SetSocketNonBlocking(int socket)
-{
-	if (socket < 0)
-		throw std::runtime_error("Invalid socket");
+	// Create the request that follows the redirect, with the same identity.
+	// Only the state of the connection and of the response starts over.
+	Wrapper							Redirect() {
+		Wrapper redirected = Restart();
+		redirected.failovers = 0;
+		redirected.redirects++;
+		auto& next = redirected.request;
+		next.fUrl = *redirectUrl;
+		next.fSSL = redirectUrl->Protocol() == "https";
+		if (redirectToGet) {
+			next.fRequestMethod = BHttpMethod::Get();
+			next.fOptInputData = nullptr;
+		}
+		if (next.fSSL && next.fHttpVersion == B_HTTP_2)
+			next.fHttpVersion = B_HTTP_11;
+		redirected.origin = HttpConnectionPool::OriginFor(next.fUrl, next.fSSL);
+		if (redirected.origin != origin)
+			redirected.remoteAddress = BNetworkAddress();
+		return redirected;
+	}
 
-	int flags = fcntl(socket, F_GETFL, 0);
-	if (flags == -1)
-		throw std::runtime_error("Error getting socket flags");
-	if (fcntl(socket, F_SETFL, flags | O_NONBLOCK) != 0)
-		throw std::runtime_error("Error setting non-blocking flag on socket");
-}
+	// Update the progress in \a report to \a bytes out of \a total. The
+	// observer is only sent a message once the minimum interval has passed
+	// since the previous one, and the minimum number of bytes was transferred.
+	void							UpdateProgress(ProgressReport& report,
+										off_t bytes, off_t total = -1) {
+		if (!reportProgress)
+			return;
+		report.bytes = bytes;
+		report.total = total;
+		report.pending = true;
+		if (bytes - report.reportedBytes < request.fOptProgressBytes)
+			return;
+		bigtime_t now = system_time();
+		if (now - report.reportedTime < request.fOptProgressInterval)
+			return;
+		SendProgress(report, now);
+	}
 
+	void							SendProgress(ProgressReport& report,
+										bigtime_t now) {
+		BMessage msg(report.what);
+		msg.AddInt32(UrlEventData::Id, result->id);
+		msg.AddInt64(UrlEventData::NumBytes, report.bytes);
+		if (report.total >= 0)
+			msg.AddInt64(UrlEventData::TotalBytes, report.total);
+		observer.SendMessage(&msg);
+		report.reportedBytes = report.bytes;
+		report.reportedTime = now;
+		report.pending = false;
+	}
 
-/*static*/ status_t
-BHttpSession::ControlThreadFunc(void* arg)
-{
-	BHttpSession::Data* data = static_cast<BHttpSession::Data*>(arg);
-	while (true) {
-		if (auto status = acquire_sem(data->controlQueueSem); status == B_INTERRUPTED)
-			continue;
-		else if (status != B_OK) {
-			// Most likely B_BAD_SEM_ID indicating that the sem was deleted
-			break;
+	std::optional<BError>			CheckDeadlines(bigtime_t now,
+										bigtime_t& next) const;
+
+	// Send the progress that was held back
+	void							FlushProgress() {
+		if (!reportProgress)
+			return;
+		bigtime_t now = system_time();
+		for (auto report: {&uploadProgress, &downloadProgress, &bytesWritten}) {
+			if (report->pending)
+				SendProgress(*report, now);
 		}
+	}
 
-		// Process items on the queue
-		while (true) {
-			data->lock.Lock();
-			if (data->controlQueue.empty() || atomic_get(&data->quitting) == 1) {
-				data->lock.Unlock();
-				break;
-			}
-			auto request = std::move(data->controlQueue.front());
-			data->controlQueue.pop_front();
-			data->lock.Unlock();
-			
-			switch (request.requestStatus) {
-				case Wrapper::kRequestInitialState:
-				{
-					std::cout << "Processing new request" << std::endl;
-					bool hasError = false;
-					try {
-						_ResolveHostName(request);
-						_OpenConnection(request);
-					} catch (BError &e) {
-						request.result->SetError(e);
-						hasError = true;
-					}
+	// Notify the observer that the request is completed, after the progress
+	// that was held back
+	void							NotifyCompleted(bool success) {
+		FlushProgress();
+		SendCompleted(observer, result->id, success);
+	}
 
-					if (hasError) {
-						break;
-					}
+	// Make the body available once all of it is received. The observer is
+	// notified once the target has all of the body, as a worker may still
+	// be writing to it; whether the request succeeded depends on that too.
+	void							CompleteBody() {
+		FlushProgress();
+		std::function<void(bool)> completed;
+		if (observer.IsValid()) {
+			completed = [observer = observer, id = result->id](bool success) {
+				SendCompleted(observer, id, success);
+			};
+		}
+		result->SetBody(std::move(completed));
+	}
 
-					// TODO: further serialization (?)
+	static	void					SendCompleted(BMessenger observer, int32 id,
+										bool success) {
+		if (!observer.IsValid())
+			return;
+		BMessage msg(UrlEvent::RequestCompleted);
+		msg.AddInt32(UrlEventData::Id, id);
+		msg.AddBool(UrlEventData::Success, success);
+		observer.SendMessage(&msg);
+	}
+};
 
-					request.requestStatus = Wrapper::kRequestConnected;
-					data->lock.Lock();
-					data->dataQueue.push_back(std::move(request));
-					data->lock.Unlock();
-					release_sem(data->dataQueueSem);
-					break;
-				}
-				default:
-				{
-					// not handled at this stage
-					break;
-				}
-			}
+
+/*!	Connection to a server, owned by a shard.
+
+	The requests on a connection are answered in the order in which they are
+	sent; the response that is being received belongs to the first request.
+	GET and HEAD requests to the same origin are pipelined: they are sent
+	before the responses to the earlier requests have arrived. Only the first
+	request is sent until the server has shown that it keeps the connection
+	open. When the connection is closed, the requests that did not get a
+	response are moved to a new connection.
+
+	HTTP/2 connections carry each request on a stream of its own, so the
+	responses may arrive in any order. They are kept open while idle, until
+	the idle timeout of the connection pool expires.
+*/
+struct BHttpSession::Connection {
+	enum {
+		kConnecting,
+		kHandshaking,
+		kOpen
+	}								state = kConnecting;
+	std::unique_ptr<BSocket>		socket;
+	int								fd = -1;
+	std::string						origin;
+	BString							host;
+	bool							ssl = false;
+	// Expiry of the connection attempt, or of an idle HTTP/2 connection
+	bigtime_t						deadline = 0;
+	TimerWheel::Timer				timer{nullptr, kConnectionTimer};
+
+	// Requests in the order in which they are sent; 'sending' points to the
+	// first request that is not completely written
+	std::list<Wrapper>				requests;
+	std::list<Wrapper>::iterator	sending;
+	// The server has confirmed that the connection is kept open
+	bool							persistent = false;
+	// No more requests are sent; the connection is closed after the response
+	// that is being received
+	bool							closing = false;
+
+	// Highest priority of the requests on the connection; connections with a
+	// higher priority are read first, and for longer
+	int8							priority = B_HTTP_PRIORITY_LOWEST;
+
+	// Receive buffer; it may hold the start of the next response
+	ReceiveBuffer					inputBuffer;
+	size_t							readSize = kMinReadSize;
+	size_t							readBudget = 0;
+	bigtime_t						lastRead = 0;
+	// The body target of a request does not keep up; nothing is read until it
+	// has caught up, so that TCP flow control slows down the server
+	bool							readPaused = false;
+
+	// HTTP/2 framing, and the requests by stream
+	std::unique_ptr<Http2Connection> http2;
+	std::unordered_map<int32, Wrapper*> streams;
+
+	// Check whether the request can be added to the connection. A request is
+	// not queued behind requests of a lower priority, as its response would
+	// have to wait for theirs.
+	bool							CanPipeline(size_t maxDepth,
+										int8 requestPriority) const {
+		if (http2 || closing || requests.size() >= maxDepth)
+			return false;
+		for (const auto& request: requests) {
+			if (!request.CanPipeline() || request.priority < requestPriority)
+				return false;
 		}
+		return true;
 	}
 
-	 // Clean up and make sure we are quitting
-	 if (atomic_get(&data->quitting) == 1) {
-	 	std::cout << "controlThread is ending, so cleaning up all requests" << std::endl;
-	 	// Cancel all requests
-	 	for (auto& request: data->dataQueue) {
-	 		request.result->SetError(BError(B_CANCELED, "Request Canceled because BHttpSession was closed"));
-			if (request.observer.IsValid()) {
-				BMessage msg(UrlEvent::RequestCompleted);
-				msg.AddInt32(UrlEventData::Id, request.result->id);
-				msg.AddBool(UrlEventData::Success, false);
-				request.observer.SendMessage(&msg);
-			}
-	 	}
-	 } else {
-	 	throw std::runtime_error("Unknown reason that the controlQueueSem is deleted");
-	 }
-	return B_OK;
-}
+	void							UpdatePriority() {
+		priority = B_HTTP_PRIORITY_LOWEST;
+		for (const auto& request: requests)
+			priority = std::max(priority, request.priority);
+	}
+
+	// Check whether an HTTP/2 request can be added to the connection
+	bool							CanMultiplex() const {
+		return http2 && !closing && !http2->IsGoingAway()
+			&& requests.size() < http2->MaxConcurrentStreams();
+	}
+
+	// Check whether the next request can be written
+	bool							CanSend() const {
+		if (http2)
+			return state == kOpen && CanSendHttp2();
+		return state == kOpen && !closing && sending != requests.end()
+			&& (sending == requests.begin() || persistent);
+	}
 
+	// Check whether there are frames to write, a stream to open, or request
+	// body data that the flow control allows to be sent
+	bool							CanSendHttp2() const {
+		if (http2->HasOutput())
+			return true;
+		if (sending != requests.end() && http2->CanOpenStream())
+			return true;
+		for (const auto& request: requests) {
+			if (request.requestStatus == Wrapper::kRequestSending
+				&& http2->SendWindow(request.stream) > 0)
+				return true;
+		}
+		return false;
+	}
+};
 
-static const uint16 EVENT_CANCELLED = 0x4000;
 
+/*!	Check the deadlines of the request at \a now.
 
-/*static*/ status_t
-BHttpSession::DataThreadFunc(void* arg)
+	Returns the error for the first deadline that has passed. Otherwise \a next
+	is set to the first point in time at which one of them may pass, or to
+	B_INFINITE_TIMEOUT. The time until the response starts and the time
+	between reads do not count while the connection does not read because the
+	body target has to catch up. The timeouts that have not started yet cannot
+	pass before they have run in full from \a now.
+*/
+std::optional<BPrivate::BError>
+BHttpSession::Wrapper::CheckDeadlines(bigtime_t now, bigtime_t& next) const
 {
-	BHttpSession::Data* data = static_cast<BHttpSession::Data*>(arg);
-	// initial initialization of wait list
-	data->objectList.push_back(object_wait_info{data->dataQueueSem,
-		B_OBJECT_TYPE_SEMAPHORE, B_EVENT_ACQUIRE_SEMAPHORE
-	});
+	next = B_INFINITE_TIMEOUT;
+	auto passed = [now, &next](bigtime_t start, bigtime_t timeout) {
+		if (timeout == B_INFINITE_TIMEOUT)
+			return false;
+		if (now - start >= timeout)
+			return true;
+		next = std::min(next, start + timeout);
+		return false;
+	};
+
+	if (passed(startTime, request.fOptTimeout))
+		return BError(B_HTTP_REQUEST_TIMEOUT, "Request took too long");
+
+	bool paused = connection->readPaused;
+	if (requestStatus < kRequestStatusReceived) {
+		bool waiting = requestStatus >= kRequestSent && responseStart != 0
+			&& !paused
+			&& (connection->http2 || &connection->requests.front() == this);
+		if (passed(waiting ? responseStart : now, request.fOptResponseTimeout))
+			return BError(B_HTTP_RESPONSE_TIMEOUT, "No response from server in time");
+		passed(now, request.fOptReadTimeout);
+	} else if (passed(paused ? now : connection->lastRead,
+			request.fOptReadTimeout)) {
+		return BError(B_HTTP_READ_TIMEOUT, "Server stopped sending data");
+	}
+	return std::nullopt;
+}
 
-	while (true) {
-		if (auto status = wait_for_objects(data->objectList.data(),
-			data->objectList.size()); status < B_OK)
-		{
-			// Something went unexplicably wrong
-			throw std::runtime_error("BHttpSession[dataThread]: error waiting for objects");
+
+// Outcome of a TLS handshake that is done by a worker thread
+struct HandshakeResult {
+	int								fd;
+	std::unique_ptr<BSocket>		socket;
+	status_t						status;
+};
+
+
+/*!	Part of the data engine that is run by a single data thread.
+
+	Each shard has its own event loop and owns the connections that are
+	assigned to it. New requests are assigned to a shard by the control thread,
+	and stay on that shard until they are finished.
+*/
+struct BHttpSession::Shard {
+	// constants (does not need to be locked to be accessed)
+	Data*								session;
+	thread_id							thread = -1;
+	// number of requests assigned to this shard (atomic access)
+	int32								load = 0;
+	// queues (lock-free; any thread may push, only the shard's thread pops)
+	MpscQueue<BHttpSession::Wrapper>	queue{kQueueCapacity};
+	MpscQueue<int32>					cancelList{kQueueCapacity};
+	MpscQueue<HandshakeResult>			handshakes{kQueueCapacity};
+	MpscQueue<int>						resumed{kQueueCapacity};
+		// connections of which the body target caught up, by file descriptor
+	// data owned by the shard's thread
+	EventLoop							loop;
+	std::unordered_map<int,BHttpSession::Connection> connections;
+	std::unordered_multimap<std::string,BHttpSession::Connection*> originIndex;
+	std::unordered_map<int32,BHttpSession::Wrapper*> requestIndex;
+	TimerWheel							timers;
+	TimerWheel::Timer					poolTimer{nullptr, kPoolTimer};
+	// connections that used up their read budget, by file descriptor
+	std::vector<int>					readPending;
+	// requests that wait for a connection, because their origin has as many
+	// connections as the limit per host allows, with whether they may be
+	// pipelined; they are dispatched again when a connection is given up, or
+	// a request leaves one. The count and the flag are shared with the other
+	// threads, which set the flag to have the requests dispatched again
+	// (atomic access).
+	std::list<std::pair<BHttpSession::Wrapper,bool>> waitingRequests;
+	int32								waitingCount = 0;
+	int32								retryWaiting = 0;
+	// content decoders for reuse, and their output
+	HttpContentDecoderPool				decoders;
+	std::vector<char>					decodeWindow;
+
+	Shard(Data* session) : session(session) {}
+	~Shard();
+};
+
+
+struct BHttpSession::Data {
+	// constants (does not need to be locked to be accessed)
+	thread_id							controlThread;
+	sem_id								controlQueueSem;
+	// state (atomic access)
+	int32								quitting = 0;
+	int32								controlWakeupPending = 0;
+	int32								retryBudget = kRetryBudgetReserve * 100;
+		// retries that may be made, in hundredths
+	// settings (atomic access)
+	int64								connectTimeout = kDefaultConnectTimeout;
+	int32								maxPipelineDepth = kDefaultPipelineDepth;
+	int32								maxRequestsPerHost
+											= kDefaultMaxRequestsPerHost;
+	int32								maxRequests = kDefaultMaxRequests;
+	int32								maxAttempts = kDefaultMaxAttempts;
+	int64								retryBackoff = kDefaultRetryBackoff;
+	int64								maxRetryBackoff = kDefaultMaxRetryBackoff;
+	int32								retryBudgetShare = kDefaultRetryBudget;
+	// queues (lock-free; any thread may push, only the control thread pops)
+	MpscQueue<BHttpSession::Wrapper>	controlQueue{kQueueCapacity};
+	MpscQueue<int32>					cancelQueue{kQueueCapacity};
+	MpscQueue<int32>					finishedQueue{kQueueCapacity};
+		// requests that are no longer in progress, by identifier
+	MpscQueue<BHttpSession::Wrapper>	retryQueue{kQueueCapacity};
+		// requests that failed, to be tried again
+	// data owned by the control thread; the requests that wait until they
+	// are tried again, by identifier
+	std::unordered_map<int32,BHttpSession::Wrapper> retrying;
+	TimerWheel							retryTimers;
+	std::minstd_rand					random{(uint32)system_time()};
+	// data owned by the control thread; the requests to an origin that are in
+	// progress, by the way in which they share connections, and the ones that
+	// wait for their turn by priority
+	enum {
+		kOwnConnection,
+		kPipelined,
+		kMultiplexed,
+		kConnectionShares
+	};
+	typedef RequestScheduler<BHttpSession::Wrapper, kPriorityLevels>
+		Scheduler;
+	struct OriginQueue {
+		size_t							active = 0;
+		size_t							shares[kConnectionShares] = {};
+		Scheduler						waiting{kPriorityAgingInterval};
+		std::list<std::string>::iterator turn;
+			// place in waitingOrigins, while there are waiting requests
+
+		// The number of connections that the requests in progress need at
+		// the least, when another request that shares them as \a share is
+		// started
+		size_t ConnectionsWith(int share, size_t pipelineDepth) const {
+			size_t counts[kConnectionShares];
+			std::copy(shares, shares + kConnectionShares, counts);
+			counts[share]++;
+			size_t streams = Http2Connection::kDefaultMaxConcurrentStreams;
+			return counts[kOwnConnection]
+				+ (counts[kPipelined] + pipelineDepth - 1) / pipelineDepth
+				+ (counts[kMultiplexed] + streams - 1) / streams;
+		}
+	};
+	std::unordered_map<std::string,OriginQueue> origins;
+	// data owned by the control thread; the origins of the requests that are
+	// waiting or in progress, with the place in the queue of the ones that
+	// are waiting, by identifier, the origins that have waiting requests in
+	// the order in which they get their turn, and the number of requests in
+	// progress
+	struct RequestOrigin {
+		std::string						origin;
+		Scheduler::Position				position;
+		int								share = kOwnConnection;
+	};
+	std::unordered_map<int32,RequestOrigin> requestOrigins;
+	std::list<std::string>				waitingOrigins;
+	size_t								activeRequests = 0;
+	// data owned by the control thread; all requests that are in progress
+	std::unordered_map<int32,std::weak_ptr<HttpResultPrivate>> requestIndex;
+	size_t								requestIndexPurgeSize
+											= kMinRequestIndexPurgeSize;
+	// data owned by the control thread; the shard that was last chosen for
+	// requests to an origin
+	std::unordered_map<std::string,Shard*> originShards;
+	// connections that the shards have set up, by origin, which are held to
+	// the limit per host (locked by connectionCountLock)
+	BLocker								connectionCountLock;
+	std::unordered_map<std::string,size_t> connectionCounts;
+	// idle persistent connections (internally locked)
+	HttpConnectionPool					connectionPool;
+	// data engine; one shard per data thread
+	std::vector<std::unique_ptr<Shard>>	shards;
+	// asynchronous host name lookups (internally locked); its workers call
+	// back into the queues above, so it is destroyed before them
+	HostResolver						resolver;
+	// blocking work that is kept out of the data thread (TLS handshakes);
+	// declared last so that the pending jobs finish before the rest is
+	// destroyed.
+	WorkerPool							workers{"http:worker",
+											kWorkerThreadCount};
+	// writers of the body data to the targets of the requests; there are
+	// more of them while targets block, so that a slow target does not hold
+	// up the bodies of the other requests
+	WorkerPool							bodyWriters{"http:body writer",
+											kBodyWriterThreadCount,
+											kMaxBodyWriterThreadCount};
+
+	// Constructor
+	Data(thread_func ControlFunc, thread_func DataFunc, int32 dataThreadCount) {
+		// set up semaphore for the control thread; the data threads are woken
+		// up through their event loops
+		controlQueueSem = create_sem(0, "http:control");
+		if (controlQueueSem < 0)
+			throw std::runtime_error("Cannot create control queue semaphore");
+
+		// set up internal threads
+		controlThread = spawn_thread(ControlFunc, "http:control", B_NORMAL_PRIORITY, this);
+		if (controlThread < 0)
+			throw std::runtime_error("Cannot create control thread");
+		if (resume_thread(controlThread) != B_OK)
+			throw std::runtime_error("Cannot resume control thread");
+
+		dataThreadCount = std::max(dataThreadCount, (int32)1);
+		for (int32 i = 0; i < dataThreadCount; i++) {
+			auto& shard = shards.emplace_back(std::make_unique<Shard>(this));
+			shard->thread = spawn_thread(DataFunc, "http:data", B_NORMAL_PRIORITY,
+				shard.get());
+			if (shard->thread < 0)
+				throw std::runtime_error("Cannot create data thread");
+			if (resume_thread(shard->thread) != B_OK)
+				throw std::runtime_error("Cannot resume data thread");
+		}
+	}
+
+	// Destructor
+	~Data() {
+		atomic_set(&quitting, 1);
+		delete_sem(controlQueueSem);
+		for (auto& shard: shards)
+			shard->loop.Wakeup();
+		status_t threadResult;
+		wait_for_thread(controlThread, &threadResult);
+		for (auto& shard: shards)
+			wait_for_thread(shard->thread, &threadResult);
+
+		// Requests that were handed back for a retry after the control thread
+		// ended
+		while (auto request = retryQueue.Pop()) {
+			request->result->SetError(BError(B_CANCELED, "Request Canceled because BHttpSession was closed"));
+			request->NotifyCompleted(false);
 		}
+	}
+
+	// Wake up the control thread. Wakeups are coalesced until the control
+	// thread starts processing the queue.
+	void WakeupControlThread() {
+		if (atomic_test_and_set(&controlWakeupPending, 1, 0) == 0)
+			release_sem(controlQueueSem);
+	}
+
+	// Queue a new request until its turn comes
+	void QueueRequest(Wrapper&& request, bigtime_t now) {
+		auto& origin = origins[request.origin];
+		if (origin.waiting.IsEmpty())
+			origin.turn = waitingOrigins.insert(waitingOrigins.end(), request.origin);
+		int32 id = request.result->id;
+		std::string name = request.origin;
+		int8 priority = request.priority;
+		auto position = origin.waiting.Push(std::move(request), priority, now);
+		requestOrigins.insert_or_assign(id,
+			RequestOrigin{std::move(name), position});
+	}
 
-		std::cout << "dataThread: objects ready" << std::endl;
+	// The way in which \a request shares the connections to its origin
+	static int ConnectionShare(const Wrapper& request, size_t pipelineDepth) {
+		if (request.UsesHttp2())
+			return kMultiplexed;
+		if (pipelineDepth > 1 && request.CanPipeline())
+			return kPipelined;
+		return kOwnConnection;
+	}
 
-		// First check if the change is in acquiring the sem, meaning that
-		// there are new requests to be scheduled
-		if (data->objectList[0].events == B_EVENT_ACQUIRE_SEMAPHORE) {
-			if (auto status = acquire_sem(data->dataQueueSem); status == B_INTERRUPTED)
+	// Take the next request that may be started. The limit per host counts
+	// connections: requests that are multiplexed or pipelined share them with
+	// the others. The origins that have room for their next request take
+	// turns; of those, the one with the most urgent request goes first. The
+	// origin that got the turn goes to the back of the line.
+	std::optional<Wrapper> NextRequest(bigtime_t now) {
+		if (activeRequests >= (size_t)atomic_get(&maxRequests))
+			return std::nullopt;
+
+		size_t perHost = atomic_get(&maxRequestsPerHost);
+		size_t pipelineDepth = std::max(atomic_get(&maxPipelineDepth), (int32)1);
+		auto next = waitingOrigins.end();
+		bigtime_t nextPriority = 0;
+		for (auto it = waitingOrigins.begin(); it != waitingOrigins.end(); it++) {
+			auto& origin = origins[*it];
+			int share = ConnectionShare(*origin.waiting.Next(now), pipelineDepth);
+			if (origin.ConnectionsWith(share, pipelineDepth) > perHost)
 				continue;
-			else if (status != B_OK) {
-				// Most likely B_BAD_SEM_ID indicating that the sem was deleted
-				break;
+			bigtime_t priority = *origin.waiting.NextPriority(now);
+			if (next == waitingOrigins.end() || priority > nextPriority) {
+				next = it;
+				nextPriority = priority;
 			}
+		}
+		if (next == waitingOrigins.end())
+			return std::nullopt;
+
+		auto& origin = origins[*next];
+		auto request = origin.waiting.Pop(now);
+		int share = ConnectionShare(*request, pipelineDepth);
+		requestOrigins.find(request->result->id)->second.share = share;
+		origin.active++;
+		origin.shares[share]++;
+		activeRequests++;
+		if (origin.waiting.IsEmpty())
+			waitingOrigins.erase(next);
+		else
+			waitingOrigins.splice(waitingOrigins.end(), waitingOrigins, next);
+		return request;
+	}
 
-			// Process the cancelList and dataQueue. Note that there might
-			// be a situation where a request is cancelled and added in the
-			// same iteration, but that is taken care by this algorithm.
-			data->lock.Lock();
-			while (!data->dataQueue.empty()) {
-				auto request = std::move(data->dataQueue.front());
-				data->dataQueue.pop_front();
-				auto socket = request.socket->Socket();
-				
-				data->connectionMap.insert(std::make_pair(socket, std::move(request)));
-
-				// Add to objectList
-				data->objectList.push_back(object_wait_info{socket,
-					B_OBJECT_TYPE_FD, B_EVENT_WRITE
-				});
-			}
-		
-			for (auto id: data->cancelList) {
-				// To cancel, we set a special event status on the
-				// object_wait_info list so that we can handle it below.
-				// Also: the first item in the waitlist is always the semaphore
-				// so the fun starts at offset 1.
-				size_t offset = 0;
-				for (auto it = data->connectionMap.cbegin(); it != data->connectionMap.cend(); it++) {
-					offset++;
-					if (it->second.result->id == id) {
-						data->objectList[offset].events = EVENT_CANCELLED;
-						break;
-					}
-				}
-			}
-			data->cancelList.clear();
-			data->lock.Unlock();
-		} else if ((data->objectList[0].events & B_EVENT_INVALID) == B_EVENT_INVALID) {
-			// The semaphore has been deleted. Start the cleanup
-			break;
+	// Take a request that is waiting for its turn, or for its next attempt,
+	// out of the queue
+	std::optional<Wrapper> RemoveWaitingRequest(int32 id) {
+		auto it = requestOrigins.find(id);
+		if (it == requestOrigins.end())
+			return std::nullopt;
+		if (auto retry = retrying.find(id); retry != retrying.end()) {
+			std::optional<Wrapper> request(std::move(retry->second));
+			retrying.erase(retry);
+			requestOrigins.erase(it);
+			return request;
 		}
+		auto originIt = origins.find(it->second.origin);
+		auto request = originIt->second.waiting.Remove(it->second.position);
+		if (!request)
+			return std::nullopt;
+		if (originIt->second.waiting.IsEmpty())
+			waitingOrigins.erase(originIt->second.turn);
+		PurgeOrigin(originIt);
+		requestOrigins.erase(it);
+		return request;
+	}
 
-		// Process all objects that are ready
-		bool resizeObjectList = false;
-		for(auto& item: data->objectList) {
-			if (item.type != B_OBJECT_TYPE_FD)
-				continue;
-			if ((item.events & B_EVENT_WRITE) == B_EVENT_WRITE) {
-				// TODO: this is currently not fully in line with non-blocking IO
-				std::cout << "> Processing write for " << item.object << std::endl;
-				auto& request = data->connectionMap.find(item.object)->second;
-				switch (request.requestStatus) {
-					case Wrapper::kRequestConnected: 
-					{
-						// Start writing data
-						std::string requestHeaders = _CreateRequestHeaders(request);
-						request.socket->Write(requestHeaders.data(), requestHeaders.size());
-						//		Idea: add a status kRequestFirstHeaderWritten, and do a non-blocking Write call
-						//		to write the rest.
-						// TODO: write Post Data (if applicable)
-						break;
-					}
-					default:
-						throw std::runtime_error("Write status for object that is in the wrong state");
-				}
-			} else if ((item.events & B_EVENT_READ) == B_EVENT_READ) {
-				std::cout << "Processing read for " << item.object << std::endl;	
-				auto& request = data->connectionMap.find(item.object)->second;
-				auto finished = false;
-				auto success = false;
-				try {
-					finished = _RequestRead(request);
-					if (finished)
-						request.result->SetBody();
-					success = true;
-				} catch (BError &e) {
-					request.result->SetError(e);
-					finished = true;
-				}
+	// Free the place of a request that is no longer in progress
+	void FinishRequest(int32 id) {
+		auto it = requestOrigins.find(id);
+		if (it == requestOrigins.end())
+			return;
+		FreePlace(it->second);
+		requestOrigins.erase(it);
+	}
 
-				if (request.result->CanCancel()) {
-					std::cout << "Canceling request because no one is listening" << std::endl;
-					// This could be done earlier, but this seems cleaner for the flow
-					request.socket->Disconnect();
-					data->connectionMap.erase(item.object);
-					resizeObjectList = true;
-				} else if (finished) {
-					request.socket->Disconnect();
-					if (request.observer.IsValid()) {
-						BMessage msg(UrlEvent::RequestCompleted);
-						msg.AddInt32(UrlEventData::Id, request.result->id);
-						msg.AddBool(UrlEventData::Success, success);
-						request.observer.SendMessage(&msg);
-					}
-					data->connectionMap.erase(item.object);
-					resizeObjectList = true;
-				}
-			} else if ((item.events & B_EVENT_DISCONNECTED) == B_EVENT_DISCONNECTED) {
-				std::cout << "Unexpected disconnect for " << item.object << std::endl;
-				auto& request = data->connectionMap.find(item.object)->second;
-				request.result->SetError(BError(B_IO_ERROR, "Connection was closed unexpectedly"));
-				if (request.observer.IsValid()) {
-					BMessage msg(UrlEvent::RequestCompleted);
-					msg.AddInt32(UrlEventData::Id, request.result->id);
-					msg.AddBool(UrlEventData::Success, false);
-					request.observer.SendMessage(&msg);
-				}
-				data->connectionMap.erase(item.object);
-				resizeObjectList = true;
-			} else if ((item.events & EVENT_CANCELLED) == EVENT_CANCELLED) {
-				std::cout << "Cancel request for " << item.object << std::endl;
-				auto& request = data->connectionMap.find(item.object)->second;
-				request.socket->Disconnect();
-				request.result->SetError(BError(B_CANCELED, "Request cancelled by user"));
-				if (request.observer.IsValid()) {
-					BMessage msg(UrlEvent::RequestCompleted);
-					msg.AddInt32(UrlEventData::Id, request.result->id);
-					msg.AddBool(UrlEventData::Success, false);
-					request.observer.SendMessage(&msg);
-				}
-				data->connectionMap.erase(item.object);
-				resizeObjectList = true;
-			} else {
-				// Likely to be B_EVENT_INVALID. This should not happen
-				throw std::runtime_error("Socket was deleted at an unexpected time");
-			}
+	// Free the place that a request took at its origin when it was started.
+	// This is the origin that the request had then; a redirect may have sent
+	// it to another one since.
+	void FreePlace(const RequestOrigin& place) {
+		auto originIt = origins.find(place.origin);
+		originIt->second.active--;
+		originIt->second.shares[place.share]--;
+		activeRequests--;
+		PurgeOrigin(originIt);
+	}
+
+	// Let the control thread know that a request that was started by the
+	// control thread is no longer in progress. May be called from any thread.
+	void RequestDone(Shard* shard, int32 id) {
+		atomic_add(&shard->load, -1);
+		PushOrWait(finishedQueue, int32(id), &quitting,
+			[this]() { WakeupControlThread(); });
+	}
+
+	// Hand a request that failed back to the control thread, to be tried
+	// again. The request is no longer in progress. May be called from any
+	// thread.
+	void RetryRequest(Shard* shard, Wrapper&& request) {
+		atomic_add(&shard->load, -1);
+		if (atomic_get(&quitting) == 1
+			|| !PushOrWait(retryQueue, std::move(request), &quitting,
+				[this]() { WakeupControlThread(); })) {
+			request.result->SetError(BError(B_CANCELED, "Request Canceled because BHttpSession was closed"));
+			request.NotifyCompleted(false);
 		}
+	}
 
-		// Reset objectList
-		data->objectList[0].events = B_EVENT_ACQUIRE_SEMAPHORE;
-		if (resizeObjectList) {
-			data->objectList.resize(data->connectionMap.size() + 1);
+	// Free the place of a request that is to be tried again, and hold it back
+	// until its delay has passed. The delay doubles with every attempt; a
+	// random part of up to half of it is left out, so that the requests that
+	// failed at the same time are not tried again at the same time.
+	void DelayRetry(Wrapper&& request, bigtime_t now) {
+		auto it = requestOrigins.find(request.result->id);
+		FreePlace(it->second);
+		if (request.result->IsCancelRequested()) {
+			requestOrigins.erase(it);
+			request.result->SetError(BError(B_CANCELED, "Request cancelled by user"));
+			request.NotifyCompleted(false);
+			return;
 		}
-		auto i = 1;
-		for (auto it = data->connectionMap.cbegin(); it != data->connectionMap.cend(); it++) {
-			data->objectList[i].object = it->first;
-			if (it->second.requestStatus == Wrapper::kRequestInitialState)
-				throw std::runtime_error("Invalid state of request");
-			else if (it->second.requestStatus == Wrapper::kRequestInitialState)
-				data->objectList[i].events = B_EVENT_WRITE | B_EVENT_DISCONNECTED;
-			else
-				data->objectList[i].events = B_EVENT_READ | B_EVENT_DISCONNECTED;
-			i++;
+
+		bigtime_t delay = atomic_get64(&retryBackoff);
+		bigtime_t maxDelay = atomic_get64(&maxRetryBackoff);
+		for (int32 i = 2; i < request.attempt && delay < maxDelay; i++)
+			delay *= 2;
+		delay = std::min(delay, maxDelay);
+		delay -= std::uniform_int_distribution<bigtime_t>(0, delay / 2)(random);
+
+		int32 id = request.result->id;
+		auto& entry = retrying.try_emplace(id, std::move(request)).first->second;
+		entry.timer.cookie = &entry;
+		retryTimers.Schedule(entry.timer, now + delay);
+	}
+
+	// Queue the requests of which the delay has passed for their next attempt
+	void QueueRetries(bigtime_t now) {
+		retryTimers.Advance(now);
+		while (auto timer = retryTimers.NextExpired()) {
+			auto& request = *static_cast<Wrapper*>(timer->cookie);
+			int32 id = request.result->id;
+			QueueRequest(std::move(request), now);
+			retrying.erase(id);
 		}
 	}
-	// Clean up and make sure we are quitting
-	if (atomic_get(&data->quitting) == 1) {
-		std::cout << "dataThread is ending, so cleaning up all requests" << std::endl;
-		// Cancel all requests
-		for (auto it = data->connectionMap.begin(); it != data->connectionMap.end(); it++) {
-			it->second.result->SetError(BError(B_CANCELED, "Request Canceled because BHttpSession was closed"));
-			if (it->second.observer.IsValid()) {
-				BMessage msg(UrlEvent::RequestCompleted);
-				msg.AddInt32(UrlEventData::Id, it->second.result->id);
-				msg.AddBool(UrlEventData::Success, false);
-				it->second.observer.SendMessage(&msg);
-			}
-	 	}
-	} else {
-		throw std::runtime_error("Unknown reason that the dataQueueSem is deleted");
+
+	// Pay for a share of a retry when a request is started
+	void AddToRetryBudget() {
+		int32 budget = atomic_get(&retryBudget);
+		while (true) {
+			int32 next = std::min(budget + atomic_get(&retryBudgetShare),
+				kRetryBudgetReserve * 100);
+			int32 previous = atomic_test_and_set(&retryBudget, next, budget);
+			if (previous == budget)
+				return;
+			budget = previous;
+		}
+	}
+
+	// Take a retry out of the budget; returns false when there is none left.
+	// May be called from any thread.
+	bool TakeFromRetryBudget() {
+		int32 budget = atomic_get(&retryBudget);
+		while (budget >= 100) {
+			int32 previous = atomic_test_and_set(&retryBudget, budget - 100,
+				budget);
+			if (previous == budget)
+				return true;
+			budget = previous;
+		}
+		return false;
+	}
+
+	// Take a connection to \a origin, unless it has as many as the limit per
+	// host allows. In that case, a request waits on \a shard; it is counted
+	// before the lock is released, so that it is not missed by a connection
+	// that is given up at the same time. May be called from any thread.
+	bool TakeConnection(const std::string& origin, Shard* shard) {
+		AutoLocker<BLocker> locker(connectionCountLock);
+		auto it = connectionCounts.try_emplace(origin, 0).first;
+		if (it->second >= (size_t)atomic_get(&maxRequestsPerHost)) {
+			if (it->second == 0)
+				connectionCounts.erase(it);
+			atomic_add(&shard->waitingCount, 1);
+			return false;
+		}
+		it->second++;
+		return true;
+	}
+
+	// Give up a connection to \a origin, and have the requests that wait for
+	// a connection dispatched again. May be called from any thread.
+	void ReleaseConnection(const std::string& origin) {
+		{
+			AutoLocker<BLocker> locker(connectionCountLock);
+			auto it = connectionCounts.find(origin);
+			if (--it->second == 0)
+				connectionCounts.erase(it);
+		}
+		for (auto& shard: shards) {
+			if (atomic_get(&shard->waitingCount) > 0) {
+				atomic_set(&shard->retryWaiting, 1);
+				shard->loop.Wakeup();
+			}
+		}
+	}
+
+	// Drop the state of an origin that has no more requests
+	void PurgeOrigin(std::unordered_map<std::string,OriginQueue>::iterator it) {
+		if (it->second.active == 0 && it->second.waiting.IsEmpty())
+			origins.erase(it);
+	}
+
+	// Assign the request to a shard. Requests that can be pipelined or
+	// multiplexed go to the shard that the earlier requests to the same origin
+	// went to, so that they can share its connections, unless that shard is
+	// much busier than the others. Everything else goes to the shard with the
+	// lowest load.
+	void AssignShard(Wrapper& request) {
+		Shard* target = shards.front().get();
+		for (auto& shard: shards) {
+			if (atomic_get(&shard->load) < atomic_get(&target->load))
+				target = shard.get();
+		}
+
+		if (request.CanPipeline() || request.UsesHttp2()) {
+			int32 slack = request.UsesHttp2()
+				? (int32)Http2Connection::kDefaultMaxConcurrentStreams
+				: atomic_get(&maxPipelineDepth);
+			auto it = originShards.find(request.origin);
+			if (it != originShards.end() && atomic_get(&it->second->load)
+					<= atomic_get(&target->load) + slack) {
+				target = it->second;
+			} else {
+				if (originShards.size() >= kMaxOriginShards)
+					originShards.clear();
+				originShards.insert_or_assign(request.origin, target);
+			}
+		}
+
+		atomic_add(&target->load, 1);
+		request.shard = target;
+	}
+
+	// Add a request to the index that is used to find it when it is
+	// cancelled. Requests that are finished, or that no one is waiting for
+	// anymore, are purged once the index has doubled in size.
+	void IndexRequest(const std::shared_ptr<HttpResultPrivate>& result) {
+		requestIndex.insert_or_assign(result->id, result);
+		if (requestIndex.size() < requestIndexPurgeSize)
+			return;
+
+		for (auto it = requestIndex.begin(); it != requestIndex.end();) {
+			auto indexed = it->second.lock();
+			if (!indexed || indexed->GetStatusAtomic() == HttpResultPrivate::kBodyReady
+				|| indexed->GetStatusAtomic() == HttpResultPrivate::kError)
+				it = requestIndex.erase(it);
+			else
+				it++;
+		}
+		requestIndexPurgeSize = std::max(requestIndex.size() * 2,
+			kMinRequestIndexPurgeSize);
+	}
+};
+
+
+BHttpSession::Shard::~Shard()
+{
+	// Requests that were handed over after the shard's thread ended
+	while (auto request = queue.Pop()) {
+		request->result->SetError(BError(B_CANCELED, "Request Canceled because BHttpSession was closed"));
+		request->NotifyCompleted(false);
+	}
+}
+
+
+BHttpSession::BHttpSession()
+	: fData(std::make_shared<Data>(ControlThreadFunc, DataThreadFunc,
+		DefaultDataThreadCount()))
+{
+}
+
+
+BHttpSession::BHttpSession(int32 dataThreadCount)
+	: fData(std::make_shared<Data>(ControlThreadFunc, DataThreadFunc,
+		dataThreadCount))
+{
+}
+
+
+BHttpResult
+BHttpSession::AddRequest(BHttpRequest request, std::unique_ptr<BDataIO> target,
+	BMessenger observer, int8 priority)
+{
+	return _AddRequest(fData.get(), std::move(request), std::move(target),
+		nullptr, observer, priority);
+}
+
+
+BHttpResult
+BHttpSession::AddRequest(BHttpRequest request,
+	std::shared_ptr<BHttpRingBuffer> target, BMessenger observer, int8 priority)
+{
+	return _AddRequest(fData.get(), std::move(request), nullptr,
+		std::move(target), observer, priority);
+}
+
+
+/*static*/ BHttpResult
+BHttpSession::_AddRequest(Data* data, BHttpRequest&& request,
+	std::unique_ptr<BDataIO> target, std::shared_ptr<BHttpRingBuffer> sharedTarget,
+	BMessenger observer, int8 priority)
+{
+	if (priority < B_HTTP_PRIORITY_LOWEST || priority > B_HTTP_PRIORITY_HIGHEST)
+		throw BError(B_BAD_VALUE, "Invalid request priority");
+
+	BHttpSession::Wrapper wRequest{std::move(request)};
+	wRequest.observer = observer;
+	wRequest.priority = priority;
+	wRequest.reportProgress = observer.IsValid();
+	wRequest.origin = HttpConnectionPool::OriginFor(wRequest.request.fUrl,
+		wRequest.request.fSSL);
+	// BSecureSocket cannot negotiate the protocol (ALPN), so HTTP/2 is only
+	// used over cleartext connections
+	if (wRequest.request.fSSL && wRequest.request.fHttpVersion == B_HTTP_2)
+		wRequest.request.fHttpVersion = B_HTTP_11;
+	auto identifier = get_netservices_request_identifier();
+
+	// create shared data
+	wRequest.result = std::make_shared<HttpResultPrivate>(identifier);
+	wRequest.result->owned_body = std::move(target);
+	if (sharedTarget != nullptr)
+		wRequest.result->SetSharedBody(std::move(sharedTarget));
+
+	auto retval = BHttpResult(wRequest.result);
+	if (!PushOrWait(data->controlQueue, std::move(wRequest), &data->quitting,
+			[data]() { data->WakeupControlThread(); })) {
+		wRequest.result->SetError(BError(B_CANCELED, "Request Canceled because BHttpSession was closed"));
+		wRequest.NotifyCompleted(false);
+	}
+	return retval;
+}
+
+
+void
+BHttpSession::Cancel(int32 identifier)
+{
+	// The control thread looks up the request and passes the cancellation
+	// on to wherever the request is.
+	auto data = fData.get();
+	PushOrWait(data->cancelQueue, int32(identifier), &data->quitting,
+		[data]() { data->WakeupControlThread(); });
+}
+
+
+void
+BHttpSession::Cancel(const BHttpResult& result)
+{
+	Cancel(result.Identity());
+}
+
+
+void
+BHttpSession::SetMaxIdleConnectionsPerHost(size_t count)
+{
+	fData->connectionPool.SetMaxIdlePerHost(count);
+}
+
+
+void
+BHttpSession::SetMaxIdleConnections(size_t count)
+{
+	fData->connectionPool.SetMaxIdle(count);
+}
+
+
+void
+BHttpSession::SetIdleConnectionTimeout(bigtime_t timeout)
+{
+	fData->connectionPool.SetIdleTimeout(timeout);
+}
+
+
+void
+BHttpSession::SetConnectTimeout(bigtime_t timeout)
+{
+	atomic_set64(&fData->connectTimeout, timeout);
+}
+
+
+void
+BHttpSession::SetMaxPipelineDepth(size_t depth)
+{
+	atomic_set(&fData->maxPipelineDepth, (int32)std::clamp(depth, (size_t)1,
+		(size_t)INT32_MAX));
+}
+
+
+/*!	Limit the connections to one host that the requests in progress take.
+	Requests that are multiplexed on an HTTP/2 connection, or that are
+	pipelined, share a connection up to its limit of streams, or the pipeline
+	depth; the other requests take a connection each. The connections that
+	are open to the host are held to the limit as well: a request that would
+	need one more, because it could not share a connection after all, waits
+	until one of them is given up.
+*/
+void
+BHttpSession::SetMaxRequestsPerHost(size_t count)
+{
+	atomic_set(&fData->maxRequestsPerHost,
+		(int32)std::clamp(count, (size_t)1, kMaxRequestsLimit));
+	// There may be room for the requests that are waiting now
+	fData->WakeupControlThread();
+}
+
+
+void
+BHttpSession::SetMaxRequests(size_t count)
+{
+	atomic_set(&fData->maxRequests,
+		(int32)std::clamp(count, (size_t)1, kMaxRequestsLimit));
+	// There may be room for the requests that are waiting now
+	fData->WakeupControlThread();
+}
+
+
+/*!	Set how many times a GET or HEAD request is tried before a transient
+	failure is passed on, including the first time (3 by default). A request
+	may set its own number with BHttpRequest::SetMaxAttempts(). A value of 1
+	turns retries off.
+*/
+void
+BHttpSession::SetMaxAttempts(int32 attempts)
+{
+	atomic_set(&fData->maxAttempts, std::max(attempts, (int32)1));
+}
+
+
+/*!	Set the delay before the first retry of a request, which doubles for every
+	next retry up to \a maximum. Up to half of the delay is left out at random.
+*/
+void
+BHttpSession::SetRetryBackoff(bigtime_t initial, bigtime_t maximum)
+{
+	initial = std::max(initial, (bigtime_t)0);
+	atomic_set64(&fData->retryBackoff, initial);
+	atomic_set64(&fData->maxRetryBackoff, std::max(maximum, initial));
+}
+
+
+/*!	Limit the retries to \a percent of the requests that are started, so that
+	a server that fails does not get a storm of retries on top of the normal
+	load. A few retries can be made before the requests have paid for them.
+*/
+void
+BHttpSession::SetRetryBudget(int32 percent)
+{
+	atomic_set(&fData->retryBudgetShare, std::clamp(percent, (int32)0,
+		(int32)100));
+}
+
+
+/*static*/ status_t
+BHttpSession::ControlThreadFunc(void* arg)
+{
+	BHttpSession::Data* data = static_cast<BHttpSession::Data*>(arg);
+	std::vector<int32> cancelList;
+	while (true) {
+		// Wake up in time for the next retry
+		bigtime_t timeout = data->retryTimers.NextTimeout(system_time());
+		status_t status = timeout == B_INFINITE_TIMEOUT
+			? acquire_sem(data->controlQueueSem)
+			: acquire_sem_etc(data->controlQueueSem, 1, B_RELATIVE_TIMEOUT,
+				timeout);
+		if (status == B_INTERRUPTED)
+			continue;
+		else if (status != B_OK && status != B_TIMED_OUT
+			&& status != B_WOULD_BLOCK) {
+			// Most likely B_BAD_SEM_ID indicating that the sem was deleted
+			break;
+		}
+
+		// Process items on the queue. Submissions that come in from now on
+		// wake up the thread again.
+		atomic_set(&data->controlWakeupPending, 0);
+
+		// Take the cancellations before the new requests. A request is always
+		// submitted before it is cancelled, so all the requests that are
+		// referred to will be in the index when the cancellations are
+		// processed.
+		while (auto id = data->cancelQueue.Pop())
+			cancelList.push_back(*id);
+
+		// Free the places of the requests that are done or that are to be
+		// tried again, and queue the new requests, and the retries of which
+		// the delay has passed, by origin
+		while (auto id = data->finishedQueue.Pop())
+			data->FinishRequest(*id);
+
+		bigtime_t now = system_time();
+		while (auto retry = data->retryQueue.Pop())
+			data->DelayRetry(std::move(*retry), now);
+		data->QueueRetries(now);
+
+		while (auto next = data->controlQueue.Pop()) {
+			data->IndexRequest(next->result);
+			data->QueueRequest(std::move(*next), now);
+		}
+
+		// Cancel the requests that are still waiting for their turn. The
+		// others are flagged, so that they are dropped at the next stage when
+		// they are being resolved or set up, and the shards cancel the ones
+		// that they own.
+		for (auto id: cancelList) {
+			auto it = data->requestIndex.find(id);
+			if (it == data->requestIndex.end())
+				continue;
+			auto result = it->second.lock();
+			data->requestIndex.erase(it);
+			if (!result)
+				continue;
+
+			if (auto request = data->RemoveWaitingRequest(id)) {
+				request->result->SetError(BError(B_CANCELED, "Request cancelled by user"));
+				request->NotifyCompleted(false);
+				continue;
+			}
+
+			result->RequestCancel();
+			for (auto& shard: data->shards) {
+				auto loop = &shard->loop;
+				PushOrWait(shard->cancelList, int32(id), &data->quitting,
+					[loop]() { loop->Wakeup(); });
+			}
+		}
+		cancelList.clear();
+
+		// Start the requests for which there is room, by priority, and taking
+		// turns between the origins
+		while (atomic_get(&data->quitting) == 0) {
+			auto next = data->NextRequest(now);
+			if (!next)
+				break;
+			auto request = std::move(*next);
+
+			switch (request.requestStatus) {
+				case Wrapper::kRequestInitialState:
+				{
+					std::cout << "Processing new request" << std::endl;
+					if (request.attempt == 1) {
+						// The total timeout counts from here, and covers the
+						// retries; the time spent waiting for a free slot
+						// does not count
+						request.startTime = now;
+						request.maxAttempts = request.request.fOptMaxAttempts > 0
+							? request.request.fOptMaxAttempts
+							: atomic_get(&data->maxAttempts);
+						data->AddToRetryBudget();
+					} else
+						request.result->SetAttempts(request.attempt);
+
+					// Prefer an idle connection to the same origin. When
+					// there is none, the host name is resolved and the data
+					// thread will set up a new connection, or pipeline the
+					// request on one of its connections to the same origin.
+					// HTTP/2 connections are never pooled; they stay with
+					// their shard.
+					data->AssignShard(request);
+					if (!request.UsesHttp2())
+						request.socket = data->connectionPool.Acquire(request.origin);
+					if (!request.socket) {
+						_ResolveHostName(data, std::move(request));
+						break;
+					}
+
+					// TODO: further serialization (?)
+
+					request.reusedConnection = true;
+					_QueueForDataThread(data, std::move(request));
+					break;
+				}
+				default:
+				{
+					// not handled at this stage
+					data->FinishRequest(request.result->id);
+					break;
+				}
+			}
+		}
+	}
+
+	 // Clean up and make sure we are quitting
+	 if (atomic_get(&data->quitting) == 1) {
+	 	std::cout << "controlThread is ending, so cleaning up all requests" << std::endl;
+	 	// Cancel all requests
+		while (auto request = data->controlQueue.Pop()) {
+			request->result->SetError(BError(B_CANCELED, "Request Canceled because BHttpSession was closed"));
+			request->NotifyCompleted(false);
+		}
+		for (auto& [origin, queue]: data->origins) {
+			while (auto request = queue.waiting.Pop(system_time())) {
+				request->result->SetError(BError(B_CANCELED, "Request Canceled because BHttpSession was closed"));
+				request->NotifyCompleted(false);
+			}
+		}
+		while (auto request = data->retryQueue.Pop()) {
+			request->result->SetError(BError(B_CANCELED, "Request Canceled because BHttpSession was closed"));
+			request->NotifyCompleted(false);
+		}
+		for (auto& [id, request]: data->retrying) {
+			request.result->SetError(BError(B_CANCELED, "Request Canceled because BHttpSession was closed"));
+			request.NotifyCompleted(false);
+		}
+		data->retrying.clear();
+	 } else {
+	 	throw std::runtime_error("Unknown reason that the controlQueueSem is deleted");
+	 }
+	return B_OK;
+}
+
+
+/*static*/ status_t
+BHttpSession::DataThreadFunc(void* arg)
+{
+	BHttpSession::Shard* shard = static_cast<BHttpSession::Shard*>(arg);
+	BHttpSession::Data* data = shard->session;
+	std::vector<EventLoop::Event> events;
+
+	while (atomic_get(&data->quitting) == 0) {
+		// Wake up in time for the first timer to expire
+		bigtime_t timeout = B_INFINITE_TIMEOUT;
+		if (!shard->readPending.empty() || atomic_get(&shard->retryWaiting) == 1)
+			timeout = 0;
+		else
+			timeout = shard->timers.NextTimeout(system_time());
+
+		if (auto status = shard->loop.Wait(events, timeout); status == B_INTERRUPTED)
+			continue;
+		else if (status != B_OK) {
+			// Something went unexplicably wrong
+			throw std::runtime_error("BHttpSession[dataThread]: error waiting for objects");
+		}
+
+		// Process the connections that are ready. Each event carries a pointer
+		// to the connection that owns the socket, so there is no need to look
+		// it up.
+		// The connections of the requests with the highest priority are
+		// served first.
+		std::vector<int> readPending;
+		readPending.swap(shard->readPending);
+		std::stable_sort(events.begin(), events.end(),
+			[](const EventLoop::Event& a, const EventLoop::Event& b) {
+				return static_cast<Connection*>(a.cookie)->priority
+					> static_cast<Connection*>(b.cookie)->priority;
+			});
+		for (auto& event: events)
+			_ProcessEvent(shard, *static_cast<Connection*>(event.cookie), event.events);
+
+		// Continue reading the connections that used up their read budget
+		// in the previous round, now that the others had their turn. They
+		// are looked up, as they may have been closed in the meantime.
+		auto priorityOf = [shard](int fd) {
+			auto it = shard->connections.find(fd);
+			return it != shard->connections.end()
+				? it->second.priority : (int8)B_HTTP_PRIORITY_LOWEST;
+		};
+		std::stable_sort(readPending.begin(), readPending.end(),
+			[&priorityOf](int a, int b) { return priorityOf(a) > priorityOf(b); });
+		for (int fd: readPending) {
+			auto it = shard->connections.find(fd);
+			if (it != shard->connections.end()
+				&& it->second.state == Connection::kOpen)
+				_ProcessEvent(shard, it->second, B_EVENT_READ);
+		}
+
+		// Pick up the connections that finished their TLS handshake
+		while (auto handshake = shard->handshakes.Pop()) {
+			auto it = shard->connections.find(handshake->fd);
+			if (it == shard->connections.end()
+				|| it->second.state != Connection::kHandshaking) {
+				// The connection was given up in the meantime; the socket is
+				// closed when the result is dropped
+				continue;
+			}
+			auto& connection = it->second;
+			connection.socket = std::move(handshake->socket);
+			if (handshake->status != B_OK) {
+				_CloseConnection(shard, connection,
+					BError(handshake->status, "Cannot establish secure connection"),
+					false);
+				continue;
+			}
+			connection.timer.Cancel();
+			connection.state = Connection::kOpen;
+			shard->loop.Add(connection.fd, B_EVENT_DISCONNECTED, &connection);
+			_UpdateInterest(shard, connection);
+		}
+
+		// Continue receiving on the connections of which the body target has
+		// caught up. The data may already be waiting, so they are read in
+		// the next round.
+		while (auto fd = shard->resumed.Pop()) {
+			auto it = shard->connections.find(*fd);
+			if (it == shard->connections.end() || !it->second.readPaused)
+				continue;
+			// The time that was spent waiting for the target does not count
+			// towards the timeouts
+			auto& connection = it->second;
+			connection.readPaused = false;
+			connection.lastRead = system_time();
+			for (auto& request: connection.requests) {
+				if (request.responseStart != 0)
+					request.responseStart = connection.lastRead;
+			}
+			shard->readPending.push_back(*fd);
+			_UpdateInterest(shard, connection);
+		}
+
+		// Pick up new requests and cancellations. A request that is cancelled
+		// before it is picked up is flagged by the control thread, otherwise
+		// it is in the index by the time the cancellation is processed.
+		// The requests that wait for a connection go first. Those that carry
+		// no socket take an idle one from the pool, if there is one now.
+		if (atomic_test_and_set(&shard->retryWaiting, 0, 1) == 1) {
+			std::list<std::pair<Wrapper,bool>> waiting;
+			waiting.swap(shard->waitingRequests);
+			atomic_set(&shard->waitingCount, 0);
+			for (auto& [request, allowPipelining]: waiting) {
+				if (!request.UsesHttp2()) {
+					request.socket = data->connectionPool.Acquire(request.origin);
+					request.reusedConnection = request.socket != nullptr;
+				}
+				_Dispatch(shard, std::move(request), allowPipelining);
+			}
+		}
+
+		while (auto next = shard->queue.Pop())
+			_Dispatch(shard, std::move(*next), true);
+
+		while (auto id = shard->cancelList.Pop()) {
+			auto it = shard->requestIndex.find(*id);
+			if (it != shard->requestIndex.end()) {
+				_CancelRequest(shard, *it->second,
+					BError(B_CANCELED, "Request cancelled by user"));
+				continue;
+			}
+			auto waiting = std::find_if(shard->waitingRequests.begin(),
+				shard->waitingRequests.end(), [id](const auto& entry) {
+					return entry.first.result->id == *id;
+				});
+			if (waiting == shard->waitingRequests.end())
+				continue;
+			auto& request = waiting->first;
+			data->RequestDone(shard, request.result->id);
+			request.result->SetError(BError(B_CANCELED, "Request cancelled by user"));
+			request.NotifyCompleted(false);
+			shard->waitingRequests.erase(waiting);
+			atomic_add(&shard->waitingCount, -1);
+		}
+
+		// Expire the connection attempts that took too long, the HTTP/2
+		// connections that were idle for too long, the requests that ran out
+		// of time, and the idle connections in the pool. A timer that is
+		// cancelled by the handling of an earlier one does not come up.
+		shard->timers.Advance(system_time());
+		while (auto timer = shard->timers.NextExpired()) {
+			switch (timer->type) {
+				case kConnectionTimer:
+					_CloseConnection(shard,
+						*static_cast<Connection*>(timer->cookie),
+						BError(B_HTTP_CONNECT_TIMEOUT,
+							"Connection attempt timed out"), false);
+					break;
+				case kRequestTimer:
+					_CheckDeadlines(shard, *static_cast<Wrapper*>(timer->cookie));
+					break;
+				case kPoolTimer:
+				{
+					bigtime_t next = data->connectionPool.EvictIdle();
+					if (next != B_INFINITE_TIMEOUT)
+						shard->timers.Schedule(*timer, next);
+					break;
+				}
+			}
+		}
+	}
+
+	// Clean up and make sure we are quitting
+	std::cout << "dataThread is ending, so cleaning up all requests" << std::endl;
+	// Cancel all requests
+	for (auto& [fd, connection]: shard->connections) {
+		for (auto& request: connection.requests) {
+			request.result->SetError(BError(B_CANCELED, "Request Canceled because BHttpSession was closed"));
+			request.NotifyCompleted(false);
+		}
+	}
+	for (auto& [request, allowPipelining]: shard->waitingRequests) {
+		request.result->SetError(BError(B_CANCELED, "Request Canceled because BHttpSession was closed"));
+		request.NotifyCompleted(false);
+	}
+	shard->waitingRequests.clear();
+	shard->requestIndex.clear();
+	shard->originIndex.clear();
+	shard->connections.clear();
+	// Requests that are still queued are cancelled when the shard is deleted,
+	// after the workers that may hand back requests have finished.
+	return B_OK;
+}
+
+
+/*!	Assign \a request to a connection on \a shard.
+
+	A request that carries a socket from the connection pool gets a connection
+	of its own. A request that can be pipelined, or that is sent over HTTP/2,
+	is added to a connection to the same origin that has room for it, if
+	\a allowPipelining is set. Otherwise a new connection is opened.
+*/
+/*static*/ void
+BHttpSession::_Dispatch(Shard* shard, Wrapper&& request, bool allowPipelining)
+{
+	if (request.result->IsCancelRequested()) {
+		shard->session->RequestDone(shard, request.result->id);
+		request.result->SetError(BError(B_CANCELED, "Request cancelled by user"));
+		request.NotifyCompleted(false);
+		return;
+	}
+
+	if (request.socket) {
+		// Keep the address in case the request has to move to a new
+		// connection
+		request.remoteAddress = request.socket->Peer();
+		if (!shard->session->TakeConnection(request.origin, shard)) {
+			auto& pool = shard->session->connectionPool;
+			pool.Release(request.origin, std::move(request.socket));
+			if (!shard->poolTimer.IsScheduled()) {
+				shard->timers.Schedule(shard->poolTimer,
+					system_time() + pool.IdleTimeout());
+			}
+			_WaitForConnection(shard, std::move(request), allowPipelining);
+			return;
+		}
+		auto& connection = _AddConnection(shard, request);
+		connection.state = Connection::kOpen;
+		connection.persistent = request.reusedConnection;
+		_AddToConnection(shard, connection, std::move(request));
+		return;
+	}
+
+	if (allowPipelining && request.UsesHttp2()) {
+		auto range = shard->originIndex.equal_range(request.origin);
+		for (auto it = range.first; it != range.second; it++) {
+			if (it->second->CanMultiplex()) {
+				_AddToConnection(shard, *it->second, std::move(request));
+				return;
+			}
+		}
+	}
+
+	size_t maxDepth = atomic_get(&shard->session->maxPipelineDepth);
+	if (allowPipelining && maxDepth > 1 && request.CanPipeline()) {
+		auto range = shard->originIndex.equal_range(request.origin);
+		for (auto it = range.first; it != range.second; it++) {
+			if (it->second->CanPipeline(maxDepth, request.priority)) {
+				_AddToConnection(shard, *it->second, std::move(request));
+				return;
+			}
+		}
+	}
+
+	if (!shard->session->TakeConnection(request.origin, shard)) {
+		_WaitForConnection(shard, std::move(request), allowPipelining);
+		return;
+	}
+	try {
+		_OpenConnection(shard, request);
+	} catch (BError& e) {
+		shard->session->ReleaseConnection(request.origin);
+		_FailRequest(shard, request, e);
+		return;
+	}
+	auto& connection = _AddConnection(shard, request);
+	if (request.UsesHttp2())
+		connection.http2 = std::make_unique<Http2Connection>();
+	connection.deadline = system_time()
+		+ std::min(atomic_get64(&shard->session->connectTimeout),
+			request.request.fOptConnectTimeout);
+	shard->timers.Schedule(connection.timer, connection.deadline);
+	_AddToConnection(shard, connection, std::move(request));
+}
+
+
+/*!	Hold \a request back on \a shard until its origin has room for another
+	connection. It is dispatched again, with \a allowPipelining, when one of
+	the connections to any origin is given up, or when a request leaves a
+	connection on \a shard, as it may be pipelined or multiplexed then.
+*/
+/*static*/ void
+BHttpSession::_WaitForConnection(Shard* shard, Wrapper&& request,
+	bool allowPipelining)
+{
+	shard->waitingRequests.emplace_back(std::move(request), allowPipelining);
+}
+
+
+/*!	Set up a connection on \a shard for the socket of \a request.
+
+	The connection is registered with the event loop, and starts out in the
+	kConnecting state.
+*/
+/*static*/ BHttpSession::Connection&
+BHttpSession::_AddConnection(Shard* shard, Wrapper& request)
+{
+	int fd = request.socket->Socket();
+	auto& connection = shard->connections.try_emplace(fd).first->second;
+	connection.socket = std::move(request.socket);
+	connection.fd = fd;
+	connection.origin = request.origin;
+	connection.host = request.request.fUrl.Host();
+	connection.ssl = request.request.fSSL;
+	connection.sending = connection.requests.end();
+	connection.timer.cookie = &connection;
+	shard->originIndex.emplace(connection.origin, &connection);
+	shard->loop.Add(fd, B_EVENT_WRITE | B_EVENT_DISCONNECTED, &connection);
+	return connection;
+}
+
+
+/*!	Queue \a request on \a connection, and send it when the connection is
+	ready for it.
+*/
+/*static*/ void
+BHttpSession::_AddToConnection(Shard* shard, Connection& connection,
+	Wrapper&& request)
+{
+	auto& entry = connection.requests.emplace_back(std::move(request));
+	entry.connection = &connection;
+	connection.priority = std::max(connection.priority, entry.priority);
+	entry.requestStatus = Wrapper::kRequestConnected;
+	shard->requestIndex.insert_or_assign(entry.result->id, &entry);
+
+	if (connection.http2 && connection.state == Connection::kOpen) {
+		// The connection is no longer idle
+		connection.timer.Cancel();
+	}
+
+	// Watch the deadlines of the request; one that has passed already is
+	// handled when the timers are processed
+	entry.timer.cookie = &entry;
+	bigtime_t next;
+	if (entry.CheckDeadlines(system_time(), next))
+		next = 0;
+	if (next != B_INFINITE_TIMEOUT)
+		shard->timers.Schedule(entry.timer, next);
+
+	if (connection.sending == connection.requests.end()) {
+		connection.sending = std::prev(connection.requests.end());
+		_UpdateInterest(shard, connection);
+	}
+}
+
+
+/*!	Update the events that are monitored for \a connection.
+
+	The connection is monitored for writability while it is connecting, or
+	when there is a request that can be sent. It is monitored for readability
+	when the first request has been sent completely. HTTP/2 connections are
+	always monitored for readability once they are open, as the server may
+	send frames at any time. A connection that is paused is not monitored for
+	readability, nor for the server closing it, as that is only noticed once
+	the data before it has been read.
+*/
+/*static*/ void
+BHttpSession::_UpdateInterest(Shard* shard, Connection& connection)
+{
+	if (connection.state == Connection::kHandshaking)
+		return;
+
+	uint16 interest = connection.readPaused ? 0 : B_EVENT_DISCONNECTED;
+	if (connection.state == Connection::kConnecting || connection.CanSend())
+		interest |= B_EVENT_WRITE;
+	if (connection.readPaused) {
+		// nothing to read until the body target has caught up
+	} else if (connection.http2) {
+		if (connection.state == Connection::kOpen)
+			interest |= B_EVENT_READ;
+	} else if (!connection.requests.empty()
+		&& connection.requests.front().requestStatus >= Wrapper::kRequestSent)
+		interest |= B_EVENT_READ;
+	shard->loop.Modify(connection.fd, interest);
+}
+
+
+/*static*/ void
+BHttpSession::_ProcessEvent(Shard* shard, Connection& connection, uint16 events)
+{
+	if (connection.state == Connection::kConnecting) {
+		// The outcome of a non-blocking connect is signalled by writability
+		// (or an error).
+		auto socket = connection.socket.get();
+		status_t status = connection.ssl
+			? static_cast<HttpSecureSocket*>(socket)->FinishConnect()
+			: static_cast<HttpSocket*>(socket)->FinishConnect();
+		if (status != B_OK) {
+			_CloseConnection(shard, connection,
+				BError(status, "Cannot connect to host"), false);
+			return;
+		}
+
+		for (auto& request: connection.requests) {
+			if (request.observer.IsValid()) {
+				BMessage msg(UrlEvent::ConnectionOpened);
+				msg.AddInt32(UrlEventData::Id, request.result->id);
+				request.observer.SendMessage(&msg);
+			}
+		}
+
+		if (connection.ssl) {
+			_StartHandshake(shard, connection);
+			return;
+		}
+		connection.timer.Cancel();
+		connection.state = Connection::kOpen;
+		if ((events & B_EVENT_WRITE) == 0) {
+			_UpdateInterest(shard, connection);
+			return;
+		}
+	}
+
+	try {
+		if ((events & B_EVENT_WRITE) != 0)
+			_ConnectionWrite(shard, connection);
+
+		if ((events & B_EVENT_READ) != 0) {
+			if (!_ConnectionRead(shard, connection))
+				return;
+		} else if ((events & (B_EVENT_DISCONNECTED | B_EVENT_ERROR)) != 0) {
+			std::cout << "Unexpected disconnect for " << connection.fd << std::endl;
+			throw BError(B_IO_ERROR, "Connection was closed unexpectedly");
+		}
+	} catch (BError& e) {
+		_CloseConnection(shard, connection, e, true);
+		return;
+	}
+	_UpdateInterest(shard, connection);
+}
+
+
+/*!	Write the requests on \a connection until the socket would block, or until
+	the next request has to wait for the server to confirm that the connection
+	is persistent.
+*/
+/*static*/ void
+BHttpSession::_ConnectionWrite(Shard* shard, Connection& connection)
+{
+	std::cout << "> Processing write for " << connection.fd << std::endl;
+	if (connection.http2) {
+		_Http2Write(shard, connection);
+		return;
+	}
+
+	while (connection.CanSend()) {
+		auto& request = *connection.sending;
+		if (request.requestStatus == Wrapper::kRequestConnected) {
+			_SerializeRequest(request);
+			request.requestStatus = Wrapper::kRequestSending;
+		}
+		if (!_RequestWrite(request))
+			break;
+		request.requestStatus = Wrapper::kRequestSent;
+		request.responseStart = system_time();
+		connection.sending++;
+	}
+}
+
+
+/*!	Receive the responses on \a connection.
+
+	Completed requests are taken off the connection. The connection is closed
+	when the server does not keep it open, and handed back to the connection
+	pool when there are no more requests on it.
+
+	Returns false when the connection has been removed.
+*/
+/*static*/ bool
+BHttpSession::_ConnectionRead(Shard* shard, Connection& connection)
+{
+	connection.readBudget = (kReadBudget >> B_HTTP_PRIORITY_NORMAL)
+		<< connection.priority;
+	if (connection.http2)
+		return _Http2Read(shard, connection);
+
+	while (!connection.requests.empty()) {
+		auto& request = connection.requests.front();
+		if (request.requestStatus < Wrapper::kRequestSent)
+			break;
+
+		auto finished = _RequestRead(request);
+
+		if (request.result->CanCancel()) {
+			std::cout << "Canceling request because no one is listening" << std::endl;
+			_DropRequest(shard, connection, request, std::nullopt);
+			_CloseConnection(shard, connection,
+				BError(B_IO_ERROR, kConnectionClosedMessage), true);
+			return false;
+		}
+		if (!finished)
+			break;
+
+		if (request.retryResponse) {
+			// The rest of the response is skipped
+			_CloseConnection(shard, connection,
+				BError(B_IO_ERROR, kConnectionClosedMessage), true);
+			return false;
+		}
+
+		bool reusable = request.CanReuseConnection() && !connection.closing;
+		if (request.redirectUrl)
+			_FollowRedirect(shard, connection, request, reusable);
+		else {
+			request.CompleteBody();
+			_DropRequest(shard, connection, request, std::nullopt);
+		}
+
+		if (!reusable) {
+			_CloseConnection(shard, connection,
+				BError(B_IO_ERROR, kConnectionClosedMessage), true);
+			return false;
+		}
+		if (connection.requests.empty()) {
+			_RemoveConnection(shard, connection, true);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/*!	Cancel \a request, which fails with \a error.
+
+	A request that has not been sent yet is simply taken off its connection.
+	When the request has been sent, its response has to be skipped, so the
+	connection is not used for any new requests. On an HTTP/2 connection, the
+	stream of the request is reset, which leaves the other streams alone.
+*/
+/*static*/ void
+BHttpSession::_CancelRequest(Shard* shard, Wrapper& request,
+	const BError& error)
+{
+	auto& connection = *request.connection;
+	std::cout << "Cancel request for " << connection.fd << std::endl;
+	request.result->SetError(error);
+
+	if (connection.http2) {
+		if (request.stream != 0)
+			connection.http2->ResetStream(request.stream);
+		_DropRequest(shard, connection, request, false);
+		if (connection.requests.empty())
+			_Http2Idle(shard, connection);
+		_UpdateInterest(shard, connection);
+		return;
+	}
+
+	if (&request == &connection.requests.front()
+		&& request.requestStatus >= Wrapper::kRequestSending) {
+		// The response may already be coming in
+		_DropRequest(shard, connection, request, false);
+		_CloseConnection(shard, connection,
+			BError(B_IO_ERROR, kConnectionClosedMessage), true);
+		return;
+	}
+
+	if (request.requestStatus >= Wrapper::kRequestSending) {
+		connection.closing = true;
+		connection.sending = connection.requests.end();
+	}
+	_DropRequest(shard, connection, request, false);
+
+	if (connection.requests.empty()) {
+		// Nothing was sent; a connection that is known to be persistent can
+		// be used again
+		_RemoveConnection(shard, connection, connection.state == Connection::kOpen
+			&& connection.persistent && !connection.closing);
+	} else
+		_UpdateInterest(shard, connection);
+}
+
+
+/*!	Fail \a request with a timeout error when one of its deadlines has passed.
+	Otherwise its timer is set to the next point in time at which one may pass.
+*/
+/*static*/ void
+BHttpSession::_CheckDeadlines(Shard* shard, Wrapper& request)
+{
+	bigtime_t next;
+	if (auto error = request.CheckDeadlines(system_time(), next)) {
+		_CancelRequest(shard, request, *error);
+		return;
+	}
+	if (next != B_INFINITE_TIMEOUT)
+		shard->timers.Schedule(request.timer, next);
+}
+
+
+/*!	Take \a request off \a connection.
+
+	If \a success has a value, the observer is notified that the request is
+	completed. The \a request reference is no longer valid after this call.
+*/
+/*static*/ void
+BHttpSession::_DropRequest(Shard* shard, Connection& connection,
+	Wrapper& request, std::optional<bool> success)
+{
+	if (success)
+		request.NotifyCompleted(*success);
+	shard->session->RequestDone(shard, request.result->id);
+	_DetachRequest(shard, connection, request);
+}
+
+
+/*!	Take \a request off \a connection, without finishing it. The \a request
+	reference is no longer valid after this call.
+*/
+/*static*/ void
+BHttpSession::_DetachRequest(Shard* shard, Connection& connection,
+	Wrapper& request)
+{
+	shard->requestIndex.erase(request.result->id);
+	if (request.stream != 0)
+		connection.streams.erase(request.stream);
+	if (!shard->waitingRequests.empty())
+		atomic_set(&shard->retryWaiting, 1);
+
+	auto it = std::find_if(connection.requests.begin(), connection.requests.end(),
+		[&request](const Wrapper& entry) { return &entry == &request; });
+	if (it == connection.sending)
+		connection.sending++;
+	bool wasFront = it == connection.requests.begin();
+	connection.requests.erase(it);
+	connection.UpdatePriority();
+
+	// The next pipelined request is now waiting for its response
+	if (wasFront && !connection.http2 && !connection.requests.empty()) {
+		auto& next = connection.requests.front();
+		if (next.requestStatus >= Wrapper::kRequestSent)
+			next.responseStart = system_time();
+	}
+}
+
+
+/*!	Close \a connection and finish its requests.
+
+	The requests that did not receive a response are moved to a new connection
+	when \a failover is set and it is safe to send them again. The other
+	requests fail with \a error. The \a connection reference is no longer valid
+	after this call.
+*/
+/*static*/ void
+BHttpSession::_CloseConnection(Shard* shard, Connection& connection,
+	const BError& error, bool failover)
+{
+	std::list<Wrapper> requests = std::move(connection.requests);
+	_RemoveConnection(shard, connection, false);
+
+	for (auto& request: requests) {
+		if (failover)
+			_Failover(shard, request, error);
+		else
+			_FailRequest(shard, request, error);
+	}
+}
+
+
+/*!	Move \a request, which has been taken off its connection, to a new
+	connection if it is safe to send it again. Otherwise it fails with
+	\a error.
+*/
+/*static*/ void
+BHttpSession::_Failover(Shard* shard, Wrapper& request, const BError& error)
+{
+	if (request.CanFailover()) {
+		shard->requestIndex.erase(request.result->id);
+		_Dispatch(shard, request.Restart(), false);
+		return;
+	}
+	_FailRequest(shard, request, error);
+}
+
+
+/*!	Move \a request, which has been taken off its connection before the
+	server processed it, to a new connection, whatever its method. A body that
+	was partly sent is rewound. Otherwise the request fails with \a error.
+*/
+/*static*/ void
+BHttpSession::_Resend(Shard* shard, Wrapper& request, const BError& error)
+{
+	if (!request.CanResend()) {
+		_FailRequest(shard, request, error);
+		return;
+	}
+	if (request.bodyBytesSent > 0) {
+		auto input = dynamic_cast<BPositionIO*>(
+			request.request.fOptInputData.get());
+		if (input->Seek(-request.bodyBytesSent, SEEK_CUR) < 0) {
+			_FailRequest(shard, request, error);
+			return;
+		}
+	}
+	shard->requestIndex.erase(request.result->id);
+	_Dispatch(shard, request.Restart(), false);
+}
+
+
+/*!	Finish \a request, which has been taken off its connection, with \a error.
+
+	A request that failed because of its connection, or that the server
+	answered with a transient error, is tried again after a delay instead, if
+	it is safe to send it again and the retry budget allows it. It goes back to
+	the control thread, and waits for its turn once more.
+*/
+/*static*/ void
+BHttpSession::_FailRequest(Shard* shard, Wrapper& request, const BError& error)
+{
+	shard->requestIndex.erase(request.result->id);
+	if (request.retryResponse
+		|| (request.requestStatus < Wrapper::kRequestStatusReceived
+			&& IsTransientError(error.Code()) && request.CanRetry()
+			&& shard->session->TakeFromRetryBudget())) {
+		shard->session->RetryRequest(shard, request.Retry());
+		return;
+	}
+	request.result->SetError(error);
+	request.NotifyCompleted(false);
+	shard->session->RequestDone(shard, request.result->id);
+}
+
+
+/*!	Send \a request, of which the response on \a connection is a redirect
+	that is followed, to the new location.
+
+	The request keeps its identity and its result. When the location has the
+	same origin, the request stays on \a connection if it is kept open
+	(\a reuse), or it takes an idle connection from the pool, or it gets a new
+	connection to the address that is known. The host name of another origin
+	is resolved first, unless there is an idle connection to it. The
+	\a request reference is no longer valid after this call.
+*/
+/*static*/ void
+BHttpSession::_FollowRedirect(Shard* shard, Connection& connection,
+	Wrapper& request, bool reuse)
+{
+	Wrapper redirected = request.Redirect();
+	bool sameOrigin = redirected.origin == connection.origin;
+	_DetachRequest(shard, connection, request);
+	if (!reuse)
+		connection.closing = true;
+
+	if (sameOrigin && reuse && !connection.http2
+		&& (connection.requests.empty() || redirected.CanPipeline())) {
+		_AddToConnection(shard, connection, std::move(redirected));
+		return;
+	}
+
+	if (!redirected.UsesHttp2()) {
+		redirected.socket
+			= shard->session->connectionPool.Acquire(redirected.origin);
+		redirected.reusedConnection = redirected.socket != nullptr;
+	}
+	if (redirected.socket || sameOrigin)
+		_Dispatch(shard, std::move(redirected), true);
+	else
+		_ResolveHostName(shard->session, std::move(redirected), shard);
+}
+
+
+/*!	Stop monitoring \a connection and remove it from \a shard.
+
+	If \a reuse is set, the socket is handed back to the connection pool,
+	otherwise it is disconnected. The connection should not have any requests
+	left. The \a connection reference is no longer valid after this call.
+*/
+/*static*/ void
+BHttpSession::_RemoveConnection(Shard* shard, Connection& connection, bool reuse)
+{
+	int fd = connection.fd;
+	if (connection.state != Connection::kHandshaking)
+		shard->loop.Remove(fd);
+	connection.timer.Cancel();
+	auto range = shard->originIndex.equal_range(connection.origin);
+	for (auto it = range.first; it != range.second; it++) {
+		if (it->second == &connection) {
+			shard->originIndex.erase(it);
+			break;
+		}
+	}
+	if (connection.socket) {
+		if (reuse && connection.inputBuffer.Size() == 0) {
+			auto& pool = shard->session->connectionPool;
+			pool.Release(connection.origin, std::move(connection.socket));
+			if (!shard->poolTimer.IsScheduled()) {
+				shard->timers.Schedule(shard->poolTimer,
+					system_time() + pool.IdleTimeout());
+			}
+		} else
+			connection.socket->Disconnect();
+	}
+	std::string origin = std::move(connection.origin);
+	shard->connections.erase(fd);
+	shard->session->ReleaseConnection(origin);
+}
+
+
+/*!	Resolve the address for \a request.
+
+	The lookup is done by the session's resolver. When the address is cached,
+	the request is passed on to the data thread straight away, otherwise this
+	happens when the resolver is done. When this is called by the data thread
+	of \a shard, a request of which the address is cached is dispatched on
+	that shard, as the data thread cannot wait for room in its own queue.
+*/
+/*static*/ void
+BHttpSession::_ResolveHostName(Data* data, Wrapper&& request, Shard* shard)
+{
+	int port = request.request.fSSL ? 443 : 80;
+	if (request.request.fUrl.HasPort())
+		port = request.request.fUrl.Port();
+
+	// TODO: proxy
+	std::string host = request.request.fUrl.Host().String();
+	auto pending = std::make_shared<Wrapper>(std::move(request));
+	auto status = data->resolver.Resolve(host, port, pending->remoteAddress,
+		[data, pending](status_t status, const BNetworkAddress& address) {
+			pending->remoteAddress = address;
+			_HostNameResolved(data, std::move(*pending), status);
+		});
+	if (status != B_WOULD_BLOCK)
+		_HostNameResolved(data, std::move(*pending), status, shard);
+}
+
+
+/*static*/ void
+BHttpSession::_HostNameResolved(Data* data, Wrapper&& request, status_t status,
+	Shard* shard)
+{
+	if (status != B_OK) {
+		data->RequestDone(request.shard, request.result->id);
+		request.result->SetError(BError(B_SERVER_NOT_FOUND, "Cannot resolve hostname"));
+		request.NotifyCompleted(false);
+		return;
 	}
 
-	return B_OK;
+	if (request.observer.IsValid()) {
+		BMessage msg(UrlEvent::HostnameResolved);
+		msg.AddInt32(UrlEventData::Id, request.result->id);
+		msg.AddString(UrlEventData::HostName, request.request.fUrl.Host());
+		request.observer.SendMessage(&msg);
+	}
+	if (shard != nullptr)
+		_Dispatch(shard, std::move(request), true);
+	else
+		_QueueForDataThread(data, std::move(request));
 }
 
 
+/*!	Hand \a request over to the data thread of the shard it is assigned to.
+
+	This may be called from any thread. When the session is quitting, the
+	request is cancelled instead.
+*/
 /*static*/ void
-BHttpSession::_ResolveHostName(Wrapper& request)
+BHttpSession::_QueueForDataThread(Data* data, Wrapper&& request)
 {
-	// This helper resolves the address for a given request
-	int port = request.request.fSSL ? 443 : 80;
-	if (request.request.fUrl.HasPort())
-		port = request.request.fUrl.Port();
+	if (request.result->IsCancelRequested()) {
+		data->RequestDone(request.shard, request.result->id);
+		request.result->SetError(BError(B_CANCELED, "Request cancelled by user"));
+		request.NotifyCompleted(false);
+		return;
+	}
 
-	// TODO: proxy
-	request.remoteAddress.SetTo(request.request.fUrl.Host(), port);
-	if (auto status = request.remoteAddress.InitCheck(); status != B_OK)
-		throw BError(B_SERVER_NOT_FOUND, "Cannot resolve hostname");
+	auto loop = &request.shard->loop;
+	if (atomic_get(&data->quitting) == 1
+		|| !PushOrWait(request.shard->queue, std::move(request), &data->quitting,
+			[loop]() { loop->Wakeup(); })) {
+		request.result->SetError(BError(B_CANCELED, "Request Canceled because BHttpSession was closed"));
+		request.NotifyCompleted(false);
+	}
 }
 
 
+/*!	Start a non-blocking connect for \a request.
+
+	The socket is stored in the request; the data thread sets up a connection
+	for it, and monitors the socket for writability to find out when the
+	connection is established.
+*/
 /*static*/ void
-BHttpSession::_OpenConnection(Wrapper& request)
+BHttpSession::_OpenConnection(Shard* shard, Wrapper& request)
 {
 	// Set up the socket
 	std::unique_ptr<BSocket> socket = nullptr;
+	status_t status;
 	if (request.request.fSSL) {
 		// To do: secure socket with callbacks to check certificates
-		socket = std::make_unique<BSecureSocket>();
+		auto secureSocket = std::make_unique<HttpSecureSocket>();
+		status = secureSocket->StartConnect(request.remoteAddress);
+		socket = std::move(secureSocket);
 	} else {
-		socket = std::make_unique<BSocket>();
+		auto plainSocket = std::make_unique<HttpSocket>();
+		status = plainSocket->StartConnect(request.remoteAddress);
+		socket = std::move(plainSocket);
 	}
 
-	// Open connection
-	if (auto status = socket->Connect(request.remoteAddress); status != B_OK) {
-		// TODO: inform listeners that the connection failed
+	if (status != B_OK)
 		throw BError(status, "Cannot connect to host");
-	}
 
-	// Make the rest of the interaction non-blocking
-	SetSocketNonBlocking(socket->Socket());
-
-	// TODO: inform the listeners that the connection was opened.
 	request.socket = std::move(socket);
 }
 
-/*static*/ std::string
-BHttpSession::_CreateRequestHeaders(Wrapper& request)
-{
-	std::stringstream headerStream;
-	const auto& httpRequest = request.request;
-
-	// Create the first line of the request header
-	headerStream << httpRequest.fRequestMethod.Method();
-	headerStream << ' ';
 
-	// TODO: proxy
+/*!	Hand the socket of \a connection over to a worker thread to do the TLS
+	handshake.
 
-	if (httpRequest.fUrl.HasPath() && httpRequest.fUrl.Path().Length() > 0)
-		headerStream << httpRequest.fUrl.Path();
-	else
-		headerStream << '/';
+	The connection stays on the shard, but it is not monitored while the
+	handshake is in progress. When it is done, the worker hands the socket back
+	through the shard's handshake queue. The connection attempt still expires
+	at its deadline.
+*/
+/*static*/ void
+BHttpSession::_StartHandshake(Shard* shard, Connection& connection)
+{
+	shard->loop.Remove(connection.fd);
+	connection.state = Connection::kHandshaking;
+
+	auto socket = static_cast<HttpSecureSocket*>(connection.socket.release());
+	int fd = connection.fd;
+	BString host = connection.host;
+	bigtime_t timeout = std::max(connection.deadline - system_time(),
+		(bigtime_t)1000);
+	shard->session->workers.Submit([shard, socket, fd, host, timeout]() {
+		auto status = socket->Handshake(host, timeout);
+		auto loop = &shard->loop;
+		PushOrWait(shard->handshakes,
+			HandshakeResult{fd, std::unique_ptr<BSocket>(socket), status},
+			&shard->session->quitting, [loop]() { loop->Wakeup(); });
+	});
+}
 
-	switch (httpRequest.fHttpVersion) {
-		case B_HTTP_11:
-			headerStream << " HTTP/1.1\r\n";
-			break;
 
-		default:
-		case B_HTTP_10:
-			headerStream << " HTTP/1.0\r\n";
-			break;
-	}
+/*static*/ void
+BHttpSession::_SerializeRequest(Wrapper& request)
+{
+	const auto& httpRequest = request.request;
+	HttpSerializer serializer(request.outputBuffer);
+	request.outputOffset = 0;
+	request.bodyBuffer.clear();
+	request.bodyOffset = 0;
+	request.bodyBytesSent = 0;
+	request.sendEnd = false;
 
-	BHttpHeaders outputHeaders;
+	// TODO: proxy
+	serializer.RequestLine(httpRequest.fRequestMethod.Method(), httpRequest.fUrl,
+		httpRequest.fHttpVersion);
 
 	// HTTP 1.1 additional headers
 	if (httpRequest.fHttpVersion == B_HTTP_11) {
-		BString host = httpRequest.fUrl.Host();
-		int defaultPort = httpRequest.fSSL ? 443 : 80;
-		if (httpRequest.fUrl.HasPort() && httpRequest.fUrl.Port() != defaultPort)
-			host << ':' << httpRequest.fUrl.Port();
-
-		outputHeaders.AddHeader("Host", host);
-
-		outputHeaders.AddHeader("Accept", "*/*");
-		outputHeaders.AddHeader("Accept-Encoding", "gzip");
-			// Allows the server to compress data using the "gzip" format.
-			// "deflate" is not supported, because there are two interpretations
+		serializer.Host(httpRequest.fUrl, httpRequest.fSSL ? 443 : 80);
+		serializer.Header("Accept", "*/*");
+		serializer.Header("Accept-Encoding",
+			HttpContentDecoderPool::AcceptEncoding());
+			// Allows the server to compress data with the codings for
+			// which there is a decoder.
+			// "deflate" is not advertised, because there are two interpretations
 			// of what it means (the RFC and Microsoft products), and we don't
 			// want to handle this. Very few websites support only deflate,
 			// and most of them will send gzip, or at worst, uncompressed data.
 
-		outputHeaders.AddHeader("Connection", "close");
-			// Let the remote server close the connection after response since
-			// we don't handle multiple request on a single connection
+		// HTTP 1.1 connections are persistent by default; finished requests
+		// return their connection to the session's connection pool.
 	}
 
 	// Classic HTTP headers
-	if (httpRequest.fOptUserAgent.CountChars() > 0)
-		outputHeaders.AddHeader("User-Agent", httpRequest.fOptUserAgent.String());
+	if (httpRequest.fOptUserAgent.Length() > 0)
+		serializer.Header("User-Agent", httpRequest.fOptUserAgent);
 
-	if (httpRequest.fOptReferer.CountChars() > 0)
-		outputHeaders.AddHeader("Referer", httpRequest.fOptReferer.String());
+	if (httpRequest.fOptReferer.Length() > 0)
+		serializer.Header("Referer", httpRequest.fOptReferer);
 
 	// TODO: Optional range requests headers
 
 	// TODO: Authentication
 
-	// TODO: Required headers for POST data
+	// Required headers for the request body
+	if (httpRequest.fOptInputData) {
+		if (httpRequest.fOptInputDataSize >= 0)
+			serializer.Header("Content-Length", (off_t)httpRequest.fOptInputDataSize);
+		else if (httpRequest.fHttpVersion == B_HTTP_11)
+			serializer.Header("Transfer-Encoding", "chunked");
+		else
+			throw BError(B_BAD_VALUE, "Request body of unknown size requires HTTP/1.1");
+		serializer.Header("Content-Type", httpRequest.fOptInputDataType);
+	}
+
+	// TODO: Post fields
 
 	// TODO: Optional headers specified by the user
 
@@ -568,67 +2460,215 @@ BHttpSession::_CreateRequestHeaders(Wrapper& request)
 
 	// TODO: proper debug
 
-	// Write output headers to output stream
-	for (int32 headerIndex = 0; headerIndex < outputHeaders.CountHeaders();
-			headerIndex++) {
-		const char* header = outputHeaders.HeaderAt(headerIndex).Header();
+	serializer.End();
+}
+
+
+static const size_t kBodySegmentSize = 65536;
+static const size_t kDecodeWindowSize = 65536;
+
+
+/*static*/ bool
+BHttpSession::_RequestWrite(Wrapper& request)
+{
+	// Write the pending output until the socket would block. The request
+	// headers and the current segment of the body are written together with
+	// a single vectored write. Once a body segment is written, the next one
+	// is read from the input.
+	//
+	// Return true when the whole request has been written.
+	const auto& httpRequest = request.request;
+	while (true) {
+		if (request.bodyOffset == request.bodyBuffer.size() && !request.sendEnd)
+			_ReadBodySegment(request);
+
+		iovec vectors[2];
+		int count = 0;
+		if (request.outputOffset < request.outputBuffer.size()) {
+			vectors[count].iov_base = request.outputBuffer.data() + request.outputOffset;
+			vectors[count].iov_len = request.outputBuffer.size() - request.outputOffset;
+			count++;
+		}
+		if (request.bodyOffset < request.bodyBuffer.size()) {
+			vectors[count].iov_base = request.bodyBuffer.data() + request.bodyOffset;
+			vectors[count].iov_len = request.bodyBuffer.size() - request.bodyOffset;
+			count++;
+		}
+		if (count == 0)
+			return true;
+
+		ssize_t bytesWritten;
+		if (httpRequest.fSSL) {
+			// The data has to go through the TLS layer, one buffer at a time
+			bytesWritten = request.connection->socket->Write(vectors[0].iov_base,
+				vectors[0].iov_len);
+		} else {
+			bytesWritten = writev(request.connection->fd, vectors, count);
+			if (bytesWritten < 0)
+				bytesWritten = errno;
+		}
+		if (bytesWritten == B_WOULD_BLOCK)
+			return false;
+		if (bytesWritten < 0)
+			throw BError(bytesWritten, "Error writing data to host");
+
+		size_t headerBytes = std::min((size_t)bytesWritten,
+			request.outputBuffer.size() - request.outputOffset);
+		request.outputOffset += headerBytes;
+		request.bodyOffset += bytesWritten - headerBytes;
+		if ((size_t)bytesWritten > headerBytes) {
+			// The body buffer may hold the framing of a chunk as well
+			request.UpdateProgress(request.uploadProgress,
+				std::max(request.bodyBytesSent - (off_t)(request.bodyBuffer.size()
+					- request.bodyOffset), (off_t)0),
+				httpRequest.fOptInputDataSize);
+		}
+	}
+}
+
+
+/*!	Read the next segment of the request body into the body buffer.
+
+	For a body of unknown size, the segment is framed as a chunk; an empty
+	chunk marks the end of the body.
+*/
+/*static*/ void
+BHttpSession::_ReadBodySegment(Wrapper& request)
+{
+	const auto& httpRequest = request.request;
+	if (!httpRequest.fOptInputData) {
+		request.sendEnd = true;
+		return;
+	}
 
-		headerStream << header;
-		headerStream << "\r\n";
+	bool chunked = httpRequest.fOptInputDataSize < 0;
+	size_t size = kBodySegmentSize;
+	if (!chunked) {
+		size = std::min((off_t)size,
+			httpRequest.fOptInputDataSize - request.bodyBytesSent);
 	}
 
-	// End of header text
-	headerStream << "\r\n";
+	// Leave room for the chunk header in front of the data
+	static const size_t kChunkHeaderSize = 10;
+	size_t offset = chunked ? kChunkHeaderSize : 0;
+	request.bodyBuffer.resize(offset + size);
+	request.bodyOffset = offset;
+	ssize_t bytesRead = 0;
+	if (size > 0) {
+		bytesRead = httpRequest.fOptInputData->Read(
+			request.bodyBuffer.data() + offset, size);
+		if (bytesRead < 0)
+			throw BError(bytesRead, "Error reading the request body");
+	}
+	request.bodyBuffer.resize(offset + bytesRead);
+	request.bodyBytesSent += bytesRead;
+
+	if (chunked) {
+		char header[kChunkHeaderSize + 1];
+		int headerSize = snprintf(header, sizeof(header), "%zx\r\n",
+			(size_t)bytesRead);
+		request.bodyOffset = offset - headerSize;
+		memcpy(request.bodyBuffer.data() + request.bodyOffset, header,
+			headerSize);
+		request.bodyBuffer.append("\r\n");
+		request.sendEnd = bytesRead == 0;
+	} else if (request.bodyBytesSent == httpRequest.fOptInputDataSize) {
+		request.sendEnd = true;
+	} else if (bytesRead == 0) {
+		throw BError(B_IO_ERROR,
+			"Request body is shorter than the announced size");
+	}
+}
 
-	// TODO: proper debug
-	std::cout << headerStream.str();
 
-	return headerStream.str();
+/*!	Read from the socket of \a connection into its receive buffer.
+
+	Returns the number of bytes that were read, 0 at the end of the data, or
+	B_WOULD_BLOCK when there is nothing to read, or when the read budget of the
+	connection is used up. In that case the connection is read again in the
+	next round of the data thread, as the socket itself may not signal that
+	there is more data (a TLS socket can have it buffered).
+*/
+/*static*/ ssize_t
+BHttpSession::_ReadSocket(Shard* shard, Connection& connection)
+{
+	if (connection.readBudget == 0) {
+		shard->readPending.push_back(connection.fd);
+		return B_WOULD_BLOCK;
+	}
+
+	size_t size = connection.readSize;
+	ssize_t bytesRead = connection.socket->Read(
+		connection.inputBuffer.Space(size), size);
+	if (bytesRead == B_WOULD_BLOCK)
+		return bytesRead;
+	if (bytesRead < 0)
+		throw BError(bytesRead, "Error reading data from host");
+
+	connection.inputBuffer.Commit(bytesRead);
+	connection.lastRead = system_time();
+	connection.readBudget -= std::min(connection.readBudget, (size_t)bytesRead);
+	// A connection that keeps filling its reads has more data waiting, so it
+	// gets larger reads
+	if ((size_t)bytesRead == size && size < kMaxReadSize)
+		connection.readSize = size * 2;
+	return bytesRead;
 }
 
 
-static const size_t kHttpBufferSize = 4096;
+/*!	Receive the response to \a request.
 
+	The data that is in the receive buffer is parsed first, as it may already
+	hold (part of) the response. More data is read until the response is
+	complete, the socket would block, or the read budget of the connection is
+	used up.
 
+	Returns true when the whole response has been received and processed.
+*/
 /*static*/ bool
 BHttpSession::_RequestRead(Wrapper& request)
 {
-	// There are two actions combined; one is to receive data, the other is to
-	// decode downloaded data in the buffer.
-	//
-	// Once all data is received (or there is an error), return true to
-	// indicate that all the reading and processing is completed.
-
-	// First check if we are going to download data
-	size_t bytesRead = 0;
-	if ((!request.receiveEnd) && (request.inputBuffer.Size() == request.previousBufferSize)) {
-		std::array<char, kHttpBufferSize> chunk;
-		bytesRead = request.socket->Read(chunk.data(), kHttpBufferSize);
-		if (bytesRead == B_WOULD_BLOCK) {
-			std::cout << "WOULD BLOCK" << std::endl;
+	auto& connection = *request.connection;
+	while (!_ParseResponse(request)) {
+		if (_PauseReceiving(request))
 			return false;
-		}
-		std::cout << "_RequestRead bytesRead: " << bytesRead << std::endl;
+		ssize_t bytesRead = _ReadSocket(request.shard, connection);
+		if (bytesRead == B_WOULD_BLOCK)
+			return false;
+
+		if (bytesRead == 0) {
+			// A server may close a persistent connection before it answers;
+			// the request can then be sent again on a new connection
+			if (request.requestStatus < Wrapper::kRequestHeadersReceived)
+				throw BError(B_IO_ERROR, kConnectionClosedMessage);
 
-		if (bytesRead < 0) {
-			throw BError(bytesRead, "Error reading data from host");
-		} else if (bytesRead == 0) {
 			// Check if we got the expected number of bytes.
 			// Exceptions:
 			// - If the content-length is not known (bytesTotal is 0), for
 			//   example in the case of a chunked transfer, we can't know
 			// - If the request method is "HEAD" which explicitly asks the
 			//   server to not send any data (only the headers)
-			if (request.bytesTotal > 0 && request.bytesReceived != request.bytesTotal) {
+			if ((request.bytesTotal > 0 && request.bytesReceived != request.bytesTotal)
+				|| (request.readByChunks && !request.chunkedDecoder.IsDone())) {
 				throw BError(B_IO_ERROR, "Error reading data from host: unexpected end of data");
 			}
 			request.receiveEnd = true;
 		}
-		request.inputBuffer.AppendData(chunk.data(), bytesRead);
-	} else
-		bytesRead = 0;
+	}
+	return true;
+}
+
 
-	request.previousBufferSize = request.inputBuffer.Size();
+/*!	Process the data in the receive buffer for \a request: the status line,
+	the headers, and the body.
+
+	Returns true when the whole response has been received and processed.
+*/
+/*static*/ bool
+BHttpSession::_ParseResponse(Wrapper& request)
+{
+	auto& connection = *request.connection;
+	auto& inputBuffer = connection.inputBuffer;
 
 	if (request.requestStatus < Wrapper::kRequestStatusReceived) {
 		_ParseStatus(request);
@@ -636,13 +2676,19 @@ BHttpSession::_RequestRead(Wrapper& request)
 		if (request.status.code != 0) {
 			// the status headers are now received, decide what to do next
 
-			if (request.request.fOptFollowLocation
-				&& request.request.IsRedirectionStatusCode(request.status.code))
-					// do nothing for now, in the original code this disables the listener
-					;
+			if (IsTransientStatus(request.status.code) && request.CanRetry()
+				&& request.shard->session->TakeFromRetryBudget()) {
+				// The response is not reported; the request is tried again
+				request.retryResponse = true;
+				return true;
+			}
 
+			// Whether a redirect is followed is known once the headers are
+			// received; only then is its status reported, if it is not
 			// TODO: move?
-			request.result->SetStatus(BHttpStatus(request.status));
+			if (!request.request.fOptFollowLocation
+				|| !request.request.IsRedirectionStatusCode(request.status.code))
+				request.result->SetStatus(BHttpStatus(request.status));
 
 			if (request.request.fOptStopOnError
 				&& request.status.code >= B_HTTP_STATUS_CLASS_CLIENT_ERROR)
@@ -657,123 +2703,105 @@ BHttpSession::_RequestRead(Wrapper& request)
 		_ParseHeaders(request);
 
 		if (request.requestStatus >= Wrapper::kRequestHeadersReceived) {
+			if (request.request.fOptFollowLocation
+				&& request.request.IsRedirectionStatusCode(request.status.code)
+				&& !request.CheckRedirect()) {
+				request.result->SetStatus(BHttpStatus(request.status));
+			}
+
 			// TODO: move headers instead???
-			request.result->SetHeaders(BHttpHeaders(request.headers));
+			if (!request.redirectUrl)
+				request.result->SetHeaders(BHttpHeaders(request.headers));
 
 			// TODO: Parse received cookies
 
+			// connection persistence
+			if (request.request.fHttpVersion == B_HTTP_11) {
+				BString connection = request.headers["Connection"];
+				if (connection.IFindFirst("close") >= 0)
+					request.keepAlive = false;
+				else if (connection.IFindFirst("keep-alive") >= 0)
+					request.keepAlive = true;
+				else
+					request.keepAlive = request.http11Response;
+			}
+
+			// Further requests are only pipelined on the connection once the
+			// server has shown that it keeps the connection open
+			if (request.keepAlive && request.http11Response)
+				connection.persistent = true;
+			else if (!request.keepAlive)
+				connection.closing = true;
+
 			// TODO: let the receivers know that the headers have been received
 
-			// transfer-encoding
+			// transfer-encoding; chunked is always the last coding
 			try {
-				if (std::string(request.headers["Transfer-Encoding"]) == "chunked")
+				std::string transferEncoding(request.headers["Transfer-Encoding"]);
+				static const size_t kChunkedLength = strlen("chunked");
+				if (transferEncoding.size() >= kChunkedLength
+					&& strcasecmp(transferEncoding.c_str() + transferEncoding.size()
+						- kChunkedLength, "chunked") == 0)
 					request.readByChunks = true;
 			} catch (std::logic_error) {
 				// header not found
 			}
 
-			// content-encoding
-			try {
-				std::string contentEncoding(request.headers["Content-Encoding"]);
-				if (contentEncoding == "gzip" || contentEncoding == "deflate") {
-					request.decompress = true;
-					BDataIO* stream = nullptr;
-					auto result = BZlibCompressionAlgorithm()
-						.CreateDecompressingOutputStream(&request.decompressorStorage,
-							NULL, stream);
-					if (result != B_OK) {
-						throw BError(result, "Could not create decompression stream");
-					}
-					request.decompressingStream = std::unique_ptr<BDataIO>(stream);
-				}
-			} catch (std::logic_error) {
-				// header not found
-			}
+			_SetupDecompression(request);
 
-			// content-length
+			// content-length; it is ignored for a chunked body
 			try {
 				std::string contentLength(request.headers["Content-Length"]);
-				request.bytesTotal = std::stol(contentLength);
+				request.bytesTotal = request.readByChunks
+					? -1 : std::stol(contentLength);
 			} catch (std::logic_error) {
 				// header not found or malformed
 				request.bytesTotal = -1;
 			}
 
 			if (request.request.fRequestMethod == BHttpMethod::Head()
-				|| request.status.code == 204) {
+				|| request.status.code == 204 || request.status.code == 304) {
 				// In the case of a HEAD request or if the server replies
-				// 204 ("no content"), we don't expect to receive anything
-				// more, and the socket will be closed.
+				// 204 ("no content") or 304 ("not modified"), we don't expect
+				// to receive anything more.
+				request.bytesTotal = 0;
+				request.readByChunks = false;
+				request.receiveEnd = true;
+				request.parseEnd = true;
 				return true;
 			}
 		}
 	}
 
 	if (request.requestStatus >= Wrapper::kRequestHeadersReceived) {
-		// If Transfer-Encoding is chunked, we should read a complete
-		// chunk in buffer before handling it
-		if (request.readByChunks)
-			throw std::runtime_error("Not implemented");
-		else {
-			bytesRead = request.inputBuffer.Size();
-
-			if (bytesRead > 0) {
-				if (request.inputTempBuffer.size() < bytesRead)
-					request.inputTempBuffer.resize(bytesRead);
-				request.inputBuffer.RemoveData(request.inputTempBuffer.data(), bytesRead);
+		// The body is passed on to the target straight from the receive
+		// buffer. Anything beyond the end of the body belongs to the next
+		// response on the connection.
+		if (request.readByChunks) {
+			if (!request.chunkedDecoder.IsDone()) {
+				inputBuffer.Consume(_ReadChunks(request, inputBuffer.Data(),
+					inputBuffer.Size()));
+			}
+			if (request.chunkedDecoder.IsDone())
+				request.receiveEnd = true;
+		} else {
+			size_t size = inputBuffer.Size();
+			if (request.bytesTotal >= 0) {
+				size = std::min((off_t)size,
+					request.bytesTotal - request.bytesReceived);
 			}
-		}
 
-		if (bytesRead >= 0) {
-			request.bytesReceived += bytesRead;
+			_WriteBody(request, inputBuffer.Data(), size);
+			inputBuffer.Consume(size);
 
-			// NOTE: the original version has a mode where the user does not
-			// want the output and is not listening to the outcome, a sort of
-			// zombie version. The new version will not support that.
-			if (request.decompress) {
-				auto status = request.decompressingStream->WriteExactly(
-					request.inputTempBuffer.data(), bytesRead);
-				if (status != B_OK) {
-					throw BError(status, "Error decompressing data");
-				}
-				ssize_t size = request.decompressorStorage.Size();
-				BStackOrHeapArray<char, 4096> buffer(size);
-				size = request.decompressorStorage.Read(buffer, size);
-				if (size > 0) {
-					// TODO: handle the situation where the buffer can write less
-					// than is available.
-					request.result->WriteToBody(buffer, size);
-					// TODO: notify listeners
-				}
-			} else {
-				// TODO: handle the situation where the buffer can write less
-				// than is available.
-				request.result->WriteToBody(request.inputTempBuffer.data(), bytesRead);
-				// TODO: notify listener
-			}
-			
 			if (request.bytesTotal >= 0 && request.bytesReceived >= request.bytesTotal)
 				request.receiveEnd = true;
-
-			if (request.decompress && request.receiveEnd) {
-				auto status = request.decompressingStream->Flush();
-
-				if (status != B_OK && status != B_BUFFER_OVERFLOW) {
-					throw BError(status, "Error flushing decompression stream");
-				}
-
-				ssize_t size = request.decompressorStorage.Size();
-				BStackOrHeapArray<char, 4096> buffer(size);
-				size = request.decompressorStorage.Read(buffer, size);
-				if (size > 0) {
-					// TODO: handle the situation where the buffer can write less
-					// than is available.
-					request.result->WriteToBody(buffer, size);
-					// TODO: notify listener
-				}
-			}
 		}
-		request.parseEnd = (request.inputBuffer.Size() == 0);
+
+		if (request.receiveEnd)
+			_FinishBody(request);
+		// All the data in the buffer that belongs to this response is parsed
+		request.parseEnd = true;
 	}
 
 	if (request.receiveEnd && request.parseEnd)
@@ -782,77 +2810,567 @@ BHttpSession::_RequestRead(Wrapper& request)
 }
 
 
-// Helper to extract a single line from a BNetBuffer
-static Expected<std::string, status_t>
-GetLine(BNetBuffer& buffer)
-{
-	size_t characterIndex = 0;
-	while ((characterIndex < buffer.Size())
-		&& ((buffer.Data())[characterIndex] != '\n'))
-		characterIndex++;
+/*!	Decode the chunked body of \a request in \a data, and pass the payload
+	on to the body target without copying it first.
 
-	if (characterIndex == buffer.Size()) {
-		return Unexpected<status_t>(B_ERROR);
+	Returns the number of bytes that belong to the body; the rest of the data
+	belongs to the next response.
+*/
+/*static*/ size_t
+BHttpSession::_ReadChunks(Wrapper& request, const char* data, size_t size)
+{
+	auto& decoder = request.chunkedDecoder;
+	size_t used = 0;
+	while (used < size && !decoder.IsDone()) {
+		const char* payload;
+		size_t payloadSize;
+		used += decoder.Decode(data + used, size - used, payload, payloadSize);
+		if (payloadSize > 0)
+			_WriteBody(request, payload, payloadSize);
 	}
 
-	// FUTURE: BNetBuffer requires an extra copy. It should be possible
-	// to copy data directly from the pointer to the buffer, and then ask
-	// the object to drop the number of bytes instead of forcing a double
-	// copy or some evil casting.
-	BStackOrHeapArray<char, 4096> tempData(characterIndex + 1);
-	if (!tempData.IsValid())
-		return Unexpected<status_t>(B_NO_MEMORY);
+	if (decoder.IsDone()
+		&& request.requestStatus < Wrapper::kRequestTrailingHeadersReceived) {
+		for (const auto& field: decoder.Trailers())
+			request.headers.AddHeader(field.c_str());
+		request.requestStatus = Wrapper::kRequestTrailingHeadersReceived;
+	}
+	return used;
+}
 
-	buffer.RemoveData(tempData, characterIndex + 1);
 
-	if (characterIndex != 0 && tempData[characterIndex -1] == '\r')
-		return std::string(tempData, characterIndex -1);
-	else
-		return std::string(tempData, characterIndex);
+/*!	Set up the decoding of the body of \a request, according to the
+	Content-Encoding of the response. A body with an encoding that is not
+	supported is passed on as it is.
+*/
+/*static*/ void
+BHttpSession::_SetupDecompression(Wrapper& request)
+{
+	try {
+		std::string contentEncoding(request.headers["Content-Encoding"]);
+		request.decoder = request.shard->decoders.Get(contentEncoding);
+	} catch (std::logic_error) {
+		// header not found
+	}
 }
 
 
+/*!	Pass \a size bytes of the response body of \a request on to its target,
+	decoding them when needed.
+
+	The body is decoded straight from the receive buffer, into the decode
+	window of the shard. From there, it is appended to the body text, or
+	passed on to the target.
+*/
 /*static*/ void
-BHttpSession::_ParseStatus(Wrapper& request)
+BHttpSession::_WriteBody(Wrapper& request, const char* data, size_t size)
 {
-	auto statusLine = GetLine(request.inputBuffer);
-	if (!statusLine)
+	if (size == 0)
 		return;
-	if (statusLine.value().size() < 12)
+	request.bytesReceived += size;
+	if (request.redirectUrl) {
+		// The body of a redirect is skipped
 		return;
-
-	std::string statusCodeStr(statusLine.value(), 9, 3);
-	try {
-		request.status.code = std::stol(statusCodeStr);
-	} catch (std::invalid_argument) {
-		std::cout << "Error getting status code" << std::endl;
+	}
+	request.UpdateProgress(request.downloadProgress, request.bytesReceived,
+		request.bytesTotal > 0 ? request.bytesTotal : -1);
+
+	// NOTE: the original version has a mode where the user does not
+	// want the output and is not listening to the outcome, a sort of
+	// zombie version. The new version will not support that.
+	if (!request.decoder) {
+		if (request.result->WriteToBody(data, size))
+			_StartBodyWriter(request);
+		request.UpdateProgress(request.bytesWritten,
+			request.bytesWritten.bytes + size);
 		return;
 	}
-	
-	request.status.text = std::string(statusLine.value().begin() + 13, statusLine.value().end());
+
+	// The window keeps its size, so it is only allocated once
+	auto& decodeWindow = request.shard->decodeWindow;
+	decodeWindow.resize(kDecodeWindowSize);
+	char* window = decodeWindow.data();
+	bool end = false;
+	size_t outputSize;
+	off_t decoded = 0;
+	do {
+		char* output = window;
+		outputSize = kDecodeWindowSize;
+		end = request.decoder->Decode(data, size, output, outputSize);
+		decoded += output - window;
+
+		if (output > window && request.result->WriteToBody(window,
+				output - window)) {
+			_StartBodyWriter(request);
+		}
+		// The decoder may have more output when it filled the window
+	} while (!end && (size > 0 || outputSize == 0));
+
+	if (decoded > 0) {
+		request.UpdateProgress(request.bytesWritten,
+			request.bytesWritten.bytes + decoded);
+	}
+}
+
+
+/*!	Start a worker that writes the queued body data of \a request to its
+	target. When the receiving was paused, the worker lets the data thread know
+	once it has caught up.
+*/
+/*static*/ void
+BHttpSession::_StartBodyWriter(Wrapper& request)
+{
+	auto shard = request.shard;
+	auto result = request.result;
+	int fd = request.connection->fd;
+	shard->session->bodyWriters.Submit([shard, result, fd]() {
+		result->WriteQueuedBody(kMaxBodyBacklog / 2,
+			[shard, fd]() { _ResumeReceiving(shard, fd); });
+	});
+}
+
+
+/*!	Check whether the target of \a request is too far behind with writing the
+	body. In that case, the connection of the request stops receiving until the
+	target has caught up.
+*/
+/*static*/ bool
+BHttpSession::_PauseReceiving(Wrapper& request)
+{
+	auto shard = request.shard;
+	int fd = request.connection->fd;
+	if (!request.result->PauseBody(kMaxBodyBacklog,
+			[shard, fd]() { _ResumeReceiving(shard, fd); }))
+		return false;
+	request.connection->readPaused = true;
+	return true;
+}
+
+
+/*!	Let the data thread of \a shard know that the connection \a fd can continue
+	receiving, as the body target has caught up. Called from other threads.
+*/
+/*static*/ void
+BHttpSession::_ResumeReceiving(Shard* shard, int fd)
+{
+	auto loop = &shard->loop;
+	PushOrWait(shard->resumed, int(fd), &shard->session->quitting,
+		[loop]() { loop->Wakeup(); });
+}
+
+
+/*!	Hand the decoder of \a request back for reuse, once the whole body is
+	received.
+*/
+/*static*/ void
+BHttpSession::_FinishBody(Wrapper& request)
+{
+	if (request.decoder)
+		request.shard->decoders.Put(std::move(request.decoder));
+}
+
+
+/*static*/ void
+BHttpSession::_ParseStatus(Wrapper& request)
+{
+	auto& inputBuffer = request.connection->inputBuffer;
+	size_t used = request.responseParser.ParseStatus(inputBuffer.Data(),
+		inputBuffer.Size(), request.status, request.http11Response);
+	if (used == 0)
+		return;
+	inputBuffer.Consume(used);
+	request.requestStatus = Wrapper::kRequestStatusReceived;
 
 	// TODO: EmitDebug
-	std::cout << "Status line received: Code " << request.status.code
-		<< " (" << request.status.text << ")" << std::endl;
 }
 
 /*static*/ void
 BHttpSession::_ParseHeaders(Wrapper& request)
 {
+	auto& inputBuffer = request.connection->inputBuffer;
 	while (true) {
-		auto currentHeader = GetLine(request.inputBuffer);
-		if (!currentHeader)
+		const char* name;
+		const char* value;
+		size_t used = request.responseParser.ParseField(inputBuffer.Data(),
+			inputBuffer.Size(), name, value);
+		if (used == 0)
 			return;
 
-		// An emtpy line means the end of the header section
-		if (currentHeader.value().size() == 0) {
-			std::cout << "End of Headers" << std::endl;
+		// The name and the value point into the receive buffer, which stays
+		// unchanged until more data is received
+		inputBuffer.Consume(used);
+		if (request.responseParser.IsDone()) {
 			request.requestStatus = Wrapper::kRequestHeadersReceived;
 			return;
 		}
+		if (name == nullptr)
+			continue;
 
 		// TODO: EmitDebug
-		std::cout << "Header Received: " << currentHeader.value() << std::endl;
-		request.headers.AddHeader(currentHeader.value().c_str());
+		request.headers.AddHeader(name, value);
+	}
+}
+
+
+/*!	Set the deadline of the HTTP/2 \a connection after its last request is
+	finished.
+
+	The connection is kept open for new requests until the idle timeout of the
+	connection pool expires. A connection that is not open yet, or that the
+	server is closing, expires straight away.
+*/
+/*static*/ void
+BHttpSession::_Http2Idle(Shard* shard, Connection& connection)
+{
+	if (connection.state != Connection::kOpen)
+		connection.closing = true;
+	connection.deadline = system_time();
+	if (connection.state == Connection::kOpen && !connection.closing
+		&& !connection.http2->IsGoingAway()) {
+		connection.deadline += shard->session->connectionPool.IdleTimeout();
+	}
+	shard->timers.Schedule(connection.timer, connection.deadline);
+}
+
+
+/*!	Write the frames of the HTTP/2 \a connection until the socket would block.
+
+	Streams are opened for the waiting requests as far as the server allows
+	concurrent streams. The request bodies are sent as far as the flow control
+	windows allow; the pending frames are written before more body data is
+	added, so that the output stays small.
+*/
+/*static*/ void
+BHttpSession::_Http2Write(Shard* shard, Connection& connection)
+{
+	auto& http2 = *connection.http2;
+	while (connection.sending != connection.requests.end()
+		&& http2.CanOpenStream()) {
+		auto& request = *connection.sending;
+		connection.sending++;
+		_Http2OpenStream(connection, request);
+	}
+
+	while (true) {
+		while (http2.HasOutput()) {
+			size_t size;
+			const char* output = http2.Output(size);
+			ssize_t bytesWritten = connection.socket->Write(output, size);
+			if (bytesWritten == B_WOULD_BLOCK)
+				return;
+			if (bytesWritten < 0)
+				throw BError(bytesWritten, "Error writing data to host");
+			http2.OutputWritten(bytesWritten);
+		}
+
+		bool queued = false;
+		for (auto it = connection.requests.begin(); it != connection.requests.end();) {
+			auto& request = *it++;
+			if (request.requestStatus == Wrapper::kRequestSending)
+				queued |= _Http2WriteBody(shard, connection, request);
+		}
+		if (!queued)
+			return;
+	}
+}
+
+
+/*!	Open a stream for \a request on the HTTP/2 \a connection, and queue its
+	request headers.
+*/
+/*static*/ void
+BHttpSession::_Http2OpenStream(Connection& connection, Wrapper& request)
+{
+	const auto& httpRequest = request.request;
+	const auto& url = httpRequest.fUrl;
+
+	// TODO: proxy
+	HpackHeaderList headers;
+	headers.reserve(10);
+	headers.emplace_back(":method", httpRequest.fRequestMethod.Method());
+	headers.emplace_back(":scheme", "http");
+	std::string authority(url.Host().String());
+	if (url.HasPort() && url.Port() != 80)
+		authority.append(":").append(std::to_string(url.Port()));
+	headers.emplace_back(":authority", std::move(authority));
+	std::string path("/");
+	if (url.HasPath() && url.Path().Length() > 0)
+		path = url.Path().String();
+	if (url.HasRequest())
+		path.append("?").append(url.Request().String());
+	headers.emplace_back(":path", std::move(path));
+	headers.emplace_back("accept", "*/*");
+	headers.emplace_back("accept-encoding",
+		HttpContentDecoderPool::AcceptEncoding());
+
+	if (httpRequest.fOptUserAgent.Length() > 0)
+		headers.emplace_back("user-agent", httpRequest.fOptUserAgent.String());
+	if (httpRequest.fOptReferer.Length() > 0)
+		headers.emplace_back("referer", httpRequest.fOptReferer.String());
+
+	// The DATA frames mark the end of a body of unknown size
+	bool hasBody = httpRequest.fOptInputData != nullptr;
+	if (hasBody) {
+		if (httpRequest.fOptInputDataSize >= 0) {
+			headers.emplace_back("content-length",
+				std::to_string(httpRequest.fOptInputDataSize));
+		}
+		headers.emplace_back("content-type",
+			httpRequest.fOptInputDataType.String());
+	}
+
+	request.stream = connection.http2->OpenStream(headers, !hasBody);
+	connection.streams.emplace(request.stream, &request);
+	request.bodyBytesSent = 0;
+	request.sendEnd = !hasBody;
+	request.requestStatus = hasBody
+		? Wrapper::kRequestSending : Wrapper::kRequestSent;
+	request.responseStart = system_time();
+}
+
+
+/*!	Queue the next segment of the body of \a request on the HTTP/2
+	\a connection, as far as the flow control allows.
+
+	When the body cannot be read, only the stream of the request is reset; the
+	other streams on the connection carry on. Returns true when a frame was
+	queued.
+*/
+/*static*/ bool
+BHttpSession::_Http2WriteBody(Shard* shard, Connection& connection,
+	Wrapper& request)
+{
+	auto& http2 = *connection.http2;
+	const auto& httpRequest = request.request;
+	bool sizeKnown = httpRequest.fOptInputDataSize >= 0;
+	size_t size = std::min(http2.SendWindow(request.stream), kBodySegmentSize);
+	if (sizeKnown) {
+		size = std::min((off_t)size,
+			httpRequest.fOptInputDataSize - request.bodyBytesSent);
+		if (size == 0 && request.bodyBytesSent < httpRequest.fOptInputDataSize)
+			return false;
+	} else if (size == 0)
+		return false;
+
+	try {
+		request.bodyBuffer.resize(size);
+		ssize_t bytesRead = 0;
+		if (size > 0) {
+			bytesRead = httpRequest.fOptInputData->Read(request.bodyBuffer.data(),
+				size);
+			if (bytesRead < 0)
+				throw BError(bytesRead, "Error reading the request body");
+		}
+		request.bodyBytesSent += bytesRead;
+
+		request.sendEnd = sizeKnown
+			? request.bodyBytesSent == httpRequest.fOptInputDataSize
+			: bytesRead == 0;
+		if (!request.sendEnd && bytesRead == 0) {
+			throw BError(B_IO_ERROR,
+				"Request body is shorter than the announced size");
+		}
+		http2.SendData(request.stream, request.bodyBuffer.data(), bytesRead,
+			request.sendEnd);
+		request.UpdateProgress(request.uploadProgress, request.bodyBytesSent,
+			httpRequest.fOptInputDataSize);
+		if (request.sendEnd) {
+			request.requestStatus = Wrapper::kRequestSent;
+			request.responseStart = system_time();
+		}
+	} catch (BError& e) {
+		http2.ResetStream(request.stream);
+		request.result->SetError(e);
+		_DropRequest(shard, connection, request, false);
+		if (connection.requests.empty())
+			_Http2Idle(shard, connection);
+	}
+	return true;
+}
+
+
+/*!	Receive the frames on the HTTP/2 \a connection until the socket would
+	block or the read budget is used up, and pass what happened on to the
+	requests on the streams.
+
+	The connection stays open when all the requests are finished.
+*/
+/*static*/ bool
+BHttpSession::_Http2Read(Shard* shard, Connection& connection)
+{
+	bool active = !connection.requests.empty();
+	auto& inputBuffer = connection.inputBuffer;
+	std::vector<Http2Event> events;
+	while (!connection.readPaused) {
+		ssize_t bytesRead = _ReadSocket(shard, connection);
+		if (bytesRead == B_WOULD_BLOCK)
+			break;
+		if (bytesRead == 0)
+			throw BError(B_IO_ERROR, kConnectionClosedMessage);
+
+		// The framing layer keeps what it needs of the data, and the events
+		// only refer to it until the next read
+		events.clear();
+		connection.http2->Receive(reinterpret_cast<const uint8*>(inputBuffer.Data()),
+			inputBuffer.Size(), events);
+		for (auto& event: events)
+			_Http2Event(shard, connection, event);
+		inputBuffer.Clear();
+	}
+
+	if (active && connection.requests.empty())
+		_Http2Idle(shard, connection);
+	return true;
+}
+
+
+/*!	Pass \a event on the HTTP/2 \a connection on to the request on its
+	stream.
+
+	Errors in the response to a request only reset the stream of the request.
+*/
+/*static*/ void
+BHttpSession::_Http2Event(Shard* shard, Connection& connection,
+	Http2Event& event)
+{
+	if (event.type == Http2Event::kGoAway) {
+		// The server did not process the streams after the last one that it
+		// reports, so they can be sent again on a new connection, whatever
+		// their method (RFC 9113, section 6.8)
+		connection.closing = true;
+		std::list<Wrapper> unprocessed;
+		for (auto it = connection.requests.begin(); it != connection.requests.end();) {
+			auto current = it++;
+			if (current->stream != 0 && current->stream <= event.stream)
+				continue;
+			if (current == connection.sending)
+				connection.sending = it;
+			connection.streams.erase(current->stream);
+			unprocessed.splice(unprocessed.end(), connection.requests, current);
+		}
+		for (auto& request: unprocessed) {
+			_Resend(shard, request,
+				BError(B_IO_ERROR, "Connection was closed by the server"));
+		}
+		return;
+	}
+
+	auto stream = connection.streams.find(event.stream);
+	if (stream == connection.streams.end()) {
+		// The request was cancelled
+		return;
+	}
+	auto& request = *stream->second;
+	auto& http2 = *connection.http2;
+	bool stop = false;
+
+	if (event.type == Http2Event::kReset) {
+		if (event.errorCode == Http2Connection::kRefusedStream) {
+			// The server did not process the request
+			auto it = std::find_if(connection.requests.begin(),
+				connection.requests.end(),
+				[&request](const Wrapper& entry) { return &entry == &request; });
+			connection.streams.erase(stream);
+			std::list<Wrapper> refused;
+			refused.splice(refused.end(), connection.requests, it);
+			_Resend(shard, refused.front(),
+				BError(B_IO_ERROR, "Request was refused by the server"));
+		} else {
+			request.result->SetError(
+				BError(B_IO_ERROR, "Request was reset by the server"));
+			_DropRequest(shard, connection, request, false);
+		}
+		return;
+	}
+
+	try {
+		if (event.type == Http2Event::kHeaders
+			&& request.requestStatus < Wrapper::kRequestHeadersReceived) {
+			int16 code = 0;
+			for (const auto& [name, value]: event.headers) {
+				if (name == ":status")
+					code = atoi(value.c_str());
+			}
+			if (code == 0)
+				throw BError(B_BAD_DATA, "Response without status");
+			if (BHttpRequest::IsInformationalStatusCode(code)) {
+				// The final response follows
+				return;
+			}
+
+			request.status.code = code;
+			request.requestStatus = Wrapper::kRequestStatusReceived;
+			if (IsTransientStatus(code) && request.CanRetry()
+				&& shard->session->TakeFromRetryBudget()) {
+				// The response is not reported; the stream is reset, and the
+				// request is tried again
+				http2.ResetStream(request.stream);
+				auto it = std::find_if(connection.requests.begin(),
+					connection.requests.end(),
+					[&request](const Wrapper& entry) { return &entry == &request; });
+				if (it == connection.sending)
+					connection.sending++;
+				connection.streams.erase(stream);
+				std::list<Wrapper> retried;
+				retried.splice(retried.end(), connection.requests, it);
+				retried.front().retryResponse = true;
+				_FailRequest(shard, retried.front(),
+					BError(B_IO_ERROR, "Server cannot handle the request now"));
+				return;
+			}
+
+			for (const auto& [name, value]: event.headers) {
+				if (name[0] != ':')
+					request.headers.AddHeader(name.c_str(), value.c_str());
+			}
+			request.requestStatus = Wrapper::kRequestHeadersReceived;
+			if (request.CheckRedirect()) {
+				// The rest of the stream is not needed
+				if (!event.endStream)
+					http2.ResetStream(request.stream);
+				_FollowRedirect(shard, connection, request, true);
+				return;
+			}
+			request.result->SetStatus(BHttpStatus(request.status));
+			request.result->SetHeaders(BHttpHeaders(request.headers));
+			_SetupDecompression(request);
+
+			if (request.request.fOptStopOnError
+				&& code >= B_HTTP_STATUS_CLASS_CLIENT_ERROR) {
+				// we will not continue anymore
+				stop = true;
+			}
+		} else if (event.type == Http2Event::kData) {
+			_WriteBody(request, reinterpret_cast<const char*>(event.data),
+				event.size);
+			// This holds back all the streams on the connection
+			_PauseReceiving(request);
+		}
+		// Trailing headers are ignored
+
+		if (request.result->CanCancel()) {
+			http2.ResetStream(request.stream);
+			_DropRequest(shard, connection, request, std::nullopt);
+			return;
+		}
+		if (!event.endStream && !stop)
+			return;
+
+		_FinishBody(request);
+		request.receiveEnd = true;
+		request.parseEnd = true;
+		request.CompleteBody();
+	} catch (BError& e) {
+		http2.ResetStream(request.stream);
+		request.result->SetError(e);
+		_DropRequest(shard, connection, request, false);
+		return;
 	}
+
+	// A response may come before the whole request body is sent
+	if (stop)
+		http2.ResetStream(request.stream);
+	else if (!request.sendEnd)
+		http2.ResetStream(request.stream, Http2Connection::kNoError);
+	_DropRequest(shard, connection, request, std::nullopt);
 }
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _HTTP_SOCKET_H_
+#define _HTTP_SOCKET_H_
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <type_traits>
+#include <unistd.h>
+
+#include <NetworkAddress.h>
+#include <SecureSocket.h>
+#include <Socket.h>
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+/*!	Socket that supports a non-blocking connect.
+
+	BSocket::Connect() blocks until the connection is established (or the
+	timeout expires). This class opens the socket in non-blocking mode, so that
+	the connection can be monitored by the event loop for writability, after
+	which FinishConnect() checks the outcome.
+
+	For secure sockets, the TLS handshake is done by Handshake(). The
+	BSecureSocket API only supports a blocking handshake, so the socket is
+	switched to blocking mode with a timeout for the duration of the handshake.
+	It should therefore not be called from the event loop.
+*/
+template<class Base>
+class AsyncConnectSocket : public Base {
+public:
+	status_t StartConnect(const BNetworkAddress& peer)
+	{
+		this->Disconnect();
+		int fd = socket(peer.Family(), SOCK_STREAM, 0);
+		if (fd < 0)
+			return errno;
+		this->fSocket = fd;
+		this->fInitStatus = B_OK;
+
+		status_t status = _SetBlocking(false);
+		if (status != B_OK)
+			return status;
+
+		if (connect(fd, peer, peer.Length()) != 0 && errno != EINPROGRESS)
+			return errno;
+		this->fPeer = peer;
+		return B_OK;
+	}
+
+	status_t FinishConnect()
+	{
+		int error = 0;
+		socklen_t length = sizeof(error);
+		if (getsockopt(this->fSocket, SOL_SOCKET, SO_ERROR, &error, &length) != 0)
+			return errno;
+		if (error != 0)
+			return error;
+		this->fIsConnected = true;
+		return B_OK;
+	}
+
+	status_t Handshake(const char* host, bigtime_t timeout)
+	{
+		if constexpr (std::is_base_of_v<BSecureSocket, Base>) {
+			status_t status = _SetBlocking(true);
+			if (status == B_OK)
+				status = this->SetTimeout(timeout);
+			if (status == B_OK)
+				status = this->_SetupConnect(host);
+			if (status == B_OK)
+				status = _SetBlocking(false);
+			return status;
+		} else
+			return B_OK;
+	}
+
+private:
+	status_t _SetBlocking(bool blocking)
+	{
+		int flags = fcntl(this->fSocket, F_GETFL, 0);
+		if (flags == -1)
+			return errno;
+		flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+		if (fcntl(this->fSocket, F_SETFL, flags) != 0)
+			return errno;
+		return B_OK;
+	}
+};
+
+
+typedef AsyncConnectSocket<BSocket> HttpSocket;
+typedef AsyncConnectSocket<BSecureSocket> HttpSecureSocket;
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _HTTP_SOCKET_H_
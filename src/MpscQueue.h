@@ -0,0 +1,107 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _MPSC_QUEUE_H_
+#define _MPSC_QUEUE_H_
+
+
+#include <memory>
+#include <optional>
+
+#include <OS.h>
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+/*!	Bounded lock-free queue for multiple producers and a single consumer.
+
+	Each slot carries a sequence number that tells whether it is free for the
+	producer that claims that position, or filled for the consumer. Producers
+	claim a position with a compare-and-swap on the enqueue position; the
+	consumer is the only one that touches the dequeue position, so it does
+	not need any atomic read-modify-write operations at all.
+
+	The capacity is rounded up to a power of two. Push() fails when the queue
+	is full, in which case the value is left untouched.
+*/
+template<typename T>
+class MpscQueue {
+public:
+	MpscQueue(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+		fMask = size - 1;
+		fCells = std::make_unique<Cell[]>(size);
+		for (size_t i = 0; i < size; i++)
+			fCells[i].sequence = i;
+	}
+
+	// Producers (any thread)
+	bool Push(T&& value)
+	{
+		int64 position = atomic_get64(&fEnqueuePosition);
+		Cell* cell;
+		while (true) {
+			cell = &fCells[position & fMask];
+			int64 difference = atomic_get64(&cell->sequence) - position;
+			if (difference == 0) {
+				int64 previous = atomic_test_and_set64(&fEnqueuePosition,
+					position + 1, position);
+				if (previous == position)
+					break;
+				position = previous;
+			} else if (difference < 0) {
+				// the consumer has not freed this slot yet
+				return false;
+			} else
+				position = atomic_get64(&fEnqueuePosition);
+		}
+
+		cell->value.emplace(std::move(value));
+		atomic_set64(&cell->sequence, position + 1);
+		return true;
+	}
+
+	// Consumer (one thread only)
+	std::optional<T> Pop()
+	{
+		Cell& cell = fCells[fDequeuePosition & fMask];
+		if (atomic_get64(&cell.sequence) != fDequeuePosition + 1)
+			return std::nullopt;
+
+		std::optional<T> value = std::move(cell.value);
+		cell.value.reset();
+		atomic_set64(&cell.sequence, fDequeuePosition + fMask + 1);
+		fDequeuePosition++;
+		return value;
+	}
+
+private:
+	struct Cell {
+		int64				sequence;
+		std::optional<T>	value;
+	};
+
+	std::unique_ptr<Cell[]>	fCells;
+	int64					fMask;
+	// keep the producer and consumer positions on separate cache lines
+	alignas(64) int64		fEnqueuePosition = 0;
+	alignas(64) int64		fDequeuePosition = 0;
+};
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _MPSC_QUEUE_H_
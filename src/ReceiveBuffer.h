@@ -0,0 +1,97 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _RECEIVE_BUFFER_H_
+#define _RECEIVE_BUFFER_H_
+
+
+#include <memory>
+#include <string.h>
+
+#include <SupportDefs.h>
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+/*!	Contiguous receive buffer of a connection.
+
+	The socket reads straight into the free space at the end of the buffer,
+	and the parsers work on the received data where it is: they consume it by
+	advancing the read position. The unconsumed data is moved to the start of
+	the buffer only when more space is needed at the end; usually that is no
+	more than the start of a line, as everything else has been consumed. The
+	buffer only grows when the unconsumed data itself does not fit.
+*/
+class ReceiveBuffer {
+public:
+	static	const size_t		kDefaultCapacity = 16384;
+
+	ReceiveBuffer(size_t capacity = kDefaultCapacity)
+		:
+		fCapacity(capacity)
+	{
+	}
+
+	// Received data
+	const char* Data() const { return fData.get() + fStart; }
+	char* Data() { return fData.get() + fStart; }
+	size_t Size() const { return fEnd - fStart; }
+
+	void Consume(size_t size)
+	{
+		fStart += size;
+		if (fStart == fEnd)
+			fStart = fEnd = 0;
+	}
+
+	void Clear() { fStart = fEnd = 0; }
+
+	// Free space to receive into; there is room for at least \a minSpace
+	// bytes
+	char* Space(size_t minSpace)
+	{
+		if (!fData)
+			fData = std::make_unique<char[]>(fCapacity);
+		if (fCapacity - fEnd >= minSpace)
+			return fData.get() + fEnd;
+
+		size_t size = Size();
+		if (size + minSpace > fCapacity) {
+			while (size + minSpace > fCapacity)
+				fCapacity *= 2;
+			auto data = std::make_unique<char[]>(fCapacity);
+			memcpy(data.get(), Data(), size);
+			fData = std::move(data);
+		} else
+			memmove(fData.get(), Data(), size);
+		fStart = 0;
+		fEnd = size;
+		return fData.get() + fEnd;
+	}
+
+	size_t SpaceSize() const { return fCapacity - fEnd; }
+
+	// Add \a size bytes that were received into Space()
+	void Commit(size_t size) { fEnd += size; }
+
+private:
+	std::unique_ptr<char[]>		fData;
+	size_t						fCapacity;
+	size_t						fStart = 0;
+	size_t						fEnd = 0;
+};
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _RECEIVE_BUFFER_H_
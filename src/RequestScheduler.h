@@ -0,0 +1,169 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _REQUEST_SCHEDULER_H_
+#define _REQUEST_SCHEDULER_H_
+
+
+#include <algorithm>
+#include <deque>
+#include <optional>
+#include <utility>
+
+#include <OS.h>
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+/*!	Queue that hands out its values by priority.
+
+	Values are kept in a FIFO per priority level, so values of the same
+	priority keep their order. Values age while they wait: for every
+	\a agingInterval that a value has waited, it counts as one level higher,
+	so that a steady stream of high-priority values cannot keep the others
+	waiting forever. Of two values with the same effective priority, the one
+	from the higher level goes first.
+
+	Push() returns the position of the value, by which Remove() takes it out
+	of the queue in constant time. A removed value leaves a gap in its level,
+	which is dropped once it reaches the front. Positions are not reused.
+
+	The queue is not locked; it is owned by a single thread.
+*/
+template<typename T, int Levels>
+class RequestScheduler {
+public:
+	RequestScheduler(bigtime_t agingInterval)
+		:
+		fAgingInterval(agingInterval)
+	{
+	}
+
+	// Identifies a value in the queue
+	struct Position {
+		int		level;
+		uint64	sequence;
+	};
+
+	Position Push(T&& value, int priority, bigtime_t now)
+	{
+		priority = std::clamp(priority, 0, Levels - 1);
+		auto& level = fLevels[priority];
+		Position position{priority, level.first + level.entries.size()};
+		level.entries.push_back({std::move(value), now});
+		fSize++;
+		return position;
+	}
+
+	std::optional<T> Pop(bigtime_t now)
+	{
+		bigtime_t priority;
+		int level = _Next(now, priority);
+		if (level < 0)
+			return std::nullopt;
+
+		std::optional<T> value(std::move(fLevels[level].entries.front().value));
+		fLevels[level].entries.pop_front();
+		fLevels[level].first++;
+		fSize--;
+		_DropGaps(fLevels[level]);
+		return value;
+	}
+
+	// The value that Pop() would return
+	const T* Next(bigtime_t now) const
+	{
+		bigtime_t priority;
+		int level = _Next(now, priority);
+		if (level < 0)
+			return nullptr;
+		return &*fLevels[level].entries.front().value;
+	}
+
+	// The effective priority of the value that Pop() would return
+	std::optional<bigtime_t> NextPriority(bigtime_t now) const
+	{
+		bigtime_t priority;
+		if (_Next(now, priority) < 0)
+			return std::nullopt;
+		return priority;
+	}
+
+	// Take out the value at \a position, if it is still in the queue
+	std::optional<T> Remove(const Position& position)
+	{
+		auto& level = fLevels[position.level];
+		if (position.sequence < level.first
+			|| position.sequence - level.first >= level.entries.size())
+			return std::nullopt;
+
+		auto& entry = level.entries[position.sequence - level.first];
+		std::optional<T> value(std::move(entry.value));
+		if (!value)
+			return std::nullopt;
+		entry.value.reset();
+		fSize--;
+		_DropGaps(level);
+		return value;
+	}
+
+	bool IsEmpty() const { return fSize == 0; }
+	size_t Size() const { return fSize; }
+
+private:
+	int _Next(bigtime_t now, bigtime_t& bestPriority) const
+	{
+		int best = -1;
+		for (int level = Levels - 1; level >= 0; level--) {
+			if (fLevels[level].entries.empty())
+				continue;
+			bigtime_t priority = level
+				+ (now - fLevels[level].entries.front().time) / fAgingInterval;
+			if (best < 0 || priority > bestPriority) {
+				best = level;
+				bestPriority = priority;
+			}
+		}
+		return best;
+	}
+
+	struct Entry {
+		std::optional<T>	value;
+			// empty when the value was removed
+		bigtime_t			time;
+	};
+
+	struct Level {
+		std::deque<Entry>	entries;
+		uint64				first = 0;
+			// sequence number of the first entry
+	};
+
+	// Keep the first entry of the level a value
+	static void _DropGaps(Level& level)
+	{
+		while (!level.entries.empty() && !level.entries.front().value) {
+			level.entries.pop_front();
+			level.first++;
+		}
+	}
+
+	Level							fLevels[Levels];
+	size_t							fSize = 0;
+	bigtime_t						fAgingInterval;
+};
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _REQUEST_SCHEDULER_H_
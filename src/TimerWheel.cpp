@@ -0,0 +1,201 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+
+#include "TimerWheel.h"
+
+#include <algorithm>
+
+using namespace BPrivate::Network;
+
+
+void
+TimerWheel::Timer::Cancel()
+{
+	if (fWheel != nullptr)
+		fWheel->_Unlink(*this);
+}
+
+
+TimerWheel::TimerWheel(bigtime_t resolution)
+	:
+	fResolution(resolution),
+	fTick(system_time() / resolution)
+{
+}
+
+
+TimerWheel::~TimerWheel()
+{
+	for (auto& level: fSlots) {
+		for (auto& slot: level) {
+			while (slot != nullptr)
+				_Unlink(*slot);
+		}
+	}
+	while (fExpired != nullptr)
+		_Unlink(*fExpired);
+}
+
+
+void
+TimerWheel::Schedule(Timer& timer, bigtime_t when)
+{
+	if (timer.fWheel != nullptr)
+		_Unlink(timer);
+
+	// Round up, so that the timer never expires early
+	timer.fWhen = when;
+	timer.fTick = std::max((uint64)((std::max(when, (bigtime_t)0)
+		+ fResolution - 1) / fResolution), fTick);
+	timer.fWheel = this;
+	fCount++;
+	_Insert(timer);
+}
+
+
+void
+TimerWheel::Advance(bigtime_t now)
+{
+	uint64 target = now / fResolution;
+	for (; fTick <= target; fTick++) {
+		if (fCount == fExpiredCount) {
+			// Nothing left on the wheel
+			fTick = target + 1;
+			break;
+		}
+
+		// Bring the timers of a higher level down when the levels below it
+		// turn over
+		for (int level = 1; level < kLevels; level++) {
+			if ((fTick & ((1ULL << (level * kSlotBits)) - 1)) != 0)
+				break;
+			_Cascade(level);
+		}
+
+		Timer*& slot = fSlots[0][fTick & kSlotMask];
+		while (slot != nullptr) {
+			Timer& timer = *slot;
+			_Unlink(timer);
+			timer.fWheel = this;
+			timer.fExpired = true;
+			fCount++;
+			fExpiredCount++;
+			_Link(fExpired, timer);
+		}
+	}
+}
+
+
+TimerWheel::Timer*
+TimerWheel::NextExpired()
+{
+	Timer* timer = fExpired;
+	if (timer != nullptr)
+		_Unlink(*timer);
+	return timer;
+}
+
+
+/*!	The next tick on which a timer expires, or on which timers are moved down
+	from a higher level. This looks at no more than the slots of one turn of
+	each level.
+*/
+bigtime_t
+TimerWheel::NextTimeout(bigtime_t now) const
+{
+	if (fExpired != nullptr)
+		return 0;
+	if (fCount == 0)
+		return B_INFINITE_TIMEOUT;
+
+	uint64 next = UINT64_MAX;
+	for (uint64 i = 0; i < kSlots; i++) {
+		if (fSlots[0][(fTick + i) & kSlotMask] != nullptr) {
+			next = fTick + i;
+			break;
+		}
+	}
+	for (int level = 1; level < kLevels; level++) {
+		int shift = level * kSlotBits;
+		// The first tick at which this level turns over
+		uint64 tick = ((fTick + (1ULL << shift) - 1) >> shift) << shift;
+		for (uint64 i = 0; i < kSlots && tick < next; i++,
+				tick += 1ULL << shift) {
+			if (fSlots[level][(tick >> shift) & kSlotMask] != nullptr) {
+				next = tick;
+				break;
+			}
+		}
+	}
+
+	if (next == UINT64_MAX)
+		return B_INFINITE_TIMEOUT;
+	bigtime_t when = (bigtime_t)next * fResolution;
+	return std::max(when - now, (bigtime_t)0);
+}
+
+
+void
+TimerWheel::_Insert(Timer& timer)
+{
+	uint64 delta = timer.fTick - fTick;
+	for (int level = 0; level < kLevels; level++) {
+		int shift = level * kSlotBits;
+		if (delta < (kSlots << shift)) {
+			_Link(fSlots[level][(timer.fTick >> shift) & kSlotMask], timer);
+			return;
+		}
+	}
+
+	// Too far away; park the timer in the last slot that the wheel reaches
+	int shift = (kLevels - 1) * kSlotBits;
+	uint64 tick = fTick + (kSlots << shift) - 1;
+	_Link(fSlots[kLevels - 1][(tick >> shift) & kSlotMask], timer);
+}
+
+
+void
+TimerWheel::_Link(Timer*& head, Timer& timer)
+{
+	timer.fNext = head;
+	if (head != nullptr)
+		head->fLink = &timer.fNext;
+	timer.fLink = &head;
+	head = &timer;
+}
+
+
+void
+TimerWheel::_Unlink(Timer& timer)
+{
+	*timer.fLink = timer.fNext;
+	if (timer.fNext != nullptr)
+		timer.fNext->fLink = timer.fLink;
+	timer.fNext = nullptr;
+	timer.fLink = nullptr;
+	timer.fWheel = nullptr;
+	if (timer.fExpired)
+		fExpiredCount--;
+	timer.fExpired = false;
+	fCount--;
+}
+
+
+/*!	Move the timers of the current slot of \a level to the levels below. */
+void
+TimerWheel::_Cascade(int level)
+{
+	Timer* timer = fSlots[level][(fTick >> (level * kSlotBits)) & kSlotMask];
+	fSlots[level][(fTick >> (level * kSlotBits)) & kSlotMask] = nullptr;
+	while (timer != nullptr) {
+		Timer* next = timer->fNext;
+		_Insert(*timer);
+		timer = next;
+	}
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+
+#include <OS.h>
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+/*!	Hierarchical timer wheel.
+
+	Timers are kept in slots by the tick on which they expire. The first level
+	has a slot for each of the next 64 ticks, every next level has slots that
+	span the whole range of the level below it. When the wheel comes to a slot
+	of a higher level, its timers are moved down to the levels below, until
+	they end up in the first level where they expire. A timer is moved down at
+	most once per level, so scheduling, cancelling and expiring a timer costs
+	O(1), however many timers there are. Timers that are further away than the
+	wheel reaches are parked in the last slot, and put back when they come up.
+
+	The timers are embedded in the objects that they belong to; a timer is
+	cancelled when it is destroyed. The wheel is not locked; it is owned by a
+	single thread, and so are its timers.
+*/
+class TimerWheel {
+public:
+	static	const bigtime_t		kDefaultResolution = 1000;
+
+	class Timer {
+	public:
+								Timer(void* cookie = nullptr, uint32 type = 0)
+									: cookie(cookie), type(type) {}
+								~Timer() { Cancel(); }
+
+		// A timer that is moved is not scheduled; the original timer stays on
+		// the wheel until it is cancelled or destroyed.
+								Timer(Timer&& other)
+									: cookie(other.cookie), type(other.type) {}
+				Timer&			operator=(Timer&& other)
+									{ cookie = other.cookie; type = other.type;
+										return *this; }
+
+				bool			IsScheduled() const { return fLink != nullptr; }
+				bigtime_t		When() const { return fWhen; }
+				void			Cancel();
+
+		// The object that the timer belongs to, and what kind of object it is
+		// when an owner uses timers for several things
+				void*			cookie;
+				uint32			type;
+
+	private:
+		friend class TimerWheel;
+
+				TimerWheel*		fWheel = nullptr;
+				Timer*			fNext = nullptr;
+				Timer**			fLink = nullptr;
+				bigtime_t		fWhen = 0;
+				uint64			fTick = 0;
+				bool			fExpired = false;
+	};
+
+								TimerWheel(
+									bigtime_t resolution = kDefaultResolution);
+								~TimerWheel();
+
+								TimerWheel(const TimerWheel&) = delete;
+				TimerWheel&		operator=(const TimerWheel&) = delete;
+
+	// (Re)schedule \a timer to expire at \a when; it expires no earlier than
+	// that, and at most one resolution later
+			void				Schedule(Timer& timer, bigtime_t when);
+
+	// Move the timers that have expired at \a now to the expired list, and
+	// take them off one by one. A timer that is cancelled in the meantime is
+	// not returned.
+			void				Advance(bigtime_t now);
+			Timer*				NextExpired();
+
+	// Time from \a now until the wheel has to be advanced; B_INFINITE_TIMEOUT
+	// when there are no timers
+			bigtime_t			NextTimeout(bigtime_t now) const;
+
+			size_t				CountTimers() const { return fCount; }
+
+private:
+	static	const int			kLevels = 4;
+	static	const int			kSlotBits = 6;
+	static	const uint64		kSlots = 1 << kSlotBits;
+	static	const uint64		kSlotMask = kSlots - 1;
+
+			void				_Insert(Timer& timer);
+			void				_Link(Timer*& head, Timer& timer);
+			void				_Unlink(Timer& timer);
+			void				_Cascade(int level);
+
+			bigtime_t			fResolution;
+			uint64				fTick;
+				// the next tick to process
+			size_t				fCount = 0;
+			size_t				fExpiredCount = 0;
+			Timer*				fSlots[kLevels][kSlots] = {};
+			Timer*				fExpired = nullptr;
+};
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _TIMER_WHEEL_H_
@@ -0,0 +1,150 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "AutoLocker.h"
+
+using namespace BPrivate::Network;
+
+
+static const bigtime_t kIdleThreadTimeout = 10000000;
+	// time after which an idle thread above the minimum exits
+
+
+WorkerPool::WorkerPool(const char* name, int32 threadCount,
+	int32 maxThreadCount)
+	:
+	fLock(name),
+	fName(name),
+	fMinThreads(threadCount),
+	fMaxThreads(std::max(threadCount, maxThreadCount))
+{
+	fJobSem = create_sem(0, name);
+	if (fJobSem < 0)
+		throw std::runtime_error("Cannot create worker pool semaphore");
+
+	AutoLocker<BLocker> locker(fLock);
+	for (int32 i = 0; i < threadCount; i++) {
+		if (_StartThread() != B_OK)
+			throw std::runtime_error("Cannot create worker thread");
+	}
+}
+
+
+WorkerPool::~WorkerPool()
+{
+	// Deleting the semaphore makes the workers finish the remaining jobs and
+	// exit. Threads that exited when they were idle have taken themselves off
+	// the list.
+	delete_sem(fJobSem);
+	fLock.Lock();
+	std::vector<thread_id> threads = fThreads;
+	fLock.Unlock();
+	status_t threadResult;
+	for (auto thread: threads)
+		wait_for_thread(thread, &threadResult);
+}
+
+
+/*!	Queue \a job, and start another thread for it when there are more jobs
+	waiting than there are idle threads to take them.
+*/
+void
+WorkerPool::Submit(std::function<void()> job)
+{
+	AutoLocker<BLocker> locker(fLock);
+	fJobs.push_back(std::move(job));
+	if ((int32)fJobs.size() > fIdleThreads
+		&& (int32)fThreads.size() < fMaxThreads) {
+		// When the thread cannot be started, the job waits for a busy one
+		_StartThread();
+	}
+	release_sem(fJobSem);
+}
+
+
+int32
+WorkerPool::CountThreads()
+{
+	AutoLocker<BLocker> locker(fLock);
+	return fThreads.size();
+}
+
+
+/*!	Start a worker thread. The lock must be held. */
+status_t
+WorkerPool::_StartThread()
+{
+	thread_id thread = spawn_thread(_WorkerThread, fName.c_str(),
+		B_NORMAL_PRIORITY, this);
+	if (thread < 0)
+		return thread;
+	fThreads.push_back(thread);
+	fIdleThreads++;
+	if (resume_thread(thread) != B_OK) {
+		fThreads.pop_back();
+		fIdleThreads--;
+		kill_thread(thread);
+		return B_ERROR;
+	}
+	return B_OK;
+}
+
+
+/*static*/ status_t
+WorkerPool::_WorkerThread(void* arg)
+{
+	WorkerPool* pool = static_cast<WorkerPool*>(arg);
+	bool quitting = false;
+	while (true) {
+		if (!quitting) {
+			auto status = acquire_sem_etc(pool->fJobSem, 1, B_RELATIVE_TIMEOUT,
+				kIdleThreadTimeout);
+			if (status == B_INTERRUPTED)
+				continue;
+			else if (status == B_TIMED_OUT) {
+				// Leave when there are more threads than needed, unless a job
+				// came in just now
+				AutoLocker<BLocker> locker(pool->fLock);
+				if ((int32)pool->fThreads.size() <= pool->fMinThreads
+					|| !pool->fJobs.empty())
+					continue;
+				auto self = std::find(pool->fThreads.begin(),
+					pool->fThreads.end(), find_thread(NULL));
+				pool->fThreads.erase(self);
+				pool->fIdleThreads--;
+				return B_OK;
+			} else if (status != B_OK)
+				quitting = true;
+		}
+
+		pool->fLock.Lock();
+		if (pool->fJobs.empty()) {
+			pool->fLock.Unlock();
+			if (quitting)
+				break;
+			continue;
+		}
+		auto job = std::move(pool->fJobs.front());
+		pool->fJobs.pop_front();
+		pool->fIdleThreads--;
+		pool->fLock.Unlock();
+
+		job();
+
+		pool->fLock.Lock();
+		pool->fIdleThreads++;
+		pool->fLock.Unlock();
+	}
+	return B_OK;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <Locker.h>
+#include <OS.h>
+
+
+namespace BPrivate {
+
+namespace Network {
+
+
+/*!	Small pool of threads for work that can block.
+
+	The session's event loop must never block, but some operations are only
+	available as blocking calls (like the TLS handshake). Those are submitted
+	as jobs to this pool. Jobs are started in the order that they are
+	submitted. When the pool is destroyed, the jobs that are still queued are
+	executed before the threads exit.
+
+	A pool may grow from \a threadCount up to \a maxThreadCount threads: when
+	a job is submitted while all threads are busy, another thread is started
+	for it, so that jobs that block for a long time do not hold up the others.
+	The extra threads exit after they have been idle for a while.
+*/
+class WorkerPool {
+public:
+								WorkerPool(const char* name, int32 threadCount,
+									int32 maxThreadCount = 0);
+								~WorkerPool();
+
+			void				Submit(std::function<void()> job);
+
+			int32				CountThreads();
+
+private:
+	static	status_t			_WorkerThread(void* arg);
+			status_t			_StartThread();
+
+			BLocker				fLock;
+			std::string			fName;
+			std::deque<std::function<void()>> fJobs;
+			sem_id				fJobSem;
+			std::vector<thread_id> fThreads;
+			int32				fMinThreads;
+			int32				fMaxThreads;
+			int32				fIdleThreads = 0;
+};
+
+
+} // namespace Network
+
+} // namespace BPrivate
+
+#endif // _WORKER_POOL_H_
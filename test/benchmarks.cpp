@@ -0,0 +1,1474 @@
+/*
+ * Copyright 2021 Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Niels Sascha Reedijk, niels.reedijk@gmail.com
+ */
+
+// Micro benchmarks for the internal building blocks of the HTTP session.
+// Run without arguments to run all benchmarks, or pass the names of the
+// benchmarks to run.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <HttpHeaders.h>
+#include <HttpRequest.h>
+#include <HttpResult.h>
+#include <HttpSession.h>
+#include <DataIO.h>
+#include <Locker.h>
+#include <Looper.h>
+#include <Messenger.h>
+#include <NetBuffer.h>
+#include <NetServices.h>
+#include <OS.h>
+#include <Url.h>
+
+#include <zlib.h>
+#ifdef BROTLI_ENCODER_ENABLED
+#include <brotli/encode.h>
+#endif
+#ifdef ZSTD_ENABLED
+#include <zstd.h>
+#endif
+
+#include "AutoLocker.h"
+#include "EventLoop.h"
+#include "HostResolver.h"
+#include "HttpChunkedDecoder.h"
+#include "HttpContentDecoder.h"
+#include "HttpResponseParser.h"
+#include "HttpSerializer.h"
+#include "MpscQueue.h"
+#include "ReceiveBuffer.h"
+#include "TimerWheel.h"
+
+using namespace BPrivate::Network;
+
+
+static status_t
+run_function(void* arg)
+{
+	(*static_cast<std::function<void()>*>(arg))();
+	return B_OK;
+}
+
+
+// Run \a function on \a count threads at the same time, and return the time it
+// took until all of them finished.
+static bigtime_t
+run_on_threads(int32 count, std::function<void()> function)
+{
+	std::vector<thread_id> threads;
+	for (int32 i = 0; i < count; i++) {
+		threads.push_back(spawn_thread(run_function, "benchmark",
+			B_NORMAL_PRIORITY, &function));
+	}
+	bigtime_t start = system_time();
+	for (auto thread: threads)
+		resume_thread(thread);
+	for (auto thread: threads) {
+		status_t result;
+		wait_for_thread(thread, &result);
+	}
+	return system_time() - start;
+}
+
+
+static void
+raise_descriptor_limit()
+{
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+}
+
+
+// Measure the cost of a single ready event while an increasing number of idle
+// connections are registered with the event loop.
+void
+benchmark_event_loop()
+{
+	static const int kIterations = 20000;
+	raise_descriptor_limit();
+
+	// The cost only stays flat with the backends that report the ready
+	// descriptors; wait_for_objects() checks all of them on every wait
+	std::cout << "event_loop: cost per ready event (" << EventLoop::Backend()
+		<< ")" << std::endl;
+	for (size_t count: {10, 100, 1000, 10000}) {
+		std::vector<std::array<int, 2>> pairs;
+		pairs.reserve(count);
+		for (size_t i = 0; i < count; i++) {
+			std::array<int, 2> fds;
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds.data()) != 0)
+				break;
+			pairs.push_back(fds);
+		}
+		if (pairs.size() != count) {
+			std::cout << "  " << std::setw(6) << count
+				<< " connections: not enough file descriptors" << std::endl;
+			for (auto& fds: pairs) {
+				close(fds[0]);
+				close(fds[1]);
+			}
+			break;
+		}
+
+		EventLoop loop;
+		for (auto& fds: pairs)
+			loop.Add(fds[0], B_EVENT_READ, &fds);
+
+		std::vector<EventLoop::Event> ready;
+		char byte = 'x';
+		bigtime_t start = system_time();
+		for (int i = 0; i < kIterations; i++) {
+			// spread the activity over all connections
+			auto& fds = pairs[(i * 7919) % count];
+			write(fds[1], &byte, 1);
+			loop.Wait(ready);
+			for (auto& event: ready)
+				read((*static_cast<std::array<int, 2>*>(event.cookie))[0], &byte, 1);
+		}
+		bigtime_t elapsed = system_time() - start;
+
+		std::cout << "  " << std::setw(6) << count << " connections: "
+			<< std::setw(8) << (elapsed * 1000 / kIterations) << " ns/event"
+			<< std::endl;
+
+		for (auto& fds: pairs) {
+			loop.Remove(fds[0]);
+			close(fds[0]);
+			close(fds[1]);
+		}
+	}
+}
+
+
+// Measure the latency that the resolver cache removes from the request path,
+// using a stub lookup function that takes a fixed amount of time.
+void
+benchmark_resolver()
+{
+	static const bigtime_t kLookupTime = 5000;
+	static const int kRequests = 400;
+	static const int kHosts = 8;
+
+	int32 lookups = 0;
+	HostResolver resolver([&lookups](const std::string& host,
+			BNetworkAddress& address, bigtime_t& ttl) {
+		atomic_add(&lookups, 1);
+		snooze(kLookupTime);
+		address.SetToLoopback();
+		ttl = HostResolver::kDefaultTtl;
+		return B_OK;
+	});
+
+	sem_id done = create_sem(0, "benchmark:resolver");
+	auto resolve = [&](const std::string& host) {
+		BNetworkAddress address;
+		auto status = resolver.Resolve(host, 80, address,
+			[done](status_t, const BNetworkAddress&) { release_sem(done); });
+		if (status == B_WOULD_BLOCK)
+			acquire_sem(done);
+	};
+
+	std::cout << "resolver: latency per request (stub lookup of "
+		<< kLookupTime << " us)" << std::endl;
+
+	bigtime_t start = system_time();
+	for (int i = 0; i < kRequests; i++) {
+		resolver.Flush();
+		resolve("host" + std::to_string(i % kHosts));
+	}
+	std::cout << "  uncached: " << std::setw(8)
+		<< (system_time() - start) / kRequests << " us/request" << std::endl;
+
+	start = system_time();
+	for (int i = 0; i < kRequests; i++)
+		resolve("host" + std::to_string(i % kHosts));
+	std::cout << "    cached: " << std::setw(8)
+		<< (system_time() - start) / kRequests << " us/request" << std::endl;
+
+	// Concurrent requests for the same host are merged into one lookup
+	resolver.Flush();
+	int32 lookupsBefore = atomic_get(&lookups);
+	int waiting = 0;
+	for (int i = 0; i < kRequests; i++) {
+		BNetworkAddress address;
+		if (resolver.Resolve("merged", 80, address,
+				[done](status_t, const BNetworkAddress&) { release_sem(done); })
+				== B_WOULD_BLOCK) {
+			waiting++;
+		}
+	}
+	while (waiting-- > 0)
+		acquire_sem(done);
+	std::cout << "    merged: " << kRequests << " concurrent requests, "
+		<< atomic_get(&lookups) - lookupsBefore << " lookup(s)" << std::endl;
+
+	delete_sem(done);
+}
+
+
+// Compare a locked queue with a semaphore release per item, to the lock-free
+// queue with coalesced wakeups, with a single consumer and many producers.
+void
+benchmark_queue()
+{
+	static const int32 kItemsPerProducer = 200000;
+
+	std::cout << "queue: cost per item" << std::endl;
+	for (int32 producers: {1, 2, 4, 8}) {
+		int32 total = producers * kItemsPerProducer;
+		sem_id sem = create_sem(0, "benchmark:queue");
+
+		// Locked queue
+		BLocker lock;
+		std::deque<int32> lockedQueue;
+		int32 received = 0;
+		int32 threads = 0;
+		bigtime_t locked = run_on_threads(producers + 1, [&]() {
+			// the first thread is the consumer
+			if (atomic_add(&threads, 1) == 0) {
+				while (received < total && acquire_sem(sem) == B_OK) {
+					AutoLocker<BLocker> locker(lock);
+					received += lockedQueue.size();
+					lockedQueue.clear();
+				}
+				return;
+			}
+			for (int32 i = 0; i < kItemsPerProducer; i++) {
+				AutoLocker<BLocker> locker(lock);
+				lockedQueue.push_back(i);
+				release_sem(sem);
+			}
+		});
+
+		// Lock-free queue
+		MpscQueue<int32> queue(1024);
+		int32 wakeupPending = 0;
+		received = 0;
+		threads = 0;
+		bigtime_t lockFree = run_on_threads(producers + 1, [&]() {
+			if (atomic_add(&threads, 1) == 0) {
+				while (received < total && acquire_sem(sem) == B_OK) {
+					atomic_set(&wakeupPending, 0);
+					while (queue.Pop())
+						received++;
+				}
+				return;
+			}
+			for (int32 i = 0; i < kItemsPerProducer; i++) {
+				int32 item = i;
+				while (!queue.Push(std::move(item))) {
+					if (atomic_test_and_set(&wakeupPending, 1, 0) == 0)
+						release_sem(sem);
+					snooze(100);
+				}
+				if (atomic_test_and_set(&wakeupPending, 1, 0) == 0)
+					release_sem(sem);
+			}
+		});
+		delete_sem(sem);
+
+		std::cout << "  " << std::setw(2) << producers << " producers: locked "
+			<< std::setw(6) << (locked * 1000 / total) << " ns/item, lock-free "
+			<< std::setw(6) << (lockFree * 1000 / total) << " ns/item"
+			<< std::endl;
+	}
+}
+
+
+// Measure the cost of BHttpSession::AddRequest() when it is called from many
+// threads at the same time. The requests are made to a closed port on the
+// local host, so the session does not do any network traffic to speak of.
+void
+benchmark_add_request()
+{
+	static const int32 kRequestsPerProducer = 2000;
+
+	std::cout << "add_request: cost per submission" << std::endl;
+	for (int32 producers: {1, 2, 4, 8}) {
+		BHttpSession session;
+		bigtime_t elapsed = run_on_threads(producers, [&session]() {
+			auto url = BUrl("http://127.0.0.1:9/");
+			for (int32 i = 0; i < kRequestsPerProducer; i++)
+				session.AddRequest(BHttpRequest::Get(url).value());
+		});
+		std::cout << "  " << std::setw(2) << producers << " producers: "
+			<< std::setw(8)
+			<< (elapsed * 1000 / (producers * kRequestsPerProducer))
+			<< " ns/request" << std::endl;
+	}
+}
+
+
+// Serialize a request head the way BHttpSession did before HttpSerializer, as
+// a reference for benchmark_serializer().
+static std::string
+serialize_with_stream(const BUrl& url, const BString& userAgent)
+{
+	std::stringstream headerStream;
+	headerStream << "GET" << ' ' << url.Path().String() << " HTTP/1.1\r\n";
+
+	BHttpHeaders outputHeaders;
+	outputHeaders.AddHeader("Host", url.Host().String());
+	outputHeaders.AddHeader("Accept", "*/*");
+	outputHeaders.AddHeader("Accept-Encoding", "gzip");
+	outputHeaders.AddHeader("User-Agent", userAgent.String());
+	for (int32 i = 0; i < outputHeaders.CountHeaders(); i++)
+		headerStream << outputHeaders.HeaderAt(i).Header() << "\r\n";
+	headerStream << "\r\n";
+	return headerStream.str();
+}
+
+
+// Measure the number of request heads that can be serialized per second.
+void
+benchmark_serializer()
+{
+	static const int32 kIterations = 200000;
+	BUrl url("http://www.example.com/path/to/some/resource.png");
+	BString userAgent("Services Kit (Haiku)");
+	size_t totalSize = 0;
+
+	bigtime_t start = system_time();
+	for (int32 i = 0; i < kIterations; i++)
+		totalSize += serialize_with_stream(url, userAgent).size();
+	bigtime_t stream = system_time() - start;
+
+	std::string buffer;
+	start = system_time();
+	for (int32 i = 0; i < kIterations; i++) {
+		HttpSerializer serializer(buffer);
+		serializer.RequestLine("GET", url, B_HTTP_11);
+		serializer.Host(url, 80);
+		serializer.Header("Accept", "*/*");
+		serializer.Header("Accept-Encoding", "gzip");
+		serializer.Header("User-Agent", userAgent);
+		serializer.End();
+		totalSize -= buffer.size();
+	}
+	bigtime_t direct = system_time() - start;
+
+	if (totalSize != 0)
+		std::cout << "serializer: output does not match the reference" << std::endl;
+	std::cout << "serializer: request heads per second" << std::endl;
+	std::cout << "  stringstream: " << std::setw(10)
+		<< (kIterations * 1000000LL / std::max(stream, (bigtime_t)1)) << std::endl;
+	std::cout << "    serializer: " << std::setw(10)
+		<< (kIterations * 1000000LL / std::max(direct, (bigtime_t)1)) << std::endl;
+}
+
+
+// Listen on a free port on the loopback interface; returns the socket and
+// sets \a port.
+static int
+listen_on_loopback(uint16& port, int backlog = 1)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t length = sizeof(address);
+	if (fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0
+		|| listen(fd, backlog) != 0
+		|| getsockname(fd, (sockaddr*)&address, &length) != 0) {
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	port = ntohs(address.sin_port);
+	return fd;
+}
+
+
+// Wait for a request head on the connection \a fd when \a http is set, and
+// send \a size bytes (after a response head when \a http is set).
+static void
+serve_connection(int fd, size_t size, bool http)
+{
+	std::vector<char> data(256 * 1024, 'x');
+	if (http) {
+		std::string request;
+		while (request.find("\r\n\r\n") == std::string::npos) {
+			ssize_t bytesRead = read(fd, data.data(), data.size());
+			if (bytesRead <= 0)
+				break;
+			request.append(data.data(), bytesRead);
+		}
+		std::string head = "HTTP/1.1 200 OK\r\nContent-Length: "
+			+ std::to_string(size) + "\r\nConnection: close\r\n\r\n";
+		write(fd, head.data(), head.size());
+	}
+	while (size > 0) {
+		ssize_t written = write(fd, data.data(), std::min(size, data.size()));
+		if (written <= 0)
+			break;
+		size -= written;
+	}
+	close(fd);
+}
+
+
+// Accept one connection on \a listener, and serve it
+static void
+serve_once(int listener, size_t size, bool http)
+{
+	int fd = accept(listener, nullptr, nullptr);
+	if (fd >= 0)
+		serve_connection(fd, size, http);
+}
+
+
+// Body target that only counts the bytes
+class DiscardingIO : public BDataIO {
+public:
+	ssize_t Write(const void*, size_t size) override
+	{
+		fSize += size;
+		return size;
+	}
+
+	size_t fSize = 0;
+};
+
+
+// Measure the throughput of a single stream over the loopback interface. The
+// read strategies of the session are compared on a plain socket: one 4 KiB
+// read per ready event (as before), and reading until the socket would block
+// within a budget, with the read size growing from 4 KiB to 256 KiB. Then a
+// download through the session is measured.
+void
+benchmark_loopback()
+{
+	static const size_t kSize = 256 * 1024 * 1024;
+
+	std::cout << "loopback: single stream throughput ("
+		<< kSize / (1024 * 1024) << " MB)" << std::endl;
+	for (bool drain: {false, true}) {
+		uint16 port;
+		int listener = listen_on_loopback(port);
+		if (listener < 0) {
+			std::cout << "  cannot listen on the loopback interface" << std::endl;
+			return;
+		}
+		std::function<void()> server = [&]() { serve_once(listener, kSize, false); };
+		thread_id thread = spawn_thread(run_function, "server",
+			B_NORMAL_PRIORITY, &server);
+		resume_thread(thread);
+
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = htons(port);
+		connect(fd, (sockaddr*)&address, sizeof(address));
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+		EventLoop loop;
+		loop.Add(fd, B_EVENT_READ, nullptr);
+		std::vector<EventLoop::Event> ready;
+		std::vector<char> buffer(256 * 1024);
+		size_t readSize = 4096;
+		size_t total = 0;
+		size_t wakeups = 0;
+		bool end = false;
+		bigtime_t start = system_time();
+		while (!end) {
+			loop.Wait(ready);
+			wakeups++;
+			size_t budget = drain ? 1024 * 1024 : 1;
+			while (budget > 0) {
+				ssize_t bytesRead = read(fd, buffer.data(), readSize);
+				if (bytesRead <= 0) {
+					end = bytesRead == 0;
+					break;
+				}
+				total += bytesRead;
+				budget -= std::min(budget, (size_t)bytesRead);
+				if (drain && (size_t)bytesRead == readSize
+					&& readSize < buffer.size())
+					readSize *= 2;
+			}
+		}
+		bigtime_t elapsed = std::max(system_time() - start, (bigtime_t)1);
+		status_t result;
+		wait_for_thread(thread, &result);
+		loop.Remove(fd);
+		close(fd);
+		close(listener);
+
+		std::cout << "  " << (drain ? "  drain, adaptive" : "one 4 KiB read")
+			<< ": " << std::setw(8) << (total / elapsed) << " MB/s, "
+			<< std::setw(8) << wakeups << " wakeups" << std::endl;
+	}
+
+	uint16 port;
+	int listener = listen_on_loopback(port);
+	if (listener < 0)
+		return;
+	std::function<void()> server = [&]() { serve_once(listener, kSize, true); };
+	thread_id thread = spawn_thread(run_function, "server", B_NORMAL_PRIORITY,
+		&server);
+	resume_thread(thread);
+
+	BHttpSession session;
+	auto target = std::make_unique<DiscardingIO>();
+	auto counter = target.get();
+	BUrl url(("http://127.0.0.1:" + std::to_string(port) + "/").c_str());
+	bigtime_t start = system_time();
+	auto result = session.AddRequest(BHttpRequest::Get(url).value(),
+		std::move(target));
+	bool succeeded = (bool)result.Body();
+	bigtime_t elapsed = std::max(system_time() - start, (bigtime_t)1);
+	status_t status;
+	wait_for_thread(thread, &status);
+	close(listener);
+
+	std::cout << "           session: " << std::setw(8)
+		<< (counter->fSize / elapsed) << " MB/s";
+	if (!succeeded)
+		std::cout << " (failed)";
+	std::cout << std::endl;
+}
+
+
+// The line reader that the response head was parsed with before: it scans the
+// buffer a byte at a time, from the start on every read, and copies the line
+// out of the buffer.
+static std::optional<std::string>
+get_line_bytewise(BNetBuffer& buffer)
+{
+	size_t index = 0;
+	while (index < buffer.Size() && buffer.Data()[index] != '\n')
+		index++;
+	if (index == buffer.Size())
+		return std::nullopt;
+
+	std::vector<char> line(index + 1);
+	buffer.RemoveData(line.data(), index + 1);
+	if (index != 0 && line[index - 1] == '\r')
+		index--;
+	return std::string(line.data(), index);
+}
+
+
+static size_t
+parse_with_get_line(const std::string& head, size_t readSize)
+{
+	BNetBuffer buffer;
+	bool statusReceived = false;
+	size_t fields = 0;
+	for (size_t offset = 0; offset < head.size(); offset += readSize) {
+		buffer.AppendData(head.data() + offset,
+			std::min(readSize, head.size() - offset));
+		while (auto line = get_line_bytewise(buffer)) {
+			if (!statusReceived) {
+				try {
+					std::stol(std::string(line.value(), 9, 3));
+				} catch (std::invalid_argument&) {
+					return 0;
+				}
+				statusReceived = true;
+			} else if (line.value().empty())
+				return fields;
+			else if (line.value().find(':') != std::string::npos)
+				fields++;
+		}
+	}
+	return 0;
+}
+
+
+static size_t
+parse_with_parser(const std::string& head, size_t readSize)
+{
+	ReceiveBuffer buffer;
+	HttpResponseParser parser;
+	BHttpStatus status;
+	bool http11;
+	bool statusReceived = false;
+	size_t fields = 0;
+	for (size_t offset = 0; offset < head.size(); offset += readSize) {
+		size_t size = std::min(readSize, head.size() - offset);
+		memcpy(buffer.Space(size), head.data() + offset, size);
+		buffer.Commit(size);
+		while (true) {
+			size_t used;
+			if (!statusReceived) {
+				used = parser.ParseStatus(buffer.Data(), buffer.Size(), status,
+					http11);
+				statusReceived = used > 0;
+			} else {
+				const char* name;
+				const char* value;
+				used = parser.ParseField(buffer.Data(), buffer.Size(), name,
+					value);
+				if (name != nullptr)
+					fields++;
+			}
+			if (used == 0)
+				break;
+			buffer.Consume(used);
+			if (parser.IsDone())
+				return fields;
+		}
+	}
+	return 0;
+}
+
+
+// Measure the number of header fields of a response head that can be parsed
+// per second, by the byte wise line reader and by the response parser. The
+// head is received in one read, and in small reads that split the lines.
+void
+benchmark_response_parser()
+{
+	static const int32 kIterations = 50000;
+	std::string head = "HTTP/1.1 200 OK\r\n"
+		"Date: Mon, 04 Oct 2021 10:00:00 GMT\r\n"
+		"Server: Apache/2.4.41 (Ubuntu)\r\n"
+		"Content-Type: text/html; charset=UTF-8\r\n"
+		"Content-Length: 104857\r\n"
+		"Cache-Control: private, max-age=0, must-revalidate\r\n"
+		"ETag: \"5d8c72a5edda8d6a:0\"\r\n"
+		"Last-Modified: Sun, 03 Oct 2021 18:30:00 GMT\r\n"
+		"Vary: Accept-Encoding, Cookie\r\n"
+		"Strict-Transport-Security: max-age=31536000; includeSubDomains\r\n"
+		"X-Content-Type-Options: nosniff\r\n";
+	head += "Content-Security-Policy: default-src 'self'";
+	for (int i = 0; i < 40; i++)
+		head += " https://cdn" + std::to_string(i) + ".example.com";
+	head += "\r\nSet-Cookie: session=" + std::string(512, 'a')
+		+ "; Path=/; HttpOnly\r\n\r\n";
+
+	std::cout << "response_parser: header fields per second ("
+		<< head.size() << " byte head)" << std::endl;
+	for (size_t readSize: {head.size(), (size_t)64}) {
+		size_t fields = 0;
+		bigtime_t start = system_time();
+		for (int32 i = 0; i < kIterations; i++)
+			fields += parse_with_get_line(head, readSize);
+		bigtime_t bytewise = std::max(system_time() - start, (bigtime_t)1);
+
+		start = system_time();
+		for (int32 i = 0; i < kIterations; i++)
+			fields -= parse_with_parser(head, readSize);
+		bigtime_t parser = std::max(system_time() - start, (bigtime_t)1);
+
+		if (fields != 0)
+			std::cout << "  parsers do not agree on the fields" << std::endl;
+		size_t total = kIterations * (size_t)parse_with_parser(head, readSize);
+		std::cout << "  reads of " << std::setw(4) << readSize << " bytes: GetLine "
+			<< std::setw(10) << (total * 1000000LL / bytewise) << ", parser "
+			<< std::setw(10) << (total * 1000000LL / parser) << std::endl;
+	}
+}
+
+
+// Measure the throughput of the content decoders that are built in, on a
+// body of log lines. The encoded body is passed in pieces of the size of a
+// socket read, and decoded into a window of the size that the session uses.
+void
+benchmark_content_decoder()
+{
+	static const size_t kBodySize = 32 * 1024 * 1024;
+	static const size_t kReadSize = 16384;
+	static const size_t kWindowSize = 65536;
+
+	std::string body;
+	for (int32 i = 0; body.size() < kBodySize; i++) {
+		body += "2021-10-04 10:00:" + std::to_string(i % 60) + " GET /images/"
+			+ std::to_string(i % 997) + ".png 200 " + std::to_string(i * 7919 % 65536)
+			+ " \"Mozilla/5.0 (compatible; HaikuWebKit)\"\n";
+	}
+
+	std::vector<std::pair<const char*, std::string>> encoded;
+	{
+		z_stream stream = {};
+		deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+			Z_DEFAULT_STRATEGY);
+		std::string data(deflateBound(&stream, body.size()), '\0');
+		stream.next_in = (Bytef*)body.data();
+		stream.avail_in = body.size();
+		stream.next_out = (Bytef*)data.data();
+		stream.avail_out = data.size();
+		deflate(&stream, Z_FINISH);
+		data.resize(stream.total_out);
+		deflateEnd(&stream);
+		encoded.emplace_back("gzip", std::move(data));
+	}
+#if defined(BROTLI_ENABLED) && defined(BROTLI_ENCODER_ENABLED)
+	{
+		size_t size = BrotliEncoderMaxCompressedSize(body.size());
+		std::string data(size, '\0');
+		BrotliEncoderCompress(6, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+			body.size(), (const uint8_t*)body.data(), &size, (uint8_t*)data.data());
+		data.resize(size);
+		encoded.emplace_back("br", std::move(data));
+	}
+#endif
+#ifdef ZSTD_ENABLED
+	{
+		std::string data(ZSTD_compressBound(body.size()), '\0');
+		data.resize(ZSTD_compress(data.data(), data.size(), body.data(),
+			body.size(), 3));
+		encoded.emplace_back("zstd", std::move(data));
+	}
+#endif
+
+	std::cout << "content_decoder: decoded MB/s (Accept-Encoding: "
+		<< HttpContentDecoderPool::AcceptEncoding() << ")" << std::endl;
+	HttpContentDecoderPool pool;
+	std::vector<char> window(kWindowSize);
+	for (auto& [encoding, data]: encoded) {
+		auto decoder = pool.Get(encoding);
+		size_t decodedSize = 0;
+		bool end = false;
+		bigtime_t start = system_time();
+		for (size_t offset = 0; offset < data.size() && !end; offset += kReadSize) {
+			const char* input = data.data() + offset;
+			size_t inputSize = std::min(kReadSize, data.size() - offset);
+			size_t outputSize;
+			do {
+				char* output = window.data();
+				outputSize = window.size();
+				end = decoder->Decode(input, inputSize, output, outputSize);
+				decodedSize += output - window.data();
+			} while (!end && (inputSize > 0 || outputSize == 0));
+		}
+		bigtime_t elapsed = std::max(system_time() - start, (bigtime_t)1);
+		pool.Put(std::move(decoder));
+
+		std::cout << "  " << std::setw(4) << encoding << ": " << std::setw(8)
+			<< (decodedSize / elapsed) << " MB/s, " << std::setw(5)
+			<< std::fixed << std::setprecision(1)
+			<< (100.0 * data.size() / body.size()) << "% of the size";
+		if (!end || decodedSize != body.size())
+			std::cout << " (decoded body does not match)";
+		std::cout << std::endl;
+	}
+}
+
+
+// Measure the throughput of the chunked decoder, on a body of tiny chunks with
+// extensions and on a body of huge chunks. The body is passed in pieces of the
+// size of a socket read, so that the chunk size lines are split over reads.
+void
+benchmark_chunked()
+{
+	static const size_t kBodySize = 64 * 1024 * 1024;
+	static const size_t kReadSize = 16384;
+
+	std::cout << "chunked: decoder throughput" << std::endl;
+	for (size_t chunkSize: {(size_t)16, (size_t)4 * 1024 * 1024}) {
+		std::string chunk(chunkSize, 'x');
+		std::string corpus;
+		char line[32];
+		while (corpus.size() < kBodySize) {
+			corpus.append(line, snprintf(line, sizeof(line), "%zx;ext=1\r\n",
+				chunkSize));
+			corpus.append(chunk);
+			corpus.append("\r\n");
+		}
+		corpus.append("0\r\n\r\n");
+
+		HttpChunkedDecoder decoder;
+		size_t payloadTotal = 0;
+		bigtime_t start = system_time();
+		for (size_t offset = 0; offset < corpus.size() && !decoder.IsDone();) {
+			size_t end = std::min(offset + kReadSize, corpus.size());
+			while (offset < end && !decoder.IsDone()) {
+				const char* payload;
+				size_t payloadSize;
+				offset += decoder.Decode(corpus.data() + offset, end - offset,
+					payload, payloadSize);
+				payloadTotal += payloadSize;
+			}
+		}
+		bigtime_t elapsed = std::max(system_time() - start, (bigtime_t)1);
+
+		if (!decoder.IsDone())
+			std::cout << "  decoder did not reach the end of the body" << std::endl;
+		std::cout << "  " << std::setw(8) << chunkSize << " byte chunks: "
+			<< std::setw(8) << (corpus.size() / elapsed) << " MB/s, "
+			<< std::setw(8) << (payloadTotal / elapsed) << " MB/s of payload"
+			<< std::endl;
+	}
+}
+
+
+// Compare a burst of small requests that are multiplexed over HTTP/2 to the
+// same burst over the pool of HTTP/1.1 connections. This needs local servers;
+// HTTP2_BENCHMARK_URL points to a server that speaks HTTP/2 over cleartext
+// (for example nghttpd --no-tls -d <directory> 8080), and HTTP11_BENCHMARK_URL
+// to an HTTP/1.1 server with the same file.
+void
+benchmark_http2()
+{
+	static const int32 kRequests = 500;
+
+	std::cout << "http2: " << kRequests << " concurrent small requests"
+		<< std::endl;
+	for (auto [name, variable, version]: {
+			std::make_tuple("HTTP/1.1", "HTTP11_BENCHMARK_URL", (int8)B_HTTP_11),
+			std::make_tuple("  HTTP/2", "HTTP2_BENCHMARK_URL", (int8)B_HTTP_2)}) {
+		const char* url = getenv(variable);
+		if (url == nullptr) {
+			std::cout << "  " << name << ": skipped, " << variable << " is not set"
+				<< std::endl;
+			continue;
+		}
+
+		BHttpSession session;
+		std::vector<BHttpResult> results;
+		results.reserve(kRequests);
+		int32 failed = 0;
+		bigtime_t start = system_time();
+		for (int32 i = 0; i < kRequests; i++) {
+			auto request = BHttpRequest::Get(BUrl(url)).value();
+			request.SetHttpVersion(version);
+			results.push_back(session.AddRequest(std::move(request)));
+		}
+		for (auto& result: results) {
+			if (!result.Body())
+				failed++;
+		}
+		bigtime_t elapsed = system_time() - start;
+
+		std::cout << "  " << name << ": " << std::setw(8) << elapsed / 1000
+			<< " ms, " << std::setw(8)
+			<< (kRequests * 1000000LL / std::max(elapsed, (bigtime_t)1))
+			<< " requests/s";
+		if (failed > 0)
+			std::cout << " (" << failed << " failed)";
+		std::cout << std::endl;
+	}
+}
+
+
+// Observer that counts the messages about a request, and lets the benchmark
+// know when the request is completed
+class CountingObserver : public BLooper {
+public:
+	CountingObserver()
+		: BLooper("observer")
+	{
+		fCompleted = create_sem(0, "observer completed");
+	}
+
+	~CountingObserver()
+	{
+		delete_sem(fCompleted);
+	}
+
+	void MessageReceived(BMessage* message) override
+	{
+		fMessages++;
+		if (message->what == UrlEvent::RequestCompleted)
+			release_sem(fCompleted);
+	}
+
+	size_t fMessages = 0;
+	sem_id fCompleted;
+};
+
+
+// CPU time of the whole process
+static bigtime_t
+cpu_time()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL
+		+ usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+
+// Measure the messages that the observer of a download over the loopback
+// interface gets, when every progress update is sent, and when the updates
+// are coalesced at the default interval. The CPU time is that of the whole
+// process: the session, the server and the observer.
+void
+benchmark_progress()
+{
+	static const size_t kSize = 256 * 1024 * 1024;
+
+	std::cout << "progress: observer messages for a download ("
+		<< kSize / (1024 * 1024) << " MB)" << std::endl;
+	for (bool coalesce: {false, true}) {
+		uint16 port;
+		int listener = listen_on_loopback(port);
+		if (listener < 0) {
+			std::cout << "  cannot listen on the loopback interface" << std::endl;
+			return;
+		}
+		std::function<void()> server = [&]() { serve_once(listener, kSize, true); };
+		thread_id thread = spawn_thread(run_function, "server",
+			B_NORMAL_PRIORITY, &server);
+		resume_thread(thread);
+
+		auto observer = new CountingObserver();
+		observer->Run();
+		BHttpSession session;
+		BUrl url(("http://127.0.0.1:" + std::to_string(port) + "/").c_str());
+		auto request = BHttpRequest::Get(url).value();
+		if (!coalesce)
+			request.SetProgressInterval(0);
+		bigtime_t start = system_time();
+		bigtime_t cpuStart = cpu_time();
+		auto result = session.AddRequest(std::move(request),
+			std::make_unique<DiscardingIO>(), BMessenger(observer));
+		bool succeeded = (bool)result.Body();
+		acquire_sem(observer->fCompleted);
+		bigtime_t elapsed = std::max(system_time() - start, (bigtime_t)1);
+		bigtime_t cpu = cpu_time() - cpuStart;
+		status_t status;
+		wait_for_thread(thread, &status);
+		close(listener);
+		size_t messages = observer->fMessages;
+		observer->Lock();
+		observer->Quit();
+
+		std::cout << "  " << (coalesce ? "   coalesced" : "every update")
+			<< ": " << std::setw(8) << messages << " messages, "
+			<< std::setw(6) << (kSize / elapsed) << " MB/s, "
+			<< std::setw(6) << cpu / 1000 << " ms CPU";
+		if (!succeeded)
+			std::cout << " (failed)";
+		std::cout << std::endl;
+	}
+}
+
+
+// Measure the latency of small high-priority requests while the session is
+// saturated by large low-priority downloads over the loopback interface, and
+// compare it to the latency when all requests have the same priority. The
+// session has a single data thread, so that all connections compete for it.
+void
+benchmark_priority()
+{
+	static const size_t kBulkCount = 16;
+	static const size_t kBulkSize = 1024 * 1024 * 1024;
+	static const size_t kProbeCount = 100;
+	static const size_t kProbeSize = 1024;
+
+	std::cout << "priority: latency of small requests under " << kBulkCount
+		<< " bulk downloads" << std::endl;
+	for (bool prioritize: {false, true}) {
+		BHttpSession session(1);
+		std::vector<int> listeners;
+		std::vector<std::function<void()>> servers(kBulkCount + 1);
+		std::vector<thread_id> threads;
+		std::vector<BHttpResult> bulk;
+		for (size_t i = 0; i <= kBulkCount; i++) {
+			uint16 port;
+			int listener = listen_on_loopback(port);
+			if (listener < 0) {
+				std::cout << "  cannot listen on the loopback interface"
+					<< std::endl;
+				return;
+			}
+			listeners.push_back(listener);
+			if (i < kBulkCount)
+				servers[i] = [=]() { serve_once(listener, kBulkSize, true); };
+			else {
+				servers[i] = [=]() {
+					for (size_t j = 0; j < kProbeCount; j++)
+						serve_once(listener, kProbeSize, true);
+				};
+			}
+			threads.push_back(spawn_thread(run_function, "server",
+				B_NORMAL_PRIORITY, &servers[i]));
+			resume_thread(threads.back());
+
+			BUrl url(("http://127.0.0.1:" + std::to_string(port) + "/").c_str());
+			if (i < kBulkCount) {
+				bulk.push_back(session.AddRequest(BHttpRequest::Get(url).value(),
+					std::make_unique<DiscardingIO>(), BMessenger(),
+					prioritize ? B_HTTP_PRIORITY_LOWEST : B_HTTP_PRIORITY_NORMAL));
+				continue;
+			}
+
+			// Let the downloads get going before the probes are sent
+			snooze(500000);
+			std::vector<bigtime_t> latencies;
+			bool succeeded = true;
+			for (size_t j = 0; j < kProbeCount; j++) {
+				bigtime_t start = system_time();
+				auto result = session.AddRequest(BHttpRequest::Get(url).value(),
+					std::unique_ptr<BDataIO>(), BMessenger(),
+					prioritize ? B_HTTP_PRIORITY_HIGHEST : B_HTTP_PRIORITY_NORMAL);
+				try {
+					result.Body();
+				} catch (...) {
+					succeeded = false;
+				}
+				latencies.push_back(system_time() - start);
+			}
+			std::sort(latencies.begin(), latencies.end());
+			std::cout << "  " << (prioritize ? "  prioritized" : "same priority")
+				<< ": p50 " << std::setw(8) << latencies[kProbeCount / 2]
+				<< " us, p99 " << std::setw(8)
+				<< latencies[kProbeCount * 99 / 100] << " us";
+			if (!succeeded)
+				std::cout << " (failed)";
+			std::cout << std::endl;
+		}
+
+		for (auto& result: bulk)
+			session.Cancel(result);
+		for (auto& result: bulk) {
+			try {
+				result.Body();
+			} catch (...) {
+			}
+		}
+		for (size_t i = 0; i < threads.size(); i++) {
+			status_t status;
+			wait_for_thread(threads[i], &status);
+			close(listeners[i]);
+		}
+	}
+}
+
+
+// Send a burst of requests to a busy host, and then a few requests to a quiet
+// host, once with the default limits on the requests in progress and once
+// with (next to) no limits. The busy host counts the connections that are
+// open at the same time. The latency of the requests to the quiet host shows
+// whether they have to wait for the burst.
+void
+benchmark_host_limits()
+{
+	static const int32 kBurstCount = 2000;
+	static const int32 kQuietCount = 20;
+	static const int32 kServerThreads = 64;
+	static const size_t kResponseSize = 1024;
+
+	raise_descriptor_limit();
+	std::cout << "host_limits: burst of " << kBurstCount
+		<< " requests to one host" << std::endl;
+	for (bool limited: {true, false}) {
+		uint16 busyPort;
+		uint16 quietPort;
+		int busy = listen_on_loopback(busyPort, 1024);
+		int quiet = listen_on_loopback(quietPort);
+		if (busy < 0 || quiet < 0) {
+			std::cout << "  cannot listen on the loopback interface" << std::endl;
+			return;
+		}
+
+		std::atomic<int32> remaining{kBurstCount};
+		std::atomic<int32> open{0};
+		std::atomic<int32> maxOpen{0};
+		std::function<void()> busyServer = [&]() {
+			while (remaining.fetch_sub(1) > 0) {
+				int fd = accept(busy, nullptr, nullptr);
+				if (fd < 0)
+					return;
+				int32 count = open.fetch_add(1) + 1;
+				int32 max = maxOpen.load();
+				while (count > max && !maxOpen.compare_exchange_weak(max, count))
+					;
+				serve_connection(fd, kResponseSize, true);
+				open.fetch_sub(1);
+			}
+		};
+		std::function<void()> quietServer = [&]() {
+			for (int32 i = 0; i < kQuietCount; i++)
+				serve_once(quiet, kResponseSize, true);
+		};
+		std::vector<thread_id> threads;
+		for (int32 i = 0; i <= kServerThreads; i++) {
+			threads.push_back(spawn_thread(run_function, "server",
+				B_NORMAL_PRIORITY, i < kServerThreads ? &busyServer : &quietServer));
+			resume_thread(threads.back());
+		}
+
+		BHttpSession session;
+		if (!limited) {
+			session.SetMaxRequestsPerHost(kBurstCount);
+			session.SetMaxRequests(kBurstCount);
+		}
+		BUrl busyUrl(("http://127.0.0.1:" + std::to_string(busyPort) + "/").c_str());
+		BUrl quietUrl(("http://127.0.0.1:" + std::to_string(quietPort) + "/").c_str());
+		bigtime_t start = system_time();
+		std::vector<BHttpResult> burst;
+		for (int32 i = 0; i < kBurstCount; i++)
+			burst.push_back(session.AddRequest(BHttpRequest::Get(busyUrl).value()));
+
+		std::vector<bigtime_t> latencies;
+		int32 failed = 0;
+		for (int32 i = 0; i < kQuietCount; i++) {
+			bigtime_t requestStart = system_time();
+			auto result = session.AddRequest(BHttpRequest::Get(quietUrl).value());
+			try {
+				result.Body();
+			} catch (...) {
+				failed++;
+			}
+			latencies.push_back(system_time() - requestStart);
+		}
+		for (auto& result: burst) {
+			try {
+				result.Body();
+			} catch (...) {
+				failed++;
+			}
+		}
+		bigtime_t elapsed = system_time() - start;
+
+		// Wake up the server threads that wait for requests that failed
+		shutdown(busy, SHUT_RDWR);
+		shutdown(quiet, SHUT_RDWR);
+		for (auto thread: threads) {
+			status_t status;
+			wait_for_thread(thread, &status);
+		}
+		close(busy);
+		close(quiet);
+
+		std::sort(latencies.begin(), latencies.end());
+		std::cout << "  " << (limited ? "  limited" : "unlimited") << ": "
+			<< std::setw(4) << maxOpen.load() << " connections at most, burst "
+			<< std::setw(6) << elapsed / 1000 << " ms, quiet host p50 "
+			<< std::setw(8) << latencies[kQuietCount / 2] << " us, p99 "
+			<< std::setw(8) << latencies[kQuietCount * 99 / 100] << " us";
+		if (failed > 0)
+			std::cout << " (" << failed << " failed)";
+		std::cout << std::endl;
+	}
+}
+
+// Compare the timer wheel to an ordered set of deadlines, as used before, with
+// many requests that each have a timeout which is pushed back now and then,
+// while the time moves on in steps of a millisecond.
+void
+benchmark_timer_wheel()
+{
+	static const size_t kTimers = 100000;
+	static const bigtime_t kSpan = 60000000;
+	static const bigtime_t kStep = 1000;
+	static const bigtime_t kDuration = 10000000;
+
+	std::cout << "timer_wheel: " << kTimers << " timers" << std::endl;
+	srand(42);
+	std::vector<bigtime_t> offsets(kTimers);
+	for (auto& offset: offsets)
+		offset = (bigtime_t)rand() % kSpan;
+
+	// Ordered set
+	bigtime_t start = system_time();
+	std::set<std::pair<bigtime_t, size_t>> deadlines;
+	std::vector<bigtime_t> when(kTimers);
+	bigtime_t time = system_time();
+	for (size_t i = 0; i < kTimers; i++) {
+		when[i] = start + offsets[i];
+		deadlines.emplace(when[i], i);
+	}
+	bigtime_t setSchedule = system_time() - time;
+	time = system_time();
+	for (size_t i = 0; i < kTimers; i++) {
+		deadlines.erase(std::make_pair(when[i], i));
+		when[i] += kStep;
+		deadlines.emplace(when[i], i);
+	}
+	bigtime_t setReschedule = system_time() - time;
+	size_t setExpired = 0;
+	time = system_time();
+	for (bigtime_t now = start; now < start + kDuration; now += kStep) {
+		while (!deadlines.empty() && deadlines.begin()->first <= now) {
+			deadlines.erase(deadlines.begin());
+			setExpired++;
+		}
+	}
+	bigtime_t setAdvance = system_time() - time;
+
+	// Timer wheel
+	TimerWheel wheel;
+	std::vector<TimerWheel::Timer> timers(kTimers);
+	time = system_time();
+	for (size_t i = 0; i < kTimers; i++)
+		wheel.Schedule(timers[i], start + offsets[i]);
+	bigtime_t wheelSchedule = system_time() - time;
+	time = system_time();
+	for (size_t i = 0; i < kTimers; i++)
+		wheel.Schedule(timers[i], timers[i].When() + kStep);
+	bigtime_t wheelReschedule = system_time() - time;
+	size_t wheelExpired = 0;
+	time = system_time();
+	for (bigtime_t now = start; now < start + kDuration; now += kStep) {
+		wheel.Advance(now);
+		while (wheel.NextExpired() != nullptr)
+			wheelExpired++;
+	}
+	bigtime_t wheelAdvance = system_time() - time;
+
+	auto print = [](const char* name, bigtime_t schedule, bigtime_t reschedule,
+			bigtime_t advance, size_t expired) {
+		std::cout << "  " << std::setw(5) << name << ": schedule "
+			<< std::setw(5) << schedule * 1000 / kTimers << " ns, reschedule "
+			<< std::setw(5) << reschedule * 1000 / kTimers << " ns, "
+			<< expired << " expired in " << std::setw(6) << advance << " us"
+			<< std::endl;
+	};
+	print("set", setSchedule, setReschedule, setAdvance, setExpired);
+	print("wheel", wheelSchedule, wheelReschedule, wheelAdvance, wheelExpired);
+}
+
+
+// Requests to a server that answers a part of them with 503 Service
+// Unavailable: compare the requests that succeed, and the load on the server,
+// without retries, with the default retry budget, and without a budget.
+void
+benchmark_retry()
+{
+	static const int32 kRequestCount = 1000;
+	static const int32 kServerThreads = 16;
+	static const int32 kFailurePercent = 30;
+
+	raise_descriptor_limit();
+	std::cout << "retry: " << kRequestCount << " requests, " << kFailurePercent
+		<< "% of the responses are 503" << std::endl;
+	for (int32 mode = 0; mode < 3; mode++) {
+		uint16 port;
+		int listener = listen_on_loopback(port, 1024);
+		if (listener < 0) {
+			std::cout << "  cannot listen on the loopback interface" << std::endl;
+			return;
+		}
+
+		std::atomic<int32> served{0};
+		std::function<void()> server = [&]() {
+			std::vector<char> buffer(4096);
+			while (true) {
+				int fd = accept(listener, nullptr, nullptr);
+				if (fd < 0)
+					return;
+				std::string request;
+				while (request.find("\r\n\r\n") == std::string::npos) {
+					ssize_t bytesRead = read(fd, buffer.data(), buffer.size());
+					if (bytesRead <= 0)
+						break;
+					request.append(buffer.data(), bytesRead);
+				}
+				bool fail = served.fetch_add(1) * 7919 % 100 < kFailurePercent;
+				std::string response = fail
+					? "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n"
+					: "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n";
+				response += "Connection: close\r\n\r\n";
+				if (!fail)
+					response += "ok";
+				write(fd, response.data(), response.size());
+				close(fd);
+			}
+		};
+		std::vector<thread_id> threads;
+		for (int32 i = 0; i < kServerThreads; i++) {
+			threads.push_back(spawn_thread(run_function, "server",
+				B_NORMAL_PRIORITY, &server));
+			resume_thread(threads.back());
+		}
+
+		BHttpSession session;
+		session.SetRetryBackoff(1000, 10000);
+		if (mode == 0)
+			session.SetMaxAttempts(1);
+		else if (mode == 2)
+			session.SetRetryBudget(100);
+		BUrl url(("http://127.0.0.1:" + std::to_string(port) + "/").c_str());
+		bigtime_t start = system_time();
+		std::vector<BHttpResult> results;
+		for (int32 i = 0; i < kRequestCount; i++)
+			results.push_back(session.AddRequest(BHttpRequest::Get(url).value()));
+		int32 succeeded = 0;
+		int32 retried = 0;
+		for (auto& result: results) {
+			try {
+				if (result.Status().value().get().code == 200)
+					succeeded++;
+			} catch (...) {
+			}
+			if (result.Attempts() > 1)
+				retried++;
+		}
+		bigtime_t elapsed = system_time() - start;
+
+		shutdown(listener, SHUT_RDWR);
+		for (auto thread: threads) {
+			status_t status;
+			wait_for_thread(thread, &status);
+		}
+		close(listener);
+
+		static const char* kModes[] = { "no retries", "budget 20%", "no budget" };
+		std::cout << "  " << std::setw(10) << kModes[mode] << ": "
+			<< std::setw(4) << succeeded << " succeeded, " << std::setw(4)
+			<< retried << " retried, " << std::setw(4) << served.load()
+			<< " requests served in " << std::setw(5) << elapsed / 1000
+			<< " ms" << std::endl;
+	}
+}
+
+
+// Requests that are redirected once to the same server: compare following
+// the redirects in the session with following them in the application, by
+// the time per request and the connections that the server accepted.
+void
+benchmark_redirect()
+{
+	static const int32 kRequestCount = 500;
+	static const int32 kServerThreads = 4;
+
+	std::cout << "redirect: " << kRequestCount << " requests, redirected once"
+		<< std::endl;
+	for (bool inSession: {false, true}) {
+		uint16 port;
+		int listener = listen_on_loopback(port, 16);
+		if (listener < 0) {
+			std::cout << "  cannot listen on the loopback interface" << std::endl;
+			return;
+		}
+
+		// Persistent connections; /start is redirected to /final
+		std::atomic<int32> connections{0};
+		std::function<void()> server = [&]() {
+			std::vector<char> buffer(4096);
+			while (true) {
+				int fd = accept(listener, nullptr, nullptr);
+				if (fd < 0)
+					return;
+				connections++;
+				std::string input;
+				while (true) {
+					size_t end = input.find("\r\n\r\n");
+					if (end == std::string::npos) {
+						ssize_t bytesRead = read(fd, buffer.data(), buffer.size());
+						if (bytesRead <= 0)
+							break;
+						input.append(buffer.data(), bytesRead);
+						continue;
+					}
+					std::string response
+						= input.compare(0, 11, "GET /start ") == 0
+						? "HTTP/1.1 302 Found\r\nLocation: /final\r\n"
+							"Content-Length: 0\r\n\r\n"
+						: "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+					input.erase(0, end + 4);
+					write(fd, response.data(), response.size());
+				}
+				close(fd);
+			}
+		};
+		std::vector<thread_id> threads;
+		for (int32 i = 0; i < kServerThreads; i++) {
+			threads.push_back(spawn_thread(run_function, "server",
+				B_NORMAL_PRIORITY, &server));
+			resume_thread(threads.back());
+		}
+
+		int32 succeeded = 0;
+		bigtime_t elapsed;
+		{
+			BHttpSession session;
+			BUrl url(("http://127.0.0.1:" + std::to_string(port) + "/start").c_str());
+			bigtime_t start = system_time();
+			for (int32 i = 0; i < kRequestCount; i++) {
+				auto request = BHttpRequest::Get(url).value();
+				request.SetFollowLocation(inSession);
+				auto result = session.AddRequest(std::move(request));
+				try {
+					if (!inSession && result.Status().value().get().code == 302) {
+						BUrl location(url,
+							result.Headers().value().get()["Location"]);
+						auto next = BHttpRequest::Get(location).value();
+						next.SetFollowLocation(false);
+						result = session.AddRequest(std::move(next));
+					}
+					if (result.Status().value().get().code == 200)
+						succeeded++;
+					result.Body();
+				} catch (...) {
+				}
+			}
+			elapsed = system_time() - start;
+		}
+
+		// The session closed its idle connections
+		shutdown(listener, SHUT_RDWR);
+		for (auto thread: threads) {
+			status_t status;
+			wait_for_thread(thread, &status);
+		}
+		close(listener);
+
+		std::cout << "  " << (inSession ? "    session" : "application") << ": "
+			<< std::setw(4) << succeeded << " succeeded, " << std::setw(6)
+			<< elapsed / kRequestCount << " us per request, " << std::setw(3)
+			<< connections.load() << " connections" << std::endl;
+	}
+}
+
+
+static const struct {
+	const char*	name;
+	void		(*function)();
+} kBenchmarks[] = {
+	{ "event_loop", benchmark_event_loop },
+	{ "resolver", benchmark_resolver },
+	{ "queue", benchmark_queue },
+	{ "add_request", benchmark_add_request },
+	{ "serializer", benchmark_serializer },
+	{ "loopback", benchmark_loopback },
+	{ "response_parser", benchmark_response_parser },
+	{ "content_decoder", benchmark_content_decoder },
+	{ "chunked", benchmark_chunked },
+	{ "http2", benchmark_http2 },
+	{ "progress", benchmark_progress },
+	{ "priority", benchmark_priority },
+	{ "host_limits", benchmark_host_limits },
+	{ "timer_wheel", benchmark_timer_wheel },
+	{ "retry", benchmark_retry },
+	{ "redirect", benchmark_redirect },
+};
+
+
+int
+main(int argc, char** argv)
+{
+	for (const auto& benchmark: kBenchmarks) {
+		bool selected = argc < 2;
+		for (int i = 1; i < argc; i++) {
+			if (strcmp(argv[i], benchmark.name) == 0)
+				selected = true;
+		}
+		if (selected)
+			benchmark.function();
+	}
+	return 0;
+}
@@ -1,10 +1,24 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <Application.h>
+#include <DataIO.h>
+#include <HttpHeaders.h>
 #include <HttpRequest.h>
 #include <HttpResult.h>
+#include <HttpRingBuffer.h>
 #include <HttpSession.h>
 #include <NetServices.h>
 #include <SupportDefs.h>
@@ -12,9 +26,36 @@
 
 #include <Expected.h>
 
+#include <zlib.h>
+
+#include "AutoLocker.h"
+#include "Hpack.h"
+#include "HttpContentDecoder.h"
+#include "HttpChunkedDecoder.h"
+#include "HttpResponseParser.h"
+#include "HttpResultPrivate.h"
+#include "ReceiveBuffer.h"
+#include "RequestScheduler.h"
+#include "TimerWheel.h"
+
+using BPrivate::Network::BHttpMethod;
 using BPrivate::Network::BHttpRequest;
 using BPrivate::Network::BHttpSession;
 using BPrivate::Network::BHttpResult;
+using BPrivate::Network::BHttpStatus;
+using BPrivate::Network::BHttpRingBuffer;
+using BPrivate::Network::HpackDecoder;
+using BPrivate::Network::HpackEncoder;
+using BPrivate::Network::HpackHeaderList;
+using BPrivate::Network::HttpChunkedDecoder;
+using BPrivate::Network::HttpContentDecoder;
+using BPrivate::Network::HttpContentDecoderPool;
+using BPrivate::Network::HttpResponseParser;
+using BPrivate::Network::HttpResultPrivate;
+using BPrivate::Network::FindFirstOf;
+using BPrivate::Network::ReceiveBuffer;
+using BPrivate::Network::RequestScheduler;
+using BPrivate::Network::TimerWheel;
 
 
 void test_expected() {
@@ -36,6 +77,707 @@ void test_expected() {
 }
 
 
+// Test the header compression of HTTP/2 with the examples of RFC 7541,
+// appendix C.4 (requests with Huffman coding) and C.6 (responses with
+// eviction from the dynamic table)
+void test_hpack() {
+	static const uint8 kRequest1[] = {0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1, 0xe3,
+		0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff};
+	static const uint8 kRequest2[] = {0x82, 0x86, 0x84, 0xbe, 0x58, 0x86, 0xa8,
+		0xeb, 0x10, 0x64, 0x9c, 0xbf};
+	HpackHeaderList request1 = {{":method", "GET"}, {":scheme", "http"},
+		{":path", "/"}, {":authority", "www.example.com"}};
+	HpackHeaderList request2 = request1;
+	request2.emplace_back("cache-control", "no-cache");
+
+	HpackEncoder encoder;
+	HpackDecoder decoder;
+	HpackHeaderList decoded;
+	std::string block;
+	encoder.Encode(block, request1);
+	assert(block == std::string((const char*)kRequest1, sizeof(kRequest1)));
+	decoder.Decode((const uint8*)block.data(), block.size(), decoded);
+	assert(decoded == request1);
+	block.clear();
+	encoder.Encode(block, request2);
+	assert(block == std::string((const char*)kRequest2, sizeof(kRequest2)));
+	decoded.clear();
+	decoder.Decode((const uint8*)block.data(), block.size(), decoded);
+	assert(decoded == request2);
+
+	static const uint8 kResponse1[] = {0x48, 0x82, 0x64, 0x02, 0x58, 0x85,
+		0xae, 0xc3, 0x77, 0x1a, 0x4b, 0x61, 0x96, 0xd0, 0x7a, 0xbe, 0x94, 0x10,
+		0x54, 0xd4, 0x44, 0xa8, 0x20, 0x05, 0x95, 0x04, 0x0b, 0x81, 0x66, 0xe0,
+		0x82, 0xa6, 0x2d, 0x1b, 0xff, 0x6e, 0x91, 0x9d, 0x29, 0xad, 0x17, 0x18,
+		0x63, 0xc7, 0x8f, 0x0b, 0x97, 0xc8, 0xe9, 0xae, 0x82, 0xae, 0x43, 0xd3};
+	static const uint8 kResponse2[] = {0x48, 0x83, 0x64, 0x0e, 0xff, 0xc1, 0xc0,
+		0xbf};
+	HpackDecoder responseDecoder;
+	responseDecoder.SetMaxTableSize(256);
+	decoded.clear();
+	responseDecoder.Decode(kResponse1, sizeof(kResponse1), decoded);
+	assert(decoded == (HpackHeaderList{{":status", "302"},
+		{"cache-control", "private"},
+		{"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+		{"location", "https://www.example.com"}}));
+	decoded.clear();
+	responseDecoder.Decode(kResponse2, sizeof(kResponse2), decoded);
+	assert(decoded == (HpackHeaderList{{":status", "307"},
+		{"cache-control", "private"},
+		{"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+		{"location", "https://www.example.com"}}));
+}
+
+
+// Test the decoding of a chunked body with extensions and a trailer section,
+// with the data split at every possible point
+void test_chunked_decoder() {
+	std::string data = "4\r\nWiki\r\n5;name=\"a;b\"\r\npedia\r\n"
+		"E\r\n in\r\n\r\nchunks.\r\n0\r\nExpires: never\r\n\r\nHTTP/1.1";
+	for (size_t split = 1; split < data.size(); split++) {
+		HttpChunkedDecoder decoder;
+		std::string body;
+		size_t used = 0;
+		for (size_t end: {split, data.size()}) {
+			while (used < end && !decoder.IsDone()) {
+				const char* payload;
+				size_t payloadSize;
+				used += decoder.Decode(data.data() + used, end - used, payload,
+					payloadSize);
+				body.append(payload != nullptr ? payload : "", payloadSize);
+			}
+		}
+		assert(decoder.IsDone());
+		assert(body == "Wikipedia in\r\n\r\nchunks.");
+		assert(data.substr(used) == "HTTP/1.1");
+		assert(decoder.Trailers().size() == 1);
+		assert(decoder.Trailers()[0] == "Expires: never");
+	}
+
+	for (const char* invalid: {"x\r\n", "4\r\nWikipedia\r\n", "\r\n"}) {
+		HttpChunkedDecoder decoder;
+		const char* payload;
+		size_t payloadSize;
+		auto exception_thrown = false;
+		try {
+			for (size_t used = 0; used < strlen(invalid);) {
+				used += decoder.Decode(invalid + used, strlen(invalid) - used,
+					payload, payloadSize);
+			}
+		} catch (BPrivate::BError&) {
+			exception_thrown = true;
+		}
+		assert(exception_thrown);
+	}
+}
+
+
+// Test parsing a response head that arrives one byte at a time, from a
+// receive buffer that has to make room for it
+void test_response_parser() {
+	std::string data = "HTTP/1.1 404 Not Found\r\nContent-Length:  12 \r\n"
+		"Invalid\r\nX-Long-Field-Name-For-The-Vector-Scan: a:b\n\r\nbody";
+	ReceiveBuffer buffer(8);
+	HttpResponseParser parser;
+	BHttpStatus status;
+	bool http11 = false;
+	bool statusParsed = false;
+	std::vector<std::string> fields;
+	for (char c: data) {
+		*buffer.Space(1) = c;
+		buffer.Commit(1);
+		while (!parser.IsDone()) {
+			size_t used;
+			if (!statusParsed) {
+				used = parser.ParseStatus(buffer.Data(), buffer.Size(), status,
+					http11);
+				statusParsed = used > 0;
+			} else {
+				const char* name;
+				const char* value;
+				used = parser.ParseField(buffer.Data(), buffer.Size(), name,
+					value);
+				if (name != nullptr)
+					fields.push_back(std::string(name) + "=" + value);
+			}
+			if (used == 0)
+				break;
+			buffer.Consume(used);
+		}
+	}
+	assert(parser.IsDone());
+	assert(http11 && status.code == 404 && status.text == "Not Found");
+	assert(fields == std::vector<std::string>({"Content-Length=12",
+		"X-Long-Field-Name-For-The-Vector-Scan=a:b"}));
+	assert(std::string(buffer.Data(), buffer.Size()) == "body");
+
+	for (const char* invalid: {"HTTP/1.1 2OO OK\r\n", "ICY 200 OK\r\n"}) {
+		std::string line(invalid);
+		auto exception_thrown = false;
+		try {
+			parser.Reset();
+			parser.ParseStatus(line.data(), line.size(), status, http11);
+		} catch (BPrivate::BError&) {
+			exception_thrown = true;
+		}
+		assert(exception_thrown);
+	}
+
+	// Every offset of the vector scan finds the first match
+	std::string line(100, 'x');
+	for (size_t i = 0; i < line.size(); i++) {
+		line[i] = '\n';
+		assert(FindFirstOf(line.data(), line.data() + line.size(), ':', '\n')
+			== line.data() + i);
+		assert(FindFirstOf(line.data() + i + 1, line.data() + line.size(), ':',
+			'\n') == line.data() + line.size());
+		line[i] = 'x';
+	}
+}
+
+
+// Test decoding gzip and deflate bodies that are passed in a byte at a time,
+// into a tiny output window, with decoders that are reused
+void test_content_decoder() {
+	std::string text;
+	for (int i = 0; i < 1000; i++)
+		text += "line " + std::to_string(i) + " of the body\n";
+
+	HttpContentDecoderPool pool;
+	HttpContentDecoder* previous = nullptr;
+	for (auto [encoding, windowBits]: {std::make_pair("gzip", 15 + 16),
+			std::make_pair("deflate", 15)}) {
+		z_stream stream = {};
+		deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits, 8,
+			Z_DEFAULT_STRATEGY);
+		std::string encoded(deflateBound(&stream, text.size()), '\0');
+		stream.next_in = (Bytef*)text.data();
+		stream.avail_in = text.size();
+		stream.next_out = (Bytef*)encoded.data();
+		stream.avail_out = encoded.size();
+		deflate(&stream, Z_FINISH);
+		encoded.resize(stream.total_out);
+		deflateEnd(&stream);
+		encoded += "trailing garbage";
+
+		auto decoder = pool.Get(encoding);
+		assert(decoder != nullptr);
+		assert(previous == nullptr || decoder.get() == previous);
+		std::string decoded;
+		bool end = false;
+		for (size_t offset = 0; offset < encoded.size(); offset++) {
+			const char* input = encoded.data() + offset;
+			size_t inputSize = 1;
+			size_t outputSize;
+			do {
+				char window[7];
+				char* output = window;
+				outputSize = sizeof(window);
+				end = decoder->Decode(input, inputSize, output, outputSize);
+				decoded.append(window, output - window);
+			} while (!end && (inputSize > 0 || outputSize == 0));
+		}
+		assert(end);
+		assert(decoded == text);
+		previous = decoder.get();
+		pool.Put(std::move(decoder));
+	}
+	assert(pool.Get("compress") == nullptr);
+	assert(strstr(HttpContentDecoderPool::AcceptEncoding(), "gzip") != nullptr);
+}
+
+
+static const uint32 kRingTestSize = 16 * 1024 * 1024;
+
+
+static status_t
+write_ring(void* arg)
+{
+	auto ring = static_cast<BHttpRingBuffer*>(arg);
+	char buffer[10000];
+	for (uint32 offset = 0; offset < kRingTestSize;) {
+		size_t size = std::min((size_t)(offset % 9973 + 1),
+			(size_t)(kRingTestSize - offset));
+		for (size_t i = 0; i < size; i++)
+			buffer[i] = (char)((offset + i) % 251);
+		for (size_t written = 0; written < size;) {
+			ssize_t result = ring->Write(buffer + written, size - written);
+			if (result == B_WOULD_BLOCK) {
+				assert(ring->WaitForWrite() == B_OK);
+				continue;
+			}
+			assert(result > 0);
+			written += result;
+		}
+		offset += size;
+	}
+	ring->SetWriteDisabled(true);
+	return B_OK;
+}
+
+
+// Test streaming through a small ring, with reads and writes of all sizes
+// that wrap around its end, and reads that time out
+void test_http_ring_buffer() {
+	BHttpRingBuffer ring(5000);
+	assert(ring.BufferSize() == 8192);
+	char buffer[12000];
+	assert(ring.Read(buffer, sizeof(buffer), 0) == B_WOULD_BLOCK);
+	assert(ring.Read(buffer, sizeof(buffer), 1000) == B_TIMED_OUT);
+
+	thread_id writer = spawn_thread(write_ring, "ring writer",
+		B_NORMAL_PRIORITY, &ring);
+	resume_thread(writer);
+	uint32 offset = 0;
+	while (true) {
+		ssize_t result = ring.Read(buffer, offset % 11987 + 1);
+		assert(result >= 0);
+		if (result == 0)
+			break;
+		for (ssize_t i = 0; i < result; i++)
+			assert(buffer[i] == (char)((offset + i) % 251));
+		offset += result;
+	}
+	assert(offset == kRingTestSize);
+	assert(ring.Write(buffer, 1) == B_NOT_ALLOWED);
+	status_t status;
+	wait_for_thread(writer, &status);
+}
+
+
+// Target that takes its time to write, or that fails
+class SlowTarget : public BDataIO {
+public:
+	SlowTarget(bool fail) : fFail(fail) {}
+
+	ssize_t Write(const void* buffer, size_t size)
+	{
+		snooze(1000);
+		if (fFail)
+			return B_IO_ERROR;
+		written += size;
+		return size;
+	}
+
+	std::atomic<size_t> written{0};
+
+private:
+	bool fFail;
+};
+
+
+static status_t
+write_queued_body(void* arg)
+{
+	static_cast<HttpResultPrivate*>(arg)->WriteQueuedBody(0, []() {});
+	return B_OK;
+}
+
+
+// Test that the completion of a body that a worker writes to its target is
+// only reported once the target has all of it, or once writing it failed
+void test_body_completion() {
+	for (bool fail: {false, true}) {
+		HttpResultPrivate result(1);
+		auto target = new SlowTarget(fail);
+		result.owned_body.reset(target);
+		char buffer[100] = {};
+		bool startWriter = false;
+		for (int i = 0; i < 20; i++)
+			startWriter |= result.WriteToBody(buffer, sizeof(buffer));
+		assert(startWriter);
+
+		std::atomic<int> completed{-1};
+		size_t written = 0;
+		result.SetBody([&](bool success) {
+			written = target->written;
+			completed = success;
+		});
+		assert(completed == -1);
+		assert(result.GetStatusAtomic() != HttpResultPrivate::kBodyReady);
+
+		thread_id writer = spawn_thread(write_queued_body, "body writer",
+			B_NORMAL_PRIORITY, &result);
+		resume_thread(writer);
+		status_t status;
+		wait_for_thread(writer, &status);
+		assert(completed == (fail ? 0 : 1));
+		assert(result.GetStatusAtomic() == (fail
+			? HttpResultPrivate::kError : HttpResultPrivate::kBodyReady));
+		assert(fail || written == 20 * sizeof(buffer));
+	}
+}
+
+
+void test_timer_wheel() {
+	// The wheel is driven by simulated time, starting from the current time
+	TimerWheel wheel(1000);
+	bigtime_t start = system_time();
+	assert(wheel.NextTimeout(start) == B_INFINITE_TIMEOUT);
+
+	// Timers on every level, one beyond the reach of the wheel, and one that
+	// has expired already
+	const bigtime_t offsets[] = { 5000, 1000, 70000, 3000000, 300000000,
+		20000000000LL, -1000 };
+	const size_t count = sizeof(offsets) / sizeof(offsets[0]);
+	TimerWheel::Timer timers[count];
+	for (size_t i = 0; i < count; i++) {
+		timers[i].cookie = &timers[i];
+		timers[i].type = i;
+		wheel.Schedule(timers[i], start + offsets[i]);
+	}
+	assert(wheel.CountTimers() == count);
+
+	// Cancelled and rescheduled timers
+	TimerWheel::Timer cancelled;
+	wheel.Schedule(cancelled, start + 2000);
+	cancelled.Cancel();
+	assert(!cancelled.IsScheduled());
+	wheel.Schedule(timers[0], start + 4000);
+	assert(wheel.CountTimers() == count);
+
+	// Each timer expires after its time has come, and before the next
+	// resolution has passed
+	bigtime_t now = start;
+	size_t expired = 0;
+	while (expired < count) {
+		bigtime_t timeout = wheel.NextTimeout(now);
+		assert(timeout != B_INFINITE_TIMEOUT);
+		now += std::max(timeout, (bigtime_t)1);
+		wheel.Advance(now);
+		while (auto timer = wheel.NextExpired()) {
+			assert(timer->cookie == &timers[timer->type]);
+			assert(!timer->IsScheduled());
+			assert(timer->When() <= now);
+			assert(now - std::max(timer->When(), start) < 2000);
+			expired++;
+		}
+	}
+	assert(wheel.CountTimers() == 0);
+	assert(wheel.NextTimeout(now) == B_INFINITE_TIMEOUT);
+
+	// A timer that is cancelled after it expired is not returned
+	wheel.Schedule(timers[0], now + 1000);
+	wheel.Advance(now + 1000);
+	timers[0].Cancel();
+	assert(wheel.NextExpired() == nullptr);
+}
+
+
+void test_request_scheduler() {
+	typedef RequestScheduler<int, 3> Scheduler;
+	Scheduler scheduler(1000);
+
+	// Values of the same level keep their order, and the higher level goes
+	// first; removed values are skipped
+	std::vector<Scheduler::Position> positions;
+	for (int i = 0; i < 10; i++)
+		positions.push_back(scheduler.Push(int(i), i % 2, 0));
+	assert(scheduler.Remove(positions[3]).value() == 3);
+	assert(!scheduler.Remove(positions[3]));
+	assert(scheduler.Remove(positions[9]).value() == 9);
+	assert(scheduler.Size() == 8);
+	const int expected[] = { 1, 5, 7, 0, 2, 4, 6, 8 };
+	for (int value: expected)
+		assert(scheduler.Pop(0).value() == value);
+	assert(scheduler.IsEmpty() && !scheduler.Pop(0));
+
+	// Values that were taken out cannot be removed again
+	scheduler.Push(42, 1, 0);
+	assert(!scheduler.Remove(positions[9]) && !scheduler.Remove(positions[1]));
+
+	// A value that waited long enough goes before one of a higher level
+	scheduler.Push(43, 2, 2500);
+	assert(scheduler.NextPriority(2500).value() == 3);
+	assert(scheduler.Pop(3000).value() == 42);
+	assert(scheduler.Pop(3000).value() == 43);
+
+	// Removing all values of a long queue, from the back, takes linear time
+	const int kCount = 100000;
+	positions.clear();
+	for (int i = 0; i < kCount; i++)
+		positions.push_back(scheduler.Push(int(i), 0, 0));
+	bigtime_t start = system_time();
+	for (int i = kCount - 1; i >= 0; i--)
+		assert(scheduler.Remove(positions[i]).value() == i);
+	assert(scheduler.IsEmpty());
+	assert(system_time() - start < 1000000);
+}
+
+
+// Write all of \a data to the socket \a fd
+static bool
+write_all(int fd, const std::string& data)
+{
+	for (size_t written = 0; written < data.size();) {
+		ssize_t result = write(fd, data.data() + written, data.size() - written);
+		if (result <= 0)
+			return false;
+		written += result;
+	}
+	return true;
+}
+
+
+// HTTP/1.1 server on the loopback interface, for the tests of the session.
+// Each connection is served by a thread of its own. The handler gets every
+// request with its body, and the number of the connection that it came on
+// (counting from 1), and returns the response. When the response is empty,
+// the connection is reset instead; after a response with "Connection: close"
+// it is closed. A handler may block, to act as a slow server.
+// For other protocols, a connection handler gets the socket instead.
+class TestServer {
+public:
+	typedef std::function<std::string(const std::string& request,
+		int32 connection)> Handler;
+	typedef std::function<void(int fd, int32 connection)> ConnectionHandler;
+
+	TestServer(Handler handler)
+		:
+		TestServer(ConnectionHandler([handler](int fd, int32 connection) {
+				_ServeHttp(fd, connection, handler);
+			}))
+	{
+	}
+
+	TestServer(ConnectionHandler serve)
+		:
+		fServe(serve)
+	{
+		fListener = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t length = sizeof(address);
+		assert(fListener >= 0);
+		assert(bind(fListener, (sockaddr*)&address, sizeof(address)) == 0);
+		assert(listen(fListener, 64) == 0);
+		assert(getsockname(fListener, (sockaddr*)&address, &length) == 0);
+		fPort = ntohs(address.sin_port);
+
+		fAcceptThread = spawn_thread(_AcceptThread, "test server",
+			B_NORMAL_PRIORITY, this);
+		resume_thread(fAcceptThread);
+	}
+
+	~TestServer()
+	{
+		status_t status;
+		shutdown(fListener, SHUT_RDWR);
+		wait_for_thread(fAcceptThread, &status);
+		close(fListener);
+
+		fLock.Lock();
+		for (int fd: fConnections)
+			shutdown(fd, SHUT_RDWR);
+		std::vector<thread_id> threads = fThreads;
+		fLock.Unlock();
+		for (auto thread: threads)
+			wait_for_thread(thread, &status);
+	}
+
+	BUrl Url(const char* path) const
+	{
+		return BUrl(("http://127.0.0.1:" + std::to_string(fPort) + path)
+			.c_str());
+	}
+
+	uint16 Port() const { return fPort; }
+	int32 CountConnections() const { return fConnectionCount; }
+
+private:
+	struct ConnectionInfo {
+		TestServer*	server;
+		int			fd;
+		int32		number;
+	};
+
+	static status_t _AcceptThread(void* arg)
+	{
+		auto server = static_cast<TestServer*>(arg);
+		while (true) {
+			int fd = accept(server->fListener, nullptr, nullptr);
+			if (fd < 0)
+				return B_OK;
+			auto info = new ConnectionInfo{server, fd,
+				++server->fConnectionCount};
+			AutoLocker<BLocker> locker(server->fLock);
+			server->fConnections.push_back(fd);
+			thread_id thread = spawn_thread(_ConnectionThread,
+				"test connection", B_NORMAL_PRIORITY, info);
+			server->fThreads.push_back(thread);
+			resume_thread(thread);
+		}
+	}
+
+	static status_t _ConnectionThread(void* arg)
+	{
+		std::unique_ptr<ConnectionInfo> info(static_cast<ConnectionInfo*>(arg));
+		auto server = info->server;
+		server->fServe(info->fd, info->number);
+
+		AutoLocker<BLocker> locker(server->fLock);
+		server->fConnections.erase(std::find(server->fConnections.begin(),
+			server->fConnections.end(), info->fd));
+		close(info->fd);
+		return B_OK;
+	}
+
+	static void _ServeHttp(int fd, int32 connection, const Handler& handler)
+	{
+		std::string input;
+		char buffer[16384];
+		while (true) {
+			// The request head, and the body of the size that it announces
+			size_t end = input.find("\r\n\r\n");
+			size_t size = std::string::npos;
+			if (end != std::string::npos) {
+				std::string head = input.substr(0, end);
+				std::transform(head.begin(), head.end(), head.begin(), ::tolower);
+				size_t field = head.find("\r\ncontent-length:");
+				size = end + 4 + (field != std::string::npos
+					? strtoul(head.c_str() + field + 17, nullptr, 10) : 0);
+			}
+			if (size == std::string::npos || input.size() < size) {
+				ssize_t bytesRead = read(fd, buffer, sizeof(buffer));
+				if (bytesRead <= 0)
+					break;
+				input.append(buffer, bytesRead);
+				continue;
+			}
+
+			std::string response = handler(input.substr(0, size), connection);
+			input.erase(0, size);
+			if (response.empty()) {
+				// Reset the connection, instead of closing it
+				linger reset = {1, 0};
+				setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+				break;
+			}
+			if (!write_all(fd, response)
+				|| response.find("\r\nConnection: close\r\n")
+					!= std::string::npos)
+				break;
+		}
+	}
+
+	ConnectionHandler		fServe;
+	int						fListener;
+	uint16					fPort;
+	thread_id				fAcceptThread;
+	std::atomic<int32>		fConnectionCount{0};
+	BLocker					fLock;
+	std::vector<int>		fConnections;
+	std::vector<thread_id>	fThreads;
+};
+
+
+// Frame of the HTTP/2 test server
+static std::string
+http2_frame(uint8 type, uint8 flags, int32 stream, const std::string& payload)
+{
+	const char header[] = { char(payload.size() >> 16), char(payload.size() >> 8),
+		char(payload.size()), char(type), char(flags), char(stream >> 24),
+		char(stream >> 16), char(stream >> 8), char(stream) };
+	return std::string(header, sizeof(header)) + payload;
+}
+
+
+// HTTP/2 server (prior knowledge) on the connection \a fd, which waits until
+// \a streams requests are open at the same time before it answers them. It
+// only understands what the session sends for GET requests.
+static void
+serve_http2(int fd, size_t streams)
+{
+	static const uint8 kSettings = 4, kHeaders = 1, kData = 0;
+	static const uint8 kEndStream = 0x1, kAck = 0x1, kEndHeaders = 0x4;
+	static const size_t kPrefaceSize = 24;
+
+	HpackEncoder encoder;
+	std::string input;
+	std::vector<int32> open;
+	bool preface = false;
+	char buffer[16384];
+	if (!write_all(fd, http2_frame(kSettings, 0, 0, "")))
+		return;
+	while (true) {
+		ssize_t bytesRead = read(fd, buffer, sizeof(buffer));
+		if (bytesRead <= 0)
+			return;
+		input.append(buffer, bytesRead);
+		if (!preface) {
+			if (input.size() < kPrefaceSize)
+				continue;
+			input.erase(0, kPrefaceSize);
+			preface = true;
+		}
+
+		std::string output;
+		while (input.size() >= 9) {
+			auto header = (const uint8*)input.data();
+			size_t length = (header[0] << 16) | (header[1] << 8) | header[2];
+			if (input.size() < 9 + length)
+				break;
+			uint8 type = header[3];
+			uint8 flags = header[4];
+			int32 stream = ((header[5] & 0x7f) << 24) | (header[6] << 16)
+				| (header[7] << 8) | header[8];
+			if (type == kSettings && (flags & kAck) == 0)
+				output += http2_frame(kSettings, kAck, 0, "");
+			else if (type == kHeaders && (flags & kEndStream) != 0)
+				open.push_back(stream);
+			input.erase(0, 9 + length);
+		}
+
+		if (open.size() >= streams) {
+			for (int32 stream: open) {
+				std::string block;
+				encoder.Encode(block, {{":status", "200"},
+					{"content-length", "6"}});
+				output += http2_frame(kHeaders, kEndHeaders, stream, block);
+				output += http2_frame(kData, kEndStream, stream, "stream");
+			}
+			open.clear();
+		}
+		if (!write_all(fd, output))
+			return;
+	}
+}
+
+
+// Response of the test server with \a body, and the header lines in \a fields
+static std::string
+http_response(const char* status, const std::string& body,
+	const std::string& fields = "")
+{
+	return std::string("HTTP/1.1 ") + status + "\r\nContent-Length: "
+		+ std::to_string(body.size()) + "\r\n" + fields + "\r\n" + body;
+}
+
+
+// Check whether \a request, as received by the test server, starts with
+// \a line
+static bool
+is_request(const std::string& request, const char* line)
+{
+	return request.compare(0, strlen(line), line) == 0;
+}
+
+
+// Wait up to \a timeout for \a result to complete
+static bool
+wait_for_completion(BHttpResult& result, bigtime_t timeout = 10000000)
+{
+	bigtime_t deadline = system_time() + timeout;
+	while (!result.IsCompleted()) {
+		if (system_time() >= deadline)
+			return false;
+		snooze(10000);
+	}
+	return true;
+}
+
+
 // Test synchronous fetching of haiku-os.org
 void test_http_get_synchronous(BHttpSession session) {
 	auto url = BUrl("https://www.haiku-os.org/");
@@ -64,7 +806,8 @@ public:
 		assert(url.IsValid());
 		auto request = BHttpRequest::Get(url);
 		assert(request);
-		fResult = fSession.AddRequest(std::move(request.value()), nullptr, BMessenger(this));
+		fResult = fSession.AddRequest(std::move(request.value()),
+			std::unique_ptr<BDataIO>(), BMessenger(this));
 	}
 
 	void MessageReceived(BMessage *msg)
@@ -99,6 +842,29 @@ test_http_get_asynchronous(BHttpSession &session)
 }
 
 
+// Test streaming a download through a ring that is much smaller than the
+// body, while the body is being received
+void
+test_http_get_streaming(BHttpSession& session)
+{
+	auto url = BUrl("https://speed.hetzner.de/100MB.bin");
+	assert(url.IsValid());
+	auto request = BHttpRequest::Get(url);
+	assert(request);
+
+	auto ring = std::make_shared<BHttpRingBuffer>(64 * 1024);
+	auto result = session.AddRequest(std::move(request.value()), ring);
+	off_t received = 0;
+	char buffer[16384];
+	while (ssize_t size = ring->Read(buffer, sizeof(buffer))) {
+		assert(size > 0);
+		received += size;
+	}
+	assert(result.Body());
+	assert(received == 100 * 1024 * 1024);
+}
+
+
 void
 test_http_implicit_cancel(BHttpSession& session)
 {
@@ -134,13 +900,616 @@ test_http_explicit_cancel(BHttpSession& session)
 }
 
 
+// Test uploading a body that is larger than what fits in the socket buffers,
+// with a known size and with the chunked encoding
+void
+test_http_post(BHttpSession& session)
+{
+	auto url = BUrl("https://httpbin.org/post");
+	assert(url.IsValid());
+	for (ssize_t size: {(ssize_t)4 * 1024 * 1024, (ssize_t)-1}) {
+		auto request = BHttpRequest::Get(url);
+		assert(request);
+		auto body = new BMallocIO();
+		body->SetSize(4 * 1024 * 1024);
+		request.value().SetMethod(BHttpMethod::Post());
+		request.value().AdoptInputData(body, size);
+
+		auto result = session.AddRequest(std::move(request.value()));
+		auto status = result.Status();
+		assert(status);
+		assert(status.value().get().code == 200);
+		assert(result.Body());
+	}
+}
+
+
+// Test a burst of requests to the same origin, which are pipelined on a few
+// connections; each response has to end up with the request that asked for it
+void
+test_http_pipelining(BHttpSession& session)
+{
+	session.SetMaxPipelineDepth(4);
+	std::vector<BHttpResult> results;
+	for (int i = 0; i < 8; i++) {
+		auto url = BUrl((std::string("http://httpbin.org/get?n=")
+			+ std::to_string(i)).c_str());
+		assert(url.IsValid());
+		auto request = BHttpRequest::Get(url);
+		assert(request);
+		results.push_back(session.AddRequest(std::move(request.value())));
+	}
+
+	for (int i = 0; i < 8; i++) {
+		auto status = results[i].Status();
+		assert(status);
+		assert(status.value().get().code == 200);
+		assert(results[i].Body());
+		auto expected = std::string("\"n\": \"") + std::to_string(i) + "\"";
+		assert(results[i].Body().value().get().text.find(expected)
+			!= std::string::npos);
+	}
+}
+
+
+// Test many concurrent requests that are multiplexed on an HTTP/2 connection.
+// This needs a local server that speaks HTTP/2 over cleartext (prior
+// knowledge), for example:
+//		nghttpd --no-tls -d <directory> 8080
+// with the URL of a file in that directory in HTTP2_TEST_URL, for example
+// http://127.0.0.1:8080/index.html.
+void
+test_http2(BHttpSession& session)
+{
+	const char* testUrl = getenv("HTTP2_TEST_URL");
+	if (testUrl == nullptr) {
+		std::cout << "Skipping the HTTP/2 test; HTTP2_TEST_URL is not set"
+			<< std::endl;
+		return;
+	}
+
+	static const int kRequests = 200;
+	auto url = BUrl(testUrl);
+	assert(url.IsValid());
+	std::vector<BHttpResult> results;
+	for (int i = 0; i < kRequests; i++) {
+		auto request = BHttpRequest::Get(url);
+		assert(request);
+		request.value().SetHttpVersion(BPrivate::Network::B_HTTP_2);
+		results.push_back(session.AddRequest(std::move(request.value())));
+	}
+	// Cancelling one stream leaves the others alone
+	session.Cancel(results[kRequests / 2]);
+
+	std::string expected;
+	for (int i = 0; i < kRequests; i++) {
+		if (i == kRequests / 2)
+			continue;
+		auto status = results[i].Status();
+		assert(status);
+		assert(status.value().get().code == 200);
+		assert(results[i].Body());
+		auto& text = results[i].Body().value().get().text;
+		if (i == 0)
+			expected = text;
+		assert(!text.empty() && text == expected);
+	}
+}
+
+
+// Target that does not take any data until it is released
+class BlockingTarget : public BDataIO {
+public:
+	BlockingTarget(std::atomic<bool>& released) : fReleased(released) {}
+
+	ssize_t Write(const void* buffer, size_t size)
+	{
+		while (!fReleased)
+			snooze(1000);
+		return size;
+	}
+
+private:
+	std::atomic<bool>&	fReleased;
+};
+
+
+// Test that body targets that block do not hold up the body of another
+// request, also when there are more of them than the session has body writers
+void
+test_http_slow_target()
+{
+	std::string body(64 * 1024, 'x');
+	TestServer server([&body](const std::string& request, int32 connection) {
+		return http_response("200 OK", body);
+	});
+	BHttpSession session;
+	session.SetMaxPipelineDepth(1);
+	session.SetMaxRequestsPerHost(16);
+
+	std::atomic<bool> released{false};
+	std::vector<BHttpResult> slow;
+	for (int i = 0; i < 8; i++) {
+		slow.push_back(session.AddRequest(
+			BHttpRequest::Get(server.Url("/slow")).value(),
+			std::make_unique<BlockingTarget>(released)));
+	}
+	auto fast = session.AddRequest(BHttpRequest::Get(server.Url("/fast")).value(),
+		std::make_unique<BMallocIO>());
+	assert(wait_for_completion(fast));
+	assert(fast.Body());
+	for (auto& result: slow)
+		assert(!result.IsCompleted());
+
+	released = true;
+	for (auto& result: slow)
+		assert(result.Body());
+}
+
+
+// Test a retry of a request that was redirected to another origin. The
+// request frees its place at the origin that it started at, so that both
+// origins have room for the next request.
+void
+test_http_redirect_retry()
+{
+	std::atomic<int32> attempts{0};
+	TestServer target([&attempts](const std::string& request,
+			int32 connection) {
+		if (attempts++ == 0)
+			return http_response("503 Service Unavailable", "");
+		return http_response("200 OK", "target");
+	});
+	std::string location = std::string("Location: ")
+		+ target.Url("/").UrlString().String() + "\r\n";
+	TestServer server([&location](const std::string& request,
+			int32 connection) {
+		if (is_request(request, "GET /moved "))
+			return http_response("302 Found", "", location);
+		return http_response("200 OK", "origin");
+	});
+	BHttpSession session;
+	session.SetMaxRequestsPerHost(1);
+	session.SetRetryBackoff(1000, 1000);
+
+	auto result = session.AddRequest(BHttpRequest::Get(server.Url("/moved")).value());
+	assert(result.Body().value().get().text == "target");
+	assert(result.Attempts() == 2);
+
+	auto first = session.AddRequest(BHttpRequest::Get(server.Url("/")).value());
+	auto second = session.AddRequest(BHttpRequest::Get(target.Url("/")).value());
+	assert(wait_for_completion(first) && wait_for_completion(second));
+	assert(first.Body().value().get().text == "origin");
+	assert(second.Body().value().get().text == "target");
+}
+
+
+// Test that the requests that are multiplexed on an HTTP/2 connection share
+// the place of the connection under the limit per host. The server only
+// answers once more streams are open than the limit.
+void
+test_http2_streams()
+{
+	static const size_t kStreams = 12;
+	TestServer server(TestServer::ConnectionHandler(
+		[](int fd, int32 connection) { serve_http2(fd, kStreams); }));
+	BHttpSession session;
+	session.SetMaxRequestsPerHost(6);
+
+	std::vector<BHttpResult> results;
+	for (size_t i = 0; i < kStreams; i++) {
+		auto request = BHttpRequest::Get(server.Url("/")).value();
+		request.SetHttpVersion(BPrivate::Network::B_HTTP_2);
+		results.push_back(session.AddRequest(std::move(request)));
+	}
+	for (auto& result: results) {
+		assert(wait_for_completion(result));
+		assert(result.Body().value().get().text == "stream");
+	}
+	assert(server.CountConnections() == 1);
+}
+
+
+// Test that a request fails when the server accepts it, but does not answer
+// in time
+void
+test_http_response_timeout()
+{
+	std::atomic<bool> released{false};
+	TestServer server([&released](const std::string& request,
+			int32 connection) {
+		while (!released)
+			snooze(1000);
+		return http_response("200 OK", "late");
+	});
+	BHttpSession session;
+	auto request = BHttpRequest::Get(server.Url("/")).value();
+	request.SetResponseTimeout(200000);
+
+	bigtime_t start = system_time();
+	auto result = session.AddRequest(std::move(request));
+	assert(wait_for_completion(result));
+	bigtime_t elapsed = system_time() - start;
+	assert(result.Status().error().Code()
+		== BPrivate::Network::B_HTTP_RESPONSE_TIMEOUT);
+	assert(elapsed >= 200000 && elapsed < 5000000);
+	released = true;
+}
+
+
+// Test that a GET request is tried again when its connection is reset, after
+// it has failed over to a new connection as often as it may, and that a POST
+// request is not
+void
+test_http_retry_reset()
+{
+	std::atomic<int32> requests{0};
+	std::atomic<int32> posts{0};
+	TestServer server([&requests, &posts](const std::string& request,
+			int32 connection) {
+		if (is_request(request, "POST ")) {
+			posts++;
+			return std::string();
+		}
+		if (requests++ < 3)
+			return std::string();
+		return http_response("200 OK", "retried");
+	});
+	BHttpSession session;
+	session.SetRetryBackoff(1000, 1000);
+
+	auto result = session.AddRequest(BHttpRequest::Get(server.Url("/")).value());
+	assert(result.Body().value().get().text == "retried");
+	assert(result.Attempts() == 2);
+	assert(server.CountConnections() == 4);
+
+	auto request = BHttpRequest::Get(server.Url("/post")).value();
+	auto body = new BMallocIO();
+	body->SetSize(1024);
+	request.SetMethod(BHttpMethod::Post());
+	request.AdoptInputData(body, 1024);
+	result = session.AddRequest(std::move(request));
+	assert(!result.Status());
+	assert(result.Attempts() == 1);
+	assert(posts == 1);
+}
+
+
+// Test that the delay before a retry doubles with every attempt, up to the
+// maximum, with up to half of it left out
+void
+test_http_retry_backoff()
+{
+	BLocker lock;
+	std::vector<bigtime_t> times;
+	TestServer server([&lock, &times](const std::string& request,
+			int32 connection) {
+		AutoLocker<BLocker> locker(lock);
+		times.push_back(system_time());
+		return http_response("503 Service Unavailable", "");
+	});
+	BHttpSession session;
+	session.SetRetryBackoff(100000, 300000);
+	session.SetMaxAttempts(5);
+
+	auto result = session.AddRequest(BHttpRequest::Get(server.Url("/")).value());
+	assert(result.Status().value().get().code == 503);
+	assert(result.Attempts() == 5);
+
+	// Delays of 100, 200, 400 (300) and 800 (300) ms, with some room for the
+	// time it takes to send the request again
+	AutoLocker<BLocker> locker(lock);
+	assert(times.size() == 5);
+	const bigtime_t minimum[] = { 50000, 100000, 150000, 150000 };
+	const bigtime_t maximum[] = { 100000, 200000, 300000, 300000 };
+	for (size_t i = 0; i < 4; i++) {
+		bigtime_t delay = times[i + 1] - times[i];
+		assert(delay >= minimum[i] && delay < maximum[i] + 80000);
+	}
+}
+
+
+// Test that requests are no longer tried again once the retry budget has run
+// out. Without requests that pay for them, the budget holds ten retries.
+void
+test_http_retry_budget()
+{
+	TestServer server([](const std::string& request, int32 connection) {
+		return http_response("503 Service Unavailable", "");
+	});
+	BHttpSession session;
+	session.SetRetryBackoff(1000, 1000);
+	session.SetMaxAttempts(3);
+	session.SetRetryBudget(0);
+
+	for (int i = 0; i < 5; i++) {
+		auto result = session.AddRequest(
+			BHttpRequest::Get(server.Url("/")).value());
+		assert(result.Status().value().get().code == 503);
+		assert(result.Attempts() == 3);
+	}
+	auto result = session.AddRequest(BHttpRequest::Get(server.Url("/")).value());
+	assert(result.Status().value().get().code == 503);
+	assert(result.Attempts() == 1);
+}
+
+
+// Test that a request that waits for its next attempt can be cancelled
+void
+test_http_retry_cancel()
+{
+	std::atomic<int32> requests{0};
+	TestServer server([&requests](const std::string& request,
+			int32 connection) {
+		requests++;
+		return http_response("503 Service Unavailable", "");
+	});
+	BHttpSession session;
+	session.SetRetryBackoff(10000000, 10000000);
+
+	auto result = session.AddRequest(BHttpRequest::Get(server.Url("/")).value());
+	while (requests == 0)
+		snooze(1000);
+	snooze(100000);
+	session.Cancel(result);
+	assert(wait_for_completion(result, 2000000));
+	assert(result.Status().error().Code() == B_CANCELED);
+	assert(requests == 1);
+}
+
+
+// Server for the redirect tests. A request for /redirect/<code> is answered
+// with that status and a location of /target, and a request for /loop with a
+// redirect to itself. The last request for /target is kept.
+class RedirectServer {
+public:
+	RedirectServer()
+		:
+		fServer([this](const std::string& request, int32 connection) {
+			return _Respond(request);
+		})
+	{
+	}
+
+	BUrl Url(const char* path) const { return fServer.Url(path); }
+	int32 CountConnections() const { return fServer.CountConnections(); }
+	int32 CountRequests() const { return fRequests; }
+
+	std::string TargetRequest()
+	{
+		AutoLocker<BLocker> locker(fLock);
+		return fTargetRequest;
+	}
+
+private:
+	std::string _Respond(const std::string& request)
+	{
+		fRequests++;
+		std::string path = request.substr(request.find(' ') + 1);
+		path.erase(path.find(' '));
+		if (path.compare(0, 10, "/redirect/") == 0) {
+			return http_response((path.substr(10) + " Redirect").c_str(), "",
+				"Location: /target\r\n");
+		}
+		if (path == "/loop")
+			return http_response("302 Found", "", "Location: /loop\r\n");
+
+		AutoLocker<BLocker> locker(fLock);
+		fTargetRequest = request;
+		return http_response("200 OK", "target");
+	}
+
+	std::atomic<int32>	fRequests{0};
+	BLocker				fLock;
+	std::string			fTargetRequest;
+	TestServer			fServer;
+};
+
+
+// POST request with a body of \a size bytes
+static BHttpRequest
+post_request(const BUrl& url, size_t size)
+{
+	auto request = BHttpRequest::Get(url).value();
+	auto body = new BMallocIO();
+	body->SetSize(size);
+	request.SetMethod(BHttpMethod::Post());
+	request.AdoptInputData(body, size);
+	return request;
+}
+
+
+// Test the redirects that are followed, and the ones that are not
+void
+test_http_redirects()
+{
+	BHttpSession session;
+
+	// A redirect to the same origin stays on the connection
+	{
+		RedirectServer server;
+		auto result = session.AddRequest(
+			BHttpRequest::Get(server.Url("/redirect/302")).value());
+		assert(result.Status().value().get().code == 200);
+		assert(result.Body().value().get().text == "target");
+		assert(is_request(server.TargetRequest(), "GET /target "));
+		assert(server.CountRequests() == 2);
+		assert(server.CountConnections() == 1);
+	}
+
+	// A POST request becomes a GET request without a body after a 301, 302
+	// or 303
+	for (const char* code: {"301", "302", "303"}) {
+		RedirectServer server;
+		auto result = session.AddRequest(post_request(
+			server.Url((std::string("/redirect/") + code).c_str()), 1024));
+		assert(result.Status().value().get().code == 200);
+		std::string target = server.TargetRequest();
+		assert(is_request(target, "GET /target "));
+		assert(target.find("\r\n\r\n") == target.size() - 4);
+		assert(target.find("Content-Length") == std::string::npos);
+	}
+
+	// A request with a body is not sent again after a 307 or 308, as the
+	// body cannot be read again; the redirect is reported
+	for (const char* code: {"307", "308"}) {
+		RedirectServer server;
+		auto result = session.AddRequest(post_request(
+			server.Url((std::string("/redirect/") + code).c_str()), 1024));
+		assert(result.Status().value().get().code == atoi(code));
+		assert(BString(result.Headers().value().get()["Location"]) == "/target");
+		assert(server.CountRequests() == 1);
+	}
+
+	// There are no more redirects than the maximum; the last one is reported
+	{
+		RedirectServer server;
+		auto request = BHttpRequest::Get(server.Url("/loop")).value();
+		request.SetFollowLocation(true, 3);
+		auto result = session.AddRequest(std::move(request));
+		assert(result.Status().value().get().code == 302);
+		assert(server.CountRequests() == 4);
+	}
+
+	// A redirect to another origin goes to a connection to that host
+	{
+		RedirectServer other;
+		std::string location = std::string("Location: ")
+			+ other.Url("/target").UrlString().String() + "\r\n";
+		TestServer origin([&location](const std::string& request,
+				int32 connection) {
+			return http_response("302 Found", "", location);
+		});
+		auto result = session.AddRequest(
+			BHttpRequest::Get(origin.Url("/")).value());
+		assert(result.Body().value().get().text == "target");
+		assert(is_request(other.TargetRequest(), "GET /target "));
+		assert(origin.CountConnections() == 1);
+		assert(other.CountConnections() == 1);
+	}
+
+	// Redirects that are not followed are reported
+	{
+		RedirectServer server;
+		auto request = BHttpRequest::Get(server.Url("/redirect/302")).value();
+		request.SetFollowLocation(false);
+		auto result = session.AddRequest(std::move(request));
+		assert(result.Status().value().get().code == 302);
+		assert(BString(result.Headers().value().get()["Location"]) == "/target");
+		assert(server.CountRequests() == 1);
+	}
+}
+
+
+// Test a burst of redirects to another origin, of which the address is known
+// already, with a single data thread. The data thread sends the redirected
+// requests on by itself, instead of waiting for room in its own queue, which
+// is filled with the requests of the burst.
+void
+test_http_redirect_burst()
+{
+	static const int kRequests = 256;
+	TestServer target([](const std::string& request, int32 connection) {
+		return http_response("200 OK", "target");
+	});
+	std::string location = std::string("Location: ")
+		+ target.Url("/").UrlString().String() + "\r\n";
+	TestServer server([&location](const std::string& request,
+			int32 connection) {
+		return http_response("302 Found", "", location);
+	});
+	BHttpSession session(1);
+	session.SetMaxRequests(kRequests);
+	session.SetMaxRequestsPerHost(kRequests);
+
+	// Resolve the address of the target
+	auto result = session.AddRequest(BHttpRequest::Get(target.Url("/")).value());
+	assert(result.Body());
+
+	std::vector<BHttpResult> results;
+	for (int i = 0; i < kRequests; i++) {
+		results.push_back(session.AddRequest(
+			BHttpRequest::Get(server.Url("/")).value()));
+	}
+	for (auto& result: results) {
+		assert(wait_for_completion(result));
+		assert(result.Body().value().get().text == "target");
+	}
+}
+
+
+// Test that a server that closes every connection after one response, for
+// which the requests counted as pipelined take a connection each after all,
+// never has more connections open at once than the limit per host
+void
+test_http_connection_limit()
+{
+	static const int kRequests = 32;
+	static const int32 kLimit = 2;
+	std::atomic<int32> open{0};
+	std::atomic<int32> maxOpen{0};
+	TestServer server([&open, &maxOpen](const std::string& request,
+			int32 connection) {
+		// Counted until the response is sent, as the session may open
+		// another connection as soon as it has it
+		int32 count = ++open;
+		int32 previous = maxOpen;
+		while (count > previous && !maxOpen.compare_exchange_weak(previous,
+				count)) {
+		}
+		snooze(20000);
+		open--;
+		return http_response("200 OK", "closed", "Connection: close\r\n");
+	});
+	BHttpSession session;
+	session.SetMaxRequests(kRequests);
+	session.SetMaxRequestsPerHost(kLimit);
+	session.SetMaxPipelineDepth(4);
+
+	std::vector<BHttpResult> results;
+	for (int i = 0; i < kRequests; i++) {
+		results.push_back(session.AddRequest(
+			BHttpRequest::Get(server.Url("/")).value()));
+	}
+	for (auto& result: results) {
+		assert(wait_for_completion(result));
+		assert(result.Body().value().get().text == "closed");
+	}
+	assert(server.CountConnections() == kRequests);
+	assert(maxOpen <= kLimit);
+}
+
+
 int
 main(int argc, char** argv) {
 	test_expected();
+	test_hpack();
+	test_chunked_decoder();
+	test_response_parser();
+	test_content_decoder();
+	test_http_ring_buffer();
+	test_body_completion();
+	test_timer_wheel();
+	test_request_scheduler();
+	test_http_slow_target();
+	test_http_redirect_retry();
+	test_http2_streams();
+	test_http_response_timeout();
+	test_http_retry_reset();
+	test_http_retry_backoff();
+	test_http_retry_budget();
+	test_http_retry_cancel();
+	test_http_redirects();
+	test_http_redirect_burst();
+	test_http_connection_limit();
 	auto session = BHttpSession();
 	test_http_get_synchronous(session);
 	test_http_get_asynchronous(session);
+	test_http_get_streaming(session);
 	test_http_implicit_cancel(session);
 	test_http_explicit_cancel(session);
+	test_http_post(session);
+	test_http_pipelining(session);
+	test_http2(session);
 	return 0;
 }